@@ -0,0 +1,355 @@
+/*
+ * Description :  Microbenchmark for the xvcpi shift kernel
+ *
+ *                Calls jtag_shift() directly, without networking, for a
+ *                set of TMS/TDI patterns, vector lengths and delays and
+ *                reports ns/bit and cycles/bit for each GPIO backend.
+ *
+ *                Hardware backends really clock the pins.  Random TMS can
+ *                load any instruction into a connected device, so only
+ *                run them with the target disconnected or expendable.
+ *
+ * See Licensing information at End of File.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include "jtag.h"
+#include "vcd.h"
+
+int verbose = 0;
+
+#define MAX_CASES (16)
+
+enum pattern { PAT_ZERO, PAT_ONE, PAT_RANDOM, PAT_TMS0, PAT_MIXED, PAT_COUNT };
+
+static const char *const pattern_names[PAT_COUNT] = {
+   "zero", "one", "random", "tms0-run", "mixed",
+};
+
+static uint32_t xorshift32(uint32_t *state)
+{
+   uint32_t x = *state;
+   x ^= x << 13;
+   x ^= x >> 17;
+   x ^= x << 5;
+   return *state = x;
+}
+
+static void set_bit(uint8_t *buf, int i, int v)
+{
+   if (v)
+      buf[i / 8] |= 1 << (i % 8);
+   else
+      buf[i / 8] &= ~(1 << (i % 8));
+}
+
+static void make_pattern(enum pattern pat, int bits, uint8_t *tms, uint8_t *tdi)
+{
+   /* Short scans as hw_server issues them: enter, 6 bits, exit, idle */
+   static const uint8_t scan_tms[10] = { 1, 0, 0, 0, 0, 0, 0, 1, 1, 0 };
+   uint32_t seed = 0x2545f491;
+   size_t nr_bytes = (bits + 7) / 8;
+
+   memset(tms, 0, nr_bytes);
+   memset(tdi, 0, nr_bytes);
+   for (int i = 0; i < bits; i++) {
+      switch (pat) {
+      case PAT_ZERO:
+         break;
+      case PAT_ONE:
+         set_bit(tdi, i, 1);
+         break;
+      case PAT_RANDOM: {
+         uint32_t r = xorshift32(&seed);
+         set_bit(tms, i, r & 1);
+         set_bit(tdi, i, (r >> 1) & 1);
+         break;
+      }
+      case PAT_TMS0:
+         set_bit(tms, i, i == bits - 1);
+         set_bit(tdi, i, xorshift32(&seed) & 1);
+         break;
+      case PAT_MIXED:
+         set_bit(tms, i, scan_tms[i % 10]);
+         set_bit(tdi, i, xorshift32(&seed) & 1);
+         break;
+      default:
+         break;
+      }
+   }
+}
+
+/* CPU cycle counter via perf; -1 when not permitted */
+static int cycles_open(void)
+{
+   struct perf_event_attr attr;
+
+   memset(&attr, 0, sizeof(attr));
+   attr.size = sizeof(attr);
+   attr.type = PERF_TYPE_HARDWARE;
+   attr.config = PERF_COUNT_HW_CPU_CYCLES;
+   attr.disabled = 1;
+   int fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+   if (fd < 0) {
+      attr.exclude_kernel = 1;
+      fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+   }
+   return fd;
+}
+
+static int parse_list(const char *arg, int *list)
+{
+   int n = 0;
+   char *copy = strdup(arg), *save = NULL;
+
+   for (char *t = strtok_r(copy, ",", &save); t && n < MAX_CASES;
+        t = strtok_r(NULL, ",", &save))
+      list[n++] = atoi(t);
+   free(copy);
+   return n;
+}
+
+static void bench_backend(struct jtag_gpio *g, const int *delays, int ndelays,
+                          const int *lengths, int nlengths, int case_ms, int cycles_fd)
+{
+   int max_bits = 0;
+
+   for (int l = 0; l < nlengths; l++)
+      if (lengths[l] > max_bits)
+         max_bits = lengths[l];
+   size_t max_bytes = (max_bits + 7) / 8;
+   uint8_t *tms = malloc(max_bytes), *tdi = malloc(max_bytes), *tdo = malloc(max_bytes);
+
+   for (int d = 0; d < ndelays; d++) {
+      delay_set_loops(&g->delay, delays[d]);
+      for (int p = 0; p < PAT_COUNT; p++) {
+         for (int l = 0; l < nlengths; l++) {
+            uint64_t bits = 0, cycles = 0, t0, t;
+
+            make_pattern(p, lengths[l], tms, tdi);
+            if (cycles_fd >= 0) {
+               ioctl(cycles_fd, PERF_EVENT_IOC_RESET, 0);
+               ioctl(cycles_fd, PERF_EVENT_IOC_ENABLE, 0);
+            }
+            t0 = now_ns();
+            do {
+               jtag_shift(g, lengths[l], tms, tdi, tdo);
+               bits += lengths[l];
+               t = now_ns() - t0;
+            } while (t < case_ms * 1000000ULL);
+            if (cycles_fd >= 0) {
+               ioctl(cycles_fd, PERF_EVENT_IOC_DISABLE, 0);
+               if (read(cycles_fd, &cycles, sizeof(cycles)) != sizeof(cycles))
+                  cycles = 0;
+            } else if (timing.cur_khz) {
+               /* Estimate from the clock when perf is unavailable */
+               cycles = t * timing.cur_khz / 1000000;
+            }
+
+            printf("%-10s %-9s %6d %-9s %7d %10.2f ", g->be->name, g->kernel_name,
+                   delays[d], pattern_names[p], lengths[l], (double)t / bits);
+            if (cycles)
+               printf("%10.1f\n", (double)cycles / bits);
+            else
+               printf("%10s\n", "-");
+         }
+      }
+   }
+   free(tms);
+   free(tdi);
+   free(tdo);
+}
+
+static void trace_event(struct tap_trace *t, enum tap_event ev)
+{
+   (void)t;
+   (void)ev;
+}
+
+/* -T: the TAP tracker xvcpi -t runs after each shift, on the same patterns */
+static void bench_trace(const int *lengths, int nlengths, int case_ms, int cycles_fd)
+{
+   int max_bits = 0;
+
+   for (int l = 0; l < nlengths; l++)
+      if (lengths[l] > max_bits)
+         max_bits = lengths[l];
+   size_t max_bytes = (max_bits + 7) / 8;
+   uint8_t *tms = malloc(max_bytes), *tdi = malloc(max_bytes);
+   struct tap_trace trace;
+
+   for (int p = 0; p < PAT_COUNT; p++) {
+      for (int l = 0; l < nlengths; l++) {
+         uint64_t bits = 0, cycles = 0, t0, t;
+
+         make_pattern(p, lengths[l], tms, tdi);
+         tap_trace_init(&trace, trace_event, NULL);
+         if (cycles_fd >= 0) {
+            ioctl(cycles_fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(cycles_fd, PERF_EVENT_IOC_ENABLE, 0);
+         }
+         t0 = now_ns();
+         do {
+            for (int i = 0; i < 64; i++)
+               tap_trace_shift(&trace, lengths[l], tms, tdi);
+            bits += 64 * lengths[l];
+            t = now_ns() - t0;
+         } while (t < case_ms * 1000000ULL);
+         if (cycles_fd >= 0) {
+            ioctl(cycles_fd, PERF_EVENT_IOC_DISABLE, 0);
+            if (read(cycles_fd, &cycles, sizeof(cycles)) != sizeof(cycles))
+               cycles = 0;
+         } else if (timing.cur_khz) {
+            cycles = t * timing.cur_khz / 1000000;
+         }
+
+         printf("%-10s %-9s %6s %-9s %7d %10.3f ", "-", "tap-trace", "-",
+                pattern_names[p], lengths[l], (double)t / bits);
+         if (cycles)
+            printf("%10.2f\n", (double)cycles / bits);
+         else
+            printf("%10s\n", "-");
+      }
+   }
+   free(tms);
+   free(tdi);
+}
+
+int main(int argc, char **argv)
+{
+   const char *backends[MAX_CASES];
+   int nbackends = 0;
+   bool all = false, trace = false;
+   int delays[MAX_CASES] = { 0, 10, JTAG_DELAY };
+   int ndelays = 3;
+   int lengths[MAX_CASES] = { 32, 256, 1024, 8192 };
+   int nlengths = 4;
+   int case_ms = 50;
+   const char *vcd_file = NULL;
+   struct jtag_gpio g = { .pins = { .tck = 11, .tms = 25, .tdi = 10, .tdo = 9 } };
+   int c;
+
+   while ((c = getopt(argc, argv, "vwaTb:d:l:t:c:m:i:o:V:")) != -1) {
+      switch (c) {
+      case 'v':
+         verbose = 1;
+         break;
+      case 'w':
+         timing.counter_wait = true;
+         break;
+      case 'a':
+         all = true;
+         break;
+      case 'T':
+         trace = true;
+         break;
+      case 'V':
+         vcd_file = optarg;
+         break;
+      case 'b':
+         if (nbackends < MAX_CASES)
+            backends[nbackends++] = optarg;
+         break;
+      case 'd':
+         ndelays = parse_list(optarg, delays);
+         break;
+      case 'l':
+         nlengths = parse_list(optarg, lengths);
+         break;
+      case 't':
+         case_ms = atoi(optarg);
+         break;
+      case 'c':
+         g.pins.tck = atoi(optarg);
+         break;
+      case 'm':
+         g.pins.tms = atoi(optarg);
+         break;
+      case 'i':
+         g.pins.tdi = atoi(optarg);
+         break;
+      case 'o':
+         g.pins.tdo = atoi(optarg);
+         break;
+      default:
+         fprintf(stderr, "usage: %s [-v] [-w] [-a] [-T] [-b backend]... [-d delays] [-l lengths] [-t ms]\n"
+                         "          [-V file.vcd] [-c tck_pin] [-m tms_pin] [-i tdi_pin] [-o tdo_pin]\n", *argv);
+         fprintf(stderr, "  -a          : every usable backend, not just mock (clocks the pins!)\n");
+         fprintf(stderr, "  -b backend  : benchmark this backend (repeatable)\n");
+         fprintf(stderr, "  -T          : benchmark the TAP tracker of -t instead\n");
+         fprintf(stderr, "  -V file     : capture the shifts to a VCD file, as xvcpi -V does\n");
+         fprintf(stderr, "  -d delays   : comma separated delays (default: 0,10,%d)\n", JTAG_DELAY);
+         fprintf(stderr, "  -l lengths  : comma separated vector lengths in bits (default: 32,256,1024,8192)\n");
+         fprintf(stderr, "  -t ms       : time per case (default: 50)\n");
+         return 1;
+      }
+   }
+   if (!nbackends && !all && !trace)
+      backends[nbackends++] = "mock";
+   for (int b = 0; b < nbackends; b++)
+      if (!gpio_backend_find(backends[b])) {
+         fprintf(stderr, "Unknown GPIO backend '%s'\n", backends[b]);
+         return 1;
+      }
+   for (int l = 0; l < nlengths; l++)
+      if (lengths[l] <= 0) {
+         fprintf(stderr, "Invalid vector length %d\n", lengths[l]);
+         return 1;
+      }
+
+   timing_init();
+   int cycles_fd = cycles_open();
+   if (cycles_fd < 0 && verbose)
+      printf("perf cycle counter unavailable, estimating from cpufreq\n");
+
+   printf("%-10s %-9s %6s %-9s %7s %10s %10s\n",
+          "backend", "kernel", "delay", "pattern", "bits", "ns/bit", "cycles/bit");
+
+   if (trace)
+      bench_trace(lengths, nlengths, case_ms, cycles_fd);
+
+   for (int i = 0; gpio_backends[i]; i++) {
+      const struct gpio_backend *be = gpio_backends[i];
+      bool selected = all;
+
+      for (int b = 0; b < nbackends; b++)
+         if (strcmp(backends[b], be->name) == 0)
+            selected = true;
+      if (!selected)
+         continue;
+      if (!gpio_open(&g, be->name))
+         continue;
+      if (vcd_file && !(g.vcd = vcd_open(vcd_file, 0))) {
+         gpio_close(&g);
+         return 1;
+      }
+      bench_backend(&g, delays, ndelays, lengths, nlengths, case_ms, cycles_fd);
+      if (g.vcd) {
+         /* Whatever the writer has left counts too */
+         uint64_t t0 = now_ns();
+         vcd_close(g.vcd);
+         g.vcd = NULL;
+         printf("%-10s VCD written %.1f ms after the last case\n", be->name,
+                (now_ns() - t0) / 1e6);
+      }
+      gpio_close(&g);
+   }
+
+   if (cycles_fd >= 0)
+      close(cycles_fd);
+   return 0;
+}
+
+/*
+ * This work, "bench_xfer.c", is part of "xvcpi.c"
+ * Updated for modern Raspberry Pi systems using libgpiod
+ *
+ * Original "xvcpi.c" is licensed under CC0 1.0 Universal
+ * by Derek Mulcahy.
+ */
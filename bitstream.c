@@ -0,0 +1,337 @@
+/*
+ * Description :  Xilinx bitstream programmer for the xvcpi JTAG engine
+ *
+ *                Configures a 7-series or UltraScale FPGA straight from a
+ *                .bit or .bin file: JPROGRAM, wait for INIT_COMPLETE,
+ *                CFG_IN with the payload, JSTART, then DONE and the STAT
+ *                register are checked.  The file is memory-mapped and
+ *                streamed through the shift engine a chunk at a time,
+ *                bit-reversing each byte on the way, so memory use does
+ *                not depend on the bitstream size.
+ *
+ *                The FPGA must be the only device on the chain.
+ *
+ * See Licensing information at End of File.
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "bitstream.h"
+
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+/* 7-series and UltraScale JTAG instructions */
+#define IR_LEN          (6)
+#define IR_CFG_OUT      (0x04)
+#define IR_CFG_IN       (0x05)
+#define IR_JPROGRAM     (0x0b)
+#define IR_JSTART       (0x0c)
+#define IR_BYPASS       (0x3f)
+
+/* IR capture value */
+#define IR_INIT_COMPLETE (1u << 4)
+#define IR_DONE         (1u << 5)
+
+/* STAT register */
+#define STAT_CRC_ERROR  (1u << 0)
+#define STAT_INIT_B     (1u << 12)
+#define STAT_DONE       (1u << 14)
+
+#define XILINX_IDCODE_MASK (0x00000fff)
+#define XILINX_IDCODE   (0x00000093)  /* manufacturer 0x49 */
+
+#define CHUNK_BYTES     (16 * 1024)
+#define INIT_TIMEOUT_MS (1000)
+#define STARTUP_CLOCKS  (2000)
+
+static const uint8_t sync_word[4] = { 0xaa, 0x99, 0x55, 0x66 };
+
+/* Sync, NOOP, read STAT (type 1, one word), NOOP, NOOP */
+static const uint8_t stat_read[] = {
+   0xaa, 0x99, 0x55, 0x66, 0x20, 0x00, 0x00, 0x00, 0x28, 0x00, 0xe0, 0x01,
+   0x20, 0x00, 0x00, 0x00, 0x20, 0x00, 0x00, 0x00,
+};
+
+/* Write CMD = DESYNC, NOOP, NOOP */
+static const uint8_t desync[] = {
+   0x30, 0x00, 0x80, 0x01, 0x00, 0x00, 0x00, 0x0d, 0x20, 0x00, 0x00, 0x00,
+   0x20, 0x00, 0x00, 0x00,
+};
+
+#define R2(n) n, n + 2 * 64, n + 1 * 64, n + 3 * 64
+#define R4(n) R2(n), R2(n + 2 * 16), R2(n + 1 * 16), R2(n + 3 * 16)
+#define R6(n) R4(n), R4(n + 2 * 4), R4(n + 1 * 4), R4(n + 3 * 4)
+static const uint8_t bitrev[256] = { R6(0), R6(2), R6(1), R6(3) };
+
+struct bit_header {
+   const char *field[4];       /* design, part, date, time */
+   int field_len[4];
+   const uint8_t *data;
+   size_t len;
+};
+
+struct programmer {
+   struct jtag_gpio *g;
+   uint8_t *tms, *tdi;         /* CHUNK_BYTES each; TDO is not sampled */
+};
+
+/*
+ * Configuration data goes MSB first, JTAG shifts LSB first: every byte
+ * is reversed as it is copied into the engine's TDI buffer.
+ */
+static void reverse_bytes(uint8_t *dst, const uint8_t *src, size_t n)
+{
+   size_t i = 0;
+
+#if defined(__aarch64__)
+   for (; i + 16 <= n; i += 16)
+      vst1q_u8(dst + i, vrbitq_u8(vld1q_u8(src + i)));
+#endif
+   for (; i < n; i++)
+      dst[i] = bitrev[src[i]];
+}
+
+static uint32_t bitrev32(uint32_t x)
+{
+   return (uint32_t)bitrev[x & 0xff] << 24 | (uint32_t)bitrev[(x >> 8) & 0xff] << 16 |
+          (uint32_t)bitrev[(x >> 16) & 0xff] << 8 | bitrev[x >> 24];
+}
+
+static unsigned int be16(const uint8_t *p)
+{
+   return p[0] << 8 | p[1];
+}
+
+static uint32_t be32(const uint8_t *p)
+{
+   return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | p[2] << 8 | p[3];
+}
+
+/*
+ * .bit: a 9 byte preamble, then fields 'a'-'d' (design, part, date,
+ * time) with 16-bit lengths and 'e' with the 32-bit payload length.
+ */
+static bool parse_bit(const uint8_t *p, size_t size, struct bit_header *h)
+{
+   const uint8_t *end = p + size;
+   size_t n;
+
+   if (size < 4 || (n = be16(p)) > size - 4)
+      return false;
+   p += 2 + n;
+   if (be16(p) != 1)
+      return false;
+   p += 2;
+
+   while (p < end) {
+      int key = *p++;
+      if (key == 'e') {
+         if (end - p < 4)
+            return false;
+         h->len = be32(p);
+         h->data = p + 4;
+         return h->len <= (size_t)(end - h->data);
+      }
+      if (key < 'a' || key > 'd' || end - p < 2 || (n = be16(p)) > (size_t)(end - p - 2))
+         return false;
+      h->field[key - 'a'] = (const char *)p + 2;
+      h->field_len[key - 'a'] = n && !p[2 + n - 1] ? n - 1 : n;
+      p += 2 + n;
+   }
+   return false;
+}
+
+/* .bin: the raw payload, which has a sync word near the start */
+static bool is_bin(const uint8_t *p, size_t size)
+{
+   for (size_t i = 0; i + 4 <= size && i < 1024; i++)
+      if (!memcmp(p + i, sync_word, 4))
+         return true;
+   return false;
+}
+
+/* Load an instruction from Run-Test/Idle and return there; returns the IR capture */
+static uint32_t ir_scan(struct jtag_gpio *g, uint32_t ir)
+{
+   gpio_xfer(g, 4, 0x3, 0);            /* RTI -> Shift-IR */
+   uint32_t capture = gpio_xfer(g, IR_LEN, 1u << (IR_LEN - 1), ir);
+   gpio_xfer(g, 2, 0x1, 0);            /* Exit1-IR -> RTI */
+   return capture;
+}
+
+/*
+ * Shift bytes into the DR MSB first, from Run-Test/Idle back to it.
+ * With drop, pages of a file mapping are released once shifted.
+ */
+static bool dr_write(struct programmer *pr, const uint8_t *data, size_t len,
+                     bool drop, const volatile sig_atomic_t *running)
+{
+   struct jtag_gpio *g = pr->g;
+   const uintptr_t page = sysconf(_SC_PAGESIZE);
+   uintptr_t dropped = (uintptr_t)data & ~(page - 1);
+
+   gpio_xfer(g, 3, 0x1, 0);            /* RTI -> Shift-DR */
+   while (len) {
+      size_t n = len < CHUNK_BYTES ? len : CHUNK_BYTES;
+
+      if (running && !*running)
+         return false;
+      timing_poll();
+      reverse_bytes(pr->tdi, data, n);
+      if (n == len)
+         pr->tms[n - 1] = 0x80;        /* last bit leaves Shift-DR */
+      jtag_shift(g, n * 8, pr->tms, pr->tdi, NULL);
+      pr->tms[n - 1] = 0;
+      data += n;
+      len -= n;
+
+      uintptr_t upto = (uintptr_t)data & ~(page - 1);
+      if (drop && upto > dropped) {
+         madvise((void *)dropped, upto - dropped, MADV_DONTNEED);
+         dropped = upto;
+      }
+   }
+   gpio_xfer(g, 2, 0x1, 0);            /* Exit1-DR -> RTI */
+   return true;
+}
+
+static uint32_t read_stat(struct programmer *pr)
+{
+   struct jtag_gpio *g = pr->g;
+   uint32_t stat;
+
+   ir_scan(g, IR_CFG_IN);
+   dr_write(pr, stat_read, sizeof(stat_read), false, NULL);
+   ir_scan(g, IR_CFG_OUT);
+   gpio_xfer(g, 3, 0x1, 0);
+   stat = bitrev32(gpio_xfer(g, 32, 1u << 31, 0));
+   gpio_xfer(g, 2, 0x1, 0);
+   ir_scan(g, IR_CFG_IN);
+   dr_write(pr, desync, sizeof(desync), false, NULL);
+   ir_scan(g, IR_BYPASS);
+   return stat;
+}
+
+static int program(struct programmer *pr, const char *path, const uint8_t *data,
+                   size_t len, const volatile sig_atomic_t *running)
+{
+   struct jtag_gpio *g = pr->g;
+   uint32_t idcode, capture;
+
+   gpio_xfer(g, 6, 0x1f, 0);           /* Test-Logic-Reset, RTI */
+   gpio_xfer(g, 3, 0x1, 0);            /* IDCODE is selected by the reset */
+   idcode = gpio_xfer(g, 32, 1u << 31, 0);
+   gpio_xfer(g, 2, 0x1, 0);
+   if ((idcode & XILINX_IDCODE_MASK) != XILINX_IDCODE) {
+      fprintf(stderr, "%s: no Xilinx device on the chain (IDCODE 0x%08x)\n", path, idcode);
+      return -1;
+   }
+   if (verbose)
+      printf("%s: IDCODE 0x%08x\n", path, idcode);
+
+   /* Clear the configuration memory */
+   ir_scan(g, IR_JPROGRAM);
+   uint64_t deadline = now_ns() + INIT_TIMEOUT_MS * 1000000ULL;
+   while (!((capture = ir_scan(g, IR_BYPASS)) & IR_INIT_COMPLETE)) {
+      if (now_ns() > deadline) {
+         fprintf(stderr, "%s: INIT_COMPLETE not set after JPROGRAM (IR 0x%02x)\n",
+                 path, capture);
+         return -1;
+      }
+      usleep(1000);
+   }
+
+   uint64_t t0 = now_ns();
+   ir_scan(g, IR_CFG_IN);
+   if (!dr_write(pr, data, len, true, running)) {
+      fprintf(stderr, "%s: cancelled, device left unconfigured\n", path);
+      return -1;
+   }
+   double secs = (now_ns() - t0) / 1e9;
+
+   /* Start-up sequence */
+   ir_scan(g, IR_JSTART);
+   jtag_shift(g, STARTUP_CLOCKS, pr->tms, pr->tdi, NULL);
+
+   capture = ir_scan(g, IR_BYPASS);
+   uint32_t stat = read_stat(pr);
+   bool done = (capture & IR_DONE) && (stat & STAT_DONE);
+
+   printf("%s: %s, %zu bytes in %.3f s (%.1f kHz), STAT 0x%08x%s\n",
+          path, done ? "DONE" : "DONE not set", len, secs,
+          secs > 0 ? len * 8 / secs / 1000 : 0, stat,
+          stat & STAT_CRC_ERROR ? " (CRC error)" : "");
+   return done ? 0 : 1;
+}
+
+int bitstream_program(struct jtag_gpio *g, const char *path,
+                      const volatile sig_atomic_t *running)
+{
+   struct bit_header h = { 0 };
+   struct programmer pr = { .g = g };
+   struct stat st;
+   int fd, result = -1;
+
+   fd = open(path, O_RDONLY);
+   if (fd < 0 || fstat(fd, &st) < 0) {
+      perror(path);
+      if (fd >= 0)
+         close(fd);
+      return -1;
+   }
+   if (!st.st_size) {
+      fprintf(stderr, "%s: empty file\n", path);
+      close(fd);
+      return -1;
+   }
+   uint8_t *file = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+   close(fd);
+   if (file == MAP_FAILED) {
+      perror(path);
+      return -1;
+   }
+   madvise(file, st.st_size, MADV_SEQUENTIAL);
+
+   if (parse_bit(file, st.st_size, &h)) {
+      if (verbose) {
+         static const char *const names[] = { "Design", "Part", "Date", "Time" };
+         for (int i = 0; i < 4; i++)
+            if (h.field[i])
+               printf("%s: %s %.*s\n", path, names[i], h.field_len[i], h.field[i]);
+      }
+   } else if (is_bin(file, st.st_size)) {
+      h.data = file;
+      h.len = st.st_size;
+   } else {
+      fprintf(stderr, "%s: not a .bit or .bin bitstream\n", path);
+      goto out;
+   }
+
+   pr.tms = calloc(2, CHUNK_BYTES);
+   if (!pr.tms) {
+      perror("calloc");
+      goto out;
+   }
+   pr.tdi = pr.tms + CHUNK_BYTES;
+   result = program(&pr, path, h.data, h.len, running);
+   free(pr.tms);
+
+out:
+   munmap(file, st.st_size);
+   return result;
+}
+
+/*
+ * This work, "bitstream.c", is part of "xvcpi.c"
+ * Updated for modern Raspberry Pi systems using libgpiod
+ *
+ * Original "xvcpi.c" is licensed under CC0 1.0 Universal
+ * by Derek Mulcahy.
+ */
@@ -0,0 +1,29 @@
+/*
+ * Description :  Xilinx bitstream programmer for the xvcpi JTAG engine
+ *
+ * See Licensing information at End of File.
+ */
+
+#ifndef XVCPI_BITSTREAM_H
+#define XVCPI_BITSTREAM_H
+
+#include <signal.h>
+#include "jtag.h"
+
+/*
+ * Configure the FPGA on a chain from a .bit or .bin file.  Returns 0
+ * when the device reports DONE, 1 when it does not and -1 on any other
+ * error.  Programming stops between chunks once *running drops to zero.
+ */
+int bitstream_program(struct jtag_gpio *g, const char *path,
+                      const volatile sig_atomic_t *running);
+
+#endif
+
+/*
+ * This work, "bitstream.h", is part of "xvcpi.c"
+ * Updated for modern Raspberry Pi systems using libgpiod
+ *
+ * Original "xvcpi.c" is licensed under CC0 1.0 Universal
+ * by Derek Mulcahy.
+ */
@@ -0,0 +1,88 @@
+/*
+ * Description :  Shared-memory ring between the xvcpi cosim backend and
+ *                an RTL simulation of the JTAG target (cosim_shim.c)
+ *
+ * See Licensing information at End of File.
+ */
+
+#ifndef XVCPI_COSIM_H
+#define XVCPI_COSIM_H
+
+#include <limits.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+/*
+ * xvcpi creates the ring in /dev/shm, named after the TCK pin of the
+ * chain so that each chain of a config file gets its own, and removes it
+ * when it exits.  The simulator attaches with cosim_shim.c.
+ *
+ * Whole vectors go through the ring: xvcpi fills slot posted % SLOTS and
+ * bumps posted; the simulator clocks the vector through the RTL at its
+ * own speed, fills in TDO and bumps done.  Vectors whose TDO is not read
+ * are posted without waiting, up to COSIM_SLOTS ahead.  Both counters
+ * are futex words, so neither side polls while the other works.
+ */
+#define COSIM_PATH      "/dev/shm/xvcpi-cosim-%d"
+#define COSIM_MAGIC     (0x4d534358)   /* "XCSM" */
+#define COSIM_VERSION   (1)
+#define COSIM_SLOTS     (8)
+#define COSIM_MAX_BITS  (64 * 1024)    /* per vector, as VEC_MAX_BITS */
+
+#define COSIM_NO_TDO    (1u << 0)      /* TDO is not read back */
+
+struct cosim_slot {
+   uint32_t bits;
+   uint32_t flags;
+   uint8_t tms[COSIM_MAX_BITS / 8];
+   uint8_t tdi[COSIM_MAX_BITS / 8];
+   uint8_t tdo[COSIM_MAX_BITS / 8];
+};
+
+struct cosim_ring {
+   uint32_t magic;
+   uint32_t version;
+   uint32_t posted;            /* vectors written by xvcpi */
+   uint32_t done;              /* vectors the simulator has finished */
+   int32_t sim_pid;            /* attached simulator, 0: none */
+   uint32_t closed;            /* xvcpi has exited */
+   struct cosim_slot slot[COSIM_SLOTS];
+};
+
+static inline uint32_t cosim_load(const uint32_t *word)
+{
+   return __atomic_load_n(word, __ATOMIC_ACQUIRE);
+}
+
+static inline void cosim_store(uint32_t *word, uint32_t val)
+{
+   __atomic_store_n(word, val, __ATOMIC_RELEASE);
+   syscall(SYS_futex, word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+/*
+ * Wait while *word is still val, at most timeout_ms.  A short spin first
+ * catches simulators that answer within microseconds.
+ */
+static inline void cosim_wait(uint32_t *word, uint32_t val, int timeout_ms)
+{
+   struct timespec ts = { timeout_ms / 1000, (timeout_ms % 1000) * 1000000L };
+
+   for (int i = 0; i < 1000; i++)
+      if (cosim_load(word) != val)
+         return;
+   syscall(SYS_futex, word, FUTEX_WAIT, val, &ts, NULL, 0);
+}
+
+#endif
+
+/*
+ * This work, "cosim.h", is part of "xvcpi.c"
+ * Updated for modern Raspberry Pi systems using libgpiod
+ *
+ * Original "xvcpi.c" is licensed under CC0 1.0 Universal
+ * by Derek Mulcahy.
+ */
@@ -0,0 +1,232 @@
+/*
+ * Description :  Simulator side of the xvcpi cosim backend
+ *
+ *                Compiled into a Verilator model as DPI-C functions, or
+ *                with -DCOSIM_VPI into an Icarus Verilog VPI module
+ *                (iverilog-vpi), as $xvc_cosim_* system tasks.  The
+ *                testbench (cosim_tb.v) takes one vector at a time from
+ *                xvcpi and clocks it through the RTL itself:
+ *
+ *                   xvc_cosim_attach(path)   0 once attached to xvcpi
+ *                   xvc_cosim_next()         bits of the next vector,
+ *                                            -1 when xvcpi has exited
+ *                   xvc_cosim_bit(i)         TMS in bit 0, TDI in bit 1
+ *                   xvc_cosim_tdo(i, v)      TDO seen for bit i
+ *                   xvc_cosim_done()         the vector is finished
+ *
+ *                Only these calls cross into C; the waiting for xvcpi
+ *                happens once per vector, not per bit.
+ *
+ * See Licensing information at End of File.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "cosim.h"
+
+static struct cosim_ring *ring;
+static struct cosim_slot *slot;        /* the vector being simulated */
+
+static bool ring_map(const char *path)
+{
+   struct stat st;
+   int fd = open(path, O_RDWR);
+
+   if (fd < 0)
+      return false;
+   if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(*ring)) {
+      close(fd);
+      return false;
+   }
+   ring = mmap(NULL, sizeof(*ring), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+   close(fd);
+   if (ring == MAP_FAILED) {
+      ring = NULL;
+      return false;
+   }
+   if (cosim_load(&ring->magic) != COSIM_MAGIC) {
+      munmap(ring, sizeof(*ring));
+      ring = NULL;
+      return false;
+   }
+   return true;
+}
+
+/* Waits for xvcpi -b cosim to create the ring; an empty path is TCK pin 11 */
+int xvc_cosim_attach(const char *path)
+{
+   char def[64];
+   bool said = false;
+
+   if (!path || !*path) {
+      snprintf(def, sizeof(def), COSIM_PATH, 11);
+      path = def;
+   }
+   while (!ring_map(path)) {
+      if (!said)
+         printf("xvc_cosim: waiting for xvcpi to create %s\n", path);
+      said = true;
+      usleep(100000);
+   }
+   if (ring->version != COSIM_VERSION) {
+      fprintf(stderr, "xvc_cosim: %s is version %u, not %d\n", path, ring->version,
+              COSIM_VERSION);
+      return -1;
+   }
+
+   /* Taking over from a simulator that died without detaching */
+   int32_t pid = 0;
+   while (!__atomic_compare_exchange_n(&ring->sim_pid, &pid, (int32_t)getpid(), false,
+                                       __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+      if (kill(pid, 0) == 0 || errno != ESRCH) {
+         fprintf(stderr, "xvc_cosim: simulator %d is already attached to %s\n",
+                 (int)pid, path);
+         return -1;
+      }
+   }
+   printf("xvc_cosim: attached to %s\n", path);
+   return 0;
+}
+
+int xvc_cosim_next(void)
+{
+   uint32_t done = ring->done, posted;
+
+   while ((posted = cosim_load(&ring->posted)) == done) {
+      if (cosim_load(&ring->closed))
+         return -1;
+      cosim_wait(&ring->posted, posted, 100);
+   }
+   slot = &ring->slot[done % COSIM_SLOTS];
+   return slot->bits;
+}
+
+int xvc_cosim_bit(int i)
+{
+   return ((slot->tms[i / 8] >> (i % 8)) & 1) | ((slot->tdi[i / 8] >> (i % 8)) & 1) << 1;
+}
+
+void xvc_cosim_tdo(int i, int v)
+{
+   uint8_t m = 1 << (i % 8);
+
+   slot->tdo[i / 8] = (v & 1) ? slot->tdo[i / 8] | m : slot->tdo[i / 8] & ~m;
+}
+
+void xvc_cosim_done(void)
+{
+   cosim_store(&ring->done, ring->done + 1);
+}
+
+#ifdef COSIM_VPI
+#include <vpi_user.h>
+
+/* The system task call and an iterator over its arguments */
+static vpiHandle vpi_args(vpiHandle *call)
+{
+   *call = vpi_handle(vpiSysTfCall, NULL);
+   return vpi_iterate(vpiArgument, *call);
+}
+
+static int vpi_int_arg(vpiHandle args)
+{
+   s_vpi_value v = { .format = vpiIntVal };
+   vpiHandle h = vpi_scan(args);
+
+   vpi_get_value(h, &v);
+   return v.value.integer;
+}
+
+static void vpi_return(vpiHandle call, int r)
+{
+   s_vpi_value v = { .format = vpiIntVal };
+
+   v.value.integer = r;
+   vpi_put_value(call, &v, NULL, vpiNoDelay);
+}
+
+static PLI_INT32 vpi_attach(PLI_BYTE8 *user)
+{
+   vpiHandle call, args = vpi_args(&call);
+   s_vpi_value v = { .format = vpiStringVal };
+   char path[256] = "";
+
+   (void)user;
+   if (args) {
+      vpi_get_value(vpi_scan(args), &v);
+      snprintf(path, sizeof(path), "%s", v.value.str);
+      vpi_free_object(args);
+   }
+   vpi_return(call, xvc_cosim_attach(path));
+   return 0;
+}
+
+static PLI_INT32 vpi_next(PLI_BYTE8 *user)
+{
+   vpiHandle call = vpi_handle(vpiSysTfCall, NULL);
+
+   (void)user;
+   vpi_return(call, xvc_cosim_next());
+   return 0;
+}
+
+static PLI_INT32 vpi_bit(PLI_BYTE8 *user)
+{
+   vpiHandle call, args = vpi_args(&call);
+   int i = vpi_int_arg(args);
+
+   (void)user;
+   vpi_free_object(args);
+   vpi_return(call, xvc_cosim_bit(i));
+   return 0;
+}
+
+static PLI_INT32 vpi_tdo(PLI_BYTE8 *user)
+{
+   vpiHandle call, args = vpi_args(&call);
+   int i = vpi_int_arg(args);
+   int v = vpi_int_arg(args);
+
+   (void)user;
+   vpi_free_object(args);
+   xvc_cosim_tdo(i, v);
+   return 0;
+}
+
+static PLI_INT32 vpi_done(PLI_BYTE8 *user)
+{
+   (void)user;
+   xvc_cosim_done();
+   return 0;
+}
+
+static void vpi_register(void)
+{
+   static s_vpi_systf_data tf[] = {
+      { vpiSysFunc, vpiIntFunc, "$xvc_cosim_attach", vpi_attach, NULL, NULL, NULL },
+      { vpiSysFunc, vpiIntFunc, "$xvc_cosim_next", vpi_next, NULL, NULL, NULL },
+      { vpiSysFunc, vpiIntFunc, "$xvc_cosim_bit", vpi_bit, NULL, NULL, NULL },
+      { vpiSysTask, 0, "$xvc_cosim_tdo", vpi_tdo, NULL, NULL, NULL },
+      { vpiSysTask, 0, "$xvc_cosim_done", vpi_done, NULL, NULL, NULL },
+   };
+
+   for (size_t i = 0; i < sizeof(tf) / sizeof(tf[0]); i++)
+      vpi_register_systf(&tf[i]);
+}
+
+void (*vlog_startup_routines[])(void) = { vpi_register, NULL };
+#endif
+
+/*
+ * This work, "cosim_shim.c", is part of "xvcpi.c"
+ * Updated for modern Raspberry Pi systems using libgpiod
+ *
+ * Original "xvcpi.c" is licensed under CC0 1.0 Universal
+ * by Derek Mulcahy.
+ */
@@ -0,0 +1,137 @@
+/*
+ * Description :  Testbench for the xvcpi cosim backend
+ *
+ *                Takes vectors from xvcpi -b cosim through cosim_shim.c
+ *                and clocks them into a TAP.  cosim_tap below is a
+ *                stand-in with IDCODE and BYPASS; replace it with the
+ *                design's own TAP, or the whole design, keeping the
+ *                tck/tms/tdi/tdo ports.
+ *
+ *                Verilator:  verilator --binary --timing -DXVC_DPI \
+ *                               cosim_tb.v cosim_shim.c
+ *                Icarus:     make cosim_shim.vpi
+ *                            iverilog -o cosim_tb cosim_tb.v
+ *                            vvp -M. -mcosim_shim cosim_tb
+ *
+ *                +xvc_ring=path attaches to another chain's ring than
+ *                TCK pin 11's; +xvc_half=ns sets half a TCK period.
+ *
+ * See Licensing information at End of File.
+ */
+
+`timescale 1ns / 1ps
+
+`ifdef XVC_DPI
+import "DPI-C" function int xvc_cosim_attach(input string path);
+import "DPI-C" function int xvc_cosim_next();
+import "DPI-C" function int xvc_cosim_bit(input int i);
+import "DPI-C" function void xvc_cosim_tdo(input int i, input int v);
+import "DPI-C" function void xvc_cosim_done();
+`define XVC_ATTACH(p)   xvc_cosim_attach(p)
+`define XVC_NEXT        xvc_cosim_next()
+`define XVC_BIT(i)      xvc_cosim_bit(i)
+`define XVC_TDO(i, v)   xvc_cosim_tdo(i, v)
+`define XVC_DONE        xvc_cosim_done()
+`else
+`define XVC_ATTACH(p)   $xvc_cosim_attach(p)
+`define XVC_NEXT        $xvc_cosim_next
+`define XVC_BIT(i)      $xvc_cosim_bit(i)
+`define XVC_TDO(i, v)   $xvc_cosim_tdo(i, v)
+`define XVC_DONE        $xvc_cosim_done
+`endif
+
+module cosim_tb;
+   reg tck = 0, tms = 1, tdi = 0;
+   wire tdo;
+`ifdef XVC_DPI
+   string ring;
+`else
+   reg [8*256-1:0] ring;
+`endif
+   integer half, bits, i, b;
+
+   cosim_tap dut(.tck(tck), .tms(tms), .tdi(tdi), .tdo(tdo));
+
+   initial begin
+      if (!$value$plusargs("xvc_ring=%s", ring))
+         ring = "";
+      if (!$value$plusargs("xvc_half=%d", half))
+         half = 50;
+      if (`XVC_ATTACH(ring) != 0)
+         $finish;
+
+      bits = `XVC_NEXT;
+      while (bits >= 0) begin
+         for (i = 0; i < bits; i = i + 1) begin
+            b = `XVC_BIT(i);
+            tms = b[0];
+            tdi = b[1];
+            #half;
+            /* TDO is sampled on the rising edge, as the GPIO kernels do */
+            `XVC_TDO(i, tdo);
+            tck = 1;
+            #half;
+            tck = 0;
+         end
+         `XVC_DONE;
+         bits = `XVC_NEXT;
+      end
+      $finish;
+   end
+endmodule
+
+/* IEEE 1149.1 TAP with a 6-bit IR, IDCODE (001001, the reset default) and BYPASS */
+module cosim_tap(input tck, input tms, input tdi, output reg tdo);
+   localparam RESET = 4'h0, IDLE = 4'h1, SEL_DR = 4'h2, CAP_DR = 4'h3,
+              SH_DR = 4'h4, EX1_DR = 4'h5, PAU_DR = 4'h6, EX2_DR = 4'h7,
+              UPD_DR = 4'h8, SEL_IR = 4'h9, CAP_IR = 4'ha, SH_IR = 4'hb,
+              EX1_IR = 4'hc, PAU_IR = 4'hd, EX2_IR = 4'he, UPD_IR = 4'hf;
+   localparam IDCODE = 6'b001001, IDCODE_VALUE = 32'h0362d093;
+
+   reg [3:0] state = RESET;
+   reg [5:0] ir = IDCODE, ir_sr;
+   reg [31:0] dr_sr;
+
+   initial tdo = 0;
+
+   always @(posedge tck) begin
+      case (state)
+         RESET:  state <= tms ? RESET : IDLE;
+         IDLE:   state <= tms ? SEL_DR : IDLE;
+         SEL_DR: state <= tms ? SEL_IR : CAP_DR;
+         CAP_DR: state <= tms ? EX1_DR : SH_DR;
+         SH_DR:  state <= tms ? EX1_DR : SH_DR;
+         EX1_DR: state <= tms ? UPD_DR : PAU_DR;
+         PAU_DR: state <= tms ? EX2_DR : PAU_DR;
+         EX2_DR: state <= tms ? UPD_DR : SH_DR;
+         UPD_DR: state <= tms ? SEL_DR : IDLE;
+         SEL_IR: state <= tms ? RESET : CAP_IR;
+         CAP_IR: state <= tms ? EX1_IR : SH_IR;
+         SH_IR:  state <= tms ? EX1_IR : SH_IR;
+         EX1_IR: state <= tms ? UPD_IR : PAU_IR;
+         PAU_IR: state <= tms ? EX2_IR : PAU_IR;
+         EX2_IR: state <= tms ? UPD_IR : SH_IR;
+         UPD_IR: state <= tms ? SEL_DR : IDLE;
+      endcase
+
+      case (state)
+         RESET:  ir <= IDCODE;
+         CAP_IR: ir_sr <= 6'b000001;
+         SH_IR:  ir_sr <= {tdi, ir_sr[5:1]};
+         UPD_IR: ir <= ir_sr;
+         CAP_DR: dr_sr <= ir == IDCODE ? IDCODE_VALUE : 32'h0;
+         SH_DR:  dr_sr <= ir == IDCODE ? {tdi, dr_sr[31:1]} : {31'h0, tdi};
+      endcase
+   end
+
+   always @(negedge tck)
+      tdo <= state == SH_IR ? ir_sr[0] : state == SH_DR ? dr_sr[0] : 1'b0;
+endmodule
+
+/*
+ * This work, "cosim_tb.v", is part of "xvcpi.c"
+ * Updated for modern Raspberry Pi systems using libgpiod
+ *
+ * Original "xvcpi.c" is licensed under CC0 1.0 Universal
+ * by Derek Mulcahy.
+ */
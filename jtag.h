@@ -0,0 +1,304 @@
+/*
+ * Description :  JTAG engine shared by the xvcpi server and its tools:
+ *                DVFS-aware timing and the GPIO backends.
+ *
+ * See Licensing information at End of File.
+ */
+
+#ifndef XVCPI_JTAG_H
+#define XVCPI_JTAG_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+extern int verbose;
+
+/* Transition delay coefficients; JTAG_DELAY/-d is the default for new chains */
+#define JTAG_DELAY (40)
+extern unsigned int jtag_delay;
+
+/*
+ * DVFS-aware timing (jtag_timing.c), shared by every chain.  timing_poll()
+ * updates it under its lock; cur_khz, loop_ps and next_poll_ns are read
+ * without, with __atomic_load_n().
+ */
+struct jtag_timing {
+   bool counter_wait;          /* -w: time delays with the system counter */
+   unsigned int max_khz;       /* cpuinfo_max_freq, 0 if unknown */
+   unsigned int cur_khz;       /* last scaling_cur_freq seen */
+   unsigned int loop_ps;       /* one spin-loop iteration at cur_khz */
+   uint64_t counter_hz;
+   uint64_t next_poll_ns;
+   uint64_t next_verify_ns;
+   unsigned int rescales;      /* frequency changes followed */
+   unsigned int recalibrations;
+   int temp_mc;                /* last SoC temperature, millidegrees C */
+   unsigned int generation;    /* bumped whenever loop_ps changes */
+};
+
+/*
+ * The delay after each pin write, kept per chain.  The time is what a
+ * chain asks for; loops/ticks are derived from it and re-derived when
+ * timing.generation moves on.
+ */
+struct jtag_delay {
+   uint64_t ps;                /* requested delay */
+   unsigned int loops;         /* ps in spin loops at the current clock */
+   uint64_t ticks;             /* ps in counter ticks (-w) */
+   unsigned int timing_gen;    /* timing.generation it was converted at */
+   unsigned int generation;    /* bumped whenever loops/ticks change */
+};
+
+extern struct jtag_timing timing;
+extern bool want_performance;
+
+uint64_t now_ns(void);
+long read_sysfs_long(const char *path);
+bool write_sysfs(const char *path, const char *val);
+void timing_init(void);
+void timing_poll(void);
+void delay_apply(struct jtag_delay *d);
+void delay_set_ps(struct jtag_delay *d, uint64_t ps);
+void delay_set_loops(struct jtag_delay *d, unsigned int loops);
+void governor_open(void);
+void governor_performance(bool enable);
+
+static inline void spin_delay(unsigned int loops)
+{
+   for (unsigned int i = 0; i < loops; i++)
+      asm volatile ("");
+}
+
+static inline uint64_t counter_read(void)
+{
+#if defined(__aarch64__)
+   uint64_t v;
+   asm volatile ("isb; mrs %0, cntvct_el0" : "=r" (v));
+   return v;
+#else
+   return now_ns();
+#endif
+}
+
+static inline void counter_wait(uint64_t ticks)
+{
+   uint64_t start = counter_read();
+   while (counter_read() - start < ticks)
+      ;
+}
+
+/* The delay following every pin write */
+static inline void jtag_wait(const struct jtag_delay *d)
+{
+   if (timing.counter_wait)
+      counter_wait(d->ticks);
+   else
+      spin_delay(d->loops);
+}
+
+/*
+ * GPIO backends (jtag_gpio.c).
+ *
+ * Each backend drives TCK/TMS/TDI and samples TDO through a different
+ * kernel interface.  open() probes whether the backend works on this
+ * board with these pins and claims them, leaving TCK=0, TMS=1, TDI=0.
+ */
+#define MAX_GANG (8)               /* gang boards besides the primary */
+
+struct jtag_pins {
+   int tck;
+   int tms;
+   int tdi;
+   int tdo;
+   int ngang;                  /* gang mode: boards sharing TCK/TMS/TDI */
+   int gang[MAX_GANG];         /* their TDO pins */
+};
+
+struct jtag_gpio;
+struct vcd_writer;
+
+/* Register access for backends whose pins share one 32-bit bank */
+struct gpio_mmio {
+   volatile uint32_t *set;
+   volatile uint32_t *clr;
+   volatile const uint32_t *lev;
+   uint32_t tck_mask;
+   uint32_t tms_mask;
+   uint32_t tdi_mask;
+   uint32_t out_mask;          /* TCK, TMS and TDI */
+   uint32_t data_mask;         /* TCK and TDI */
+   uint32_t gang_mask;         /* TDO of the gang boards */
+   int tdo;
+};
+
+typedef void (*shift_kernel_fn)(struct jtag_gpio *g, int bits, const uint8_t *tms,
+                                const uint8_t *tdi, uint8_t *tdo);
+
+struct gpio_backend {
+   const char *name;
+   bool autoselect;            /* candidate for gpio_open(g, NULL) */
+   bool (*open)(struct jtag_gpio *g);
+   void (*close)(struct jtag_gpio *g);
+   void (*write)(struct jtag_gpio *g, int tck, int tms, int tdi);
+   /* Optional: drive TCK and TDI only, TMS keeps its last value */
+   void (*write_data)(struct jtag_gpio *g, int tck, int tdi);
+   int (*read)(struct jtag_gpio *g);
+   /* Gang mode: primary TDO in bit 0, gang board b's TDO in bit b + 1 */
+   uint32_t (*read_gang)(struct jtag_gpio *g);
+   /* Optional: takes whole vectors itself, in place of the shift kernels */
+   shift_kernel_fn shift;
+};
+
+/* Gang boards' TDO compared with the primary's, since gang_reset() */
+struct gang_stats {
+   uint64_t shifts;
+   uint64_t mismatches[MAX_GANG];      /* bits that differed */
+   uint64_t first_shift[MAX_GANG];     /* where the first one was */
+   int first_bit[MAX_GANG];
+};
+
+struct jtag_gpio {
+   const struct gpio_backend *be;
+   struct jtag_pins pins;
+   int tms;                    /* TMS level last written */
+   void *priv;                 /* backend state */
+   struct jtag_delay delay;
+   struct gpio_mmio *mmio;     /* set by memory-mapped backends */
+   shift_kernel_fn kernel;     /* chosen by jtag_select_kernel() */
+   shift_kernel_fn kernel_wo;  /* its write-only twin */
+   const char *kernel_name;
+   unsigned int kernel_gen;    /* delay.generation it was chosen for */
+   struct gang_stats gang;
+   struct vcd_writer *vcd;     /* capture of every shift (vcd.h), or NULL */
+};
+
+extern const struct gpio_backend *const gpio_backends[];
+
+const struct gpio_backend *gpio_backend_find(const char *name);
+uint64_t gpio_dry_run_ps(struct jtag_gpio *g, int bits);
+bool gpio_open(struct jtag_gpio *g, const char *backend);
+void gpio_close(struct jtag_gpio *g);
+
+static inline int gpio_read(struct jtag_gpio *g)
+{
+   return g->be->read(g);
+}
+
+static inline void gpio_write(struct jtag_gpio *g, int tck, int tms, int tdi)
+{
+   g->be->write(g, tck, tms, tdi);
+   g->tms = tms;
+   jtag_wait(&g->delay);
+}
+
+static inline void gpio_write_data(struct jtag_gpio *g, int tck, int tdi)
+{
+   if (g->be->write_data)
+      g->be->write_data(g, tck, tdi);
+   else
+      g->be->write(g, tck, g->tms, tdi);
+   jtag_wait(&g->delay);
+}
+
+uint32_t gpio_xfer(struct jtag_gpio *g, int n, uint32_t tms, uint32_t tdi);
+
+/* Gang mode (jtag_dispatch.c); boards has bit b set for gang board b */
+void gang_reset(struct jtag_gpio *g);
+void gang_mismatch(struct jtag_gpio *g, int bit, uint32_t boards);
+void gang_report(struct jtag_gpio *g, const char *name);
+
+/* TDO of bit 'bit' of the current shift, checking the gang boards against it */
+static inline int gpio_sample(struct jtag_gpio *g, int bit)
+{
+   if (!g->pins.ngang)
+      return gpio_read(g);
+
+   uint32_t v = g->be->read_gang(g);
+   uint32_t diff = ((v ^ -(v & 1)) >> 1) & ((1u << g->pins.ngang) - 1);
+   if (diff)
+      gang_mismatch(g, bit, diff);
+   return v & 1;
+}
+
+/* TAP controller states (jtag_tap.c), in SVF order */
+enum tap_state {
+   TAP_RESET, TAP_IDLE,
+   TAP_DRSELECT, TAP_DRCAPTURE, TAP_DRSHIFT, TAP_DREXIT1,
+   TAP_DRPAUSE, TAP_DREXIT2, TAP_DRUPDATE,
+   TAP_IRSELECT, TAP_IRCAPTURE, TAP_IRSHIFT, TAP_IREXIT1,
+   TAP_IRPAUSE, TAP_IREXIT2, TAP_IRUPDATE,
+   TAP_STATES
+};
+
+extern const uint8_t tap_next[TAP_STATES][2];
+extern const char *const tap_names[TAP_STATES];
+
+int tap_state_find(const char *name, size_t len);
+bool tap_stable(int s);
+int tap_path(int from, int to, uint32_t *tms);
+
+/*
+ * TAP tracker: follows the state from the TMS of every shift and
+ * reports scans as they complete.  Bytes of TMS go through a table,
+ * only those that start or finish a scan are walked bit by bit.
+ */
+enum tap_event {
+   TAP_EVENT_RESET,            /* Test-Logic-Reset entered */
+   TAP_EVENT_IR,               /* IR scan done: ir, ir_len */
+   TAP_EVENT_DR,               /* DR scan done: dr_bits */
+};
+
+struct tap_trace;
+typedef void (*tap_event_fn)(struct tap_trace *t, enum tap_event ev);
+
+struct tap_trace {
+   uint8_t state;
+   uint64_t ir_shift;          /* first 64 bits of the IR scan in progress */
+   int ir_bits;
+   uint64_t ir;                /* last IR scanned, 0 bits after a reset */
+   int ir_len;
+   uint64_t dr_bits;           /* of the DR scan in progress or just done */
+   tap_event_fn event;
+   void *arg;
+};
+
+/* Starts in Test-Logic-Reset, where XVC clients begin */
+void tap_trace_init(struct tap_trace *t, tap_event_fn event, void *arg);
+void tap_trace_shift(struct tap_trace *t, int bits, const uint8_t *tms, const uint8_t *tdi);
+/* Name of a 6-bit Xilinx instruction, or NULL */
+const char *tap_xilinx_ir_name(unsigned int ir);
+
+/* Shift kernels (jtag_kernel.c, once per CPU variant) */
+#define KERNEL_FIXED_DELAYS (7)
+
+struct shift_kernel {
+   unsigned int delay;         /* spin delay it was built for */
+   shift_kernel_fn fn;
+   shift_kernel_fn fn_wo;      /* the same without sampling TDO, tdo is NULL */
+   const char *name;
+};
+
+struct kernel_set {
+   const char *variant;        /* generic, a53, a72, a76 */
+   struct shift_kernel generic;
+   struct shift_kernel mmio;   /* runtime delay */
+   struct shift_kernel mmio_fixed[KERNEL_FIXED_DELAYS];
+   struct shift_kernel mmio_gang;
+};
+
+/* Kernel dispatch (jtag_dispatch.c) */
+void jtag_select_kernel(struct jtag_gpio *g);
+/* With tdo == NULL, TDO is not sampled at all */
+void jtag_shift(struct jtag_gpio *g, int bits, const uint8_t *tms,
+                const uint8_t *tdi, uint8_t *tdo);
+
+#endif
+
+/*
+ * This work, "jtag.h", is part of "xvcpi.c"
+ * Updated for modern Raspberry Pi systems using libgpiod
+ *
+ * Original "xvcpi.c" is licensed under CC0 1.0 Universal
+ * by Derek Mulcahy.
+ */
@@ -0,0 +1,205 @@
+/*
+ * Description :  Shift kernel dispatch for the xvcpi JTAG engine
+ *
+ *                One binary carries the generic kernels and, on ARM, sets
+ *                tuned with -mcpu for the cores used by Raspberry Pi
+ *                models.  The core is identified once at startup from
+ *                MIDR_EL1 (HWCAP_CPUID) or /proc/cpuinfo.
+ *
+ * See Licensing information at End of File.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#if defined(__aarch64__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+#include "jtag.h"
+#include "vcd.h"
+
+extern const struct kernel_set kernels_generic;
+#ifdef CPU_KERNELS
+extern const struct kernel_set kernels_a53;
+extern const struct kernel_set kernels_a72;
+extern const struct kernel_set kernels_a76;
+#endif
+
+/* ARM primary part numbers (MIDR_EL1[15:4]) */
+static const struct {
+   unsigned int part;
+   const char *model;
+   const struct kernel_set *set;
+} cpu_kernels[] = {
+#ifdef CPU_KERNELS
+   { 0xd03, "Cortex-A53 (Pi 3, Zero 2)", &kernels_a53 },
+   { 0xd08, "Cortex-A72 (Pi 4, 400, CM4)", &kernels_a72 },
+   { 0xd0b, "Cortex-A76 (Pi 5, CM5)", &kernels_a76 },
+#endif
+   { 0, "unknown", &kernels_generic },
+};
+
+static unsigned int cpu_part(void)
+{
+#if defined(__aarch64__) && defined(HWCAP_CPUID)
+   if (getauxval(AT_HWCAP) & HWCAP_CPUID) {
+      uint64_t midr;
+      asm volatile ("mrs %0, midr_el1" : "=r" (midr));
+      return (midr >> 4) & 0xfff;
+   }
+#endif
+   FILE *f = fopen("/proc/cpuinfo", "r");
+   char line[128];
+   unsigned int part = 0;
+
+   if (!f)
+      return 0;
+   while (fgets(line, sizeof(line), f)) {
+      if (strncmp(line, "CPU part", 8) == 0) {
+         char *colon = strchr(line, ':');
+         if (colon)
+            part = strtoul(colon + 1, NULL, 0);
+         break;
+      }
+   }
+   fclose(f);
+   return part;
+}
+
+static const struct kernel_set *cpu_set;
+
+static void cpu_kernel_detect(void)
+{
+   const size_t n = sizeof(cpu_kernels) / sizeof(cpu_kernels[0]);
+   unsigned int part = cpu_part();
+   size_t i;
+   for (i = 0; i < n - 1; i++)
+      if (cpu_kernels[i].part == part)
+         break;
+   cpu_set = cpu_kernels[i].set;
+   if (verbose)
+      printf("CPU part 0x%03x, %s: %s kernels\n", part, cpu_kernels[i].model,
+             cpu_set->variant);
+}
+
+/* Detected once, by whichever chain's engine thread shifts first */
+static const struct kernel_set *cpu_kernel_set(void)
+{
+   static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+   pthread_once(&once, cpu_kernel_detect);
+   return cpu_set;
+}
+
+/*
+ * Pick the kernel for the backend and the chain's delay.  jtag_shift()
+ * calls this again whenever the delay changes (settck, -d, auto-tune,
+ * DVFS rescaling).
+ */
+void jtag_select_kernel(struct jtag_gpio *g)
+{
+   const struct kernel_set *ks = cpu_kernel_set();
+   const struct shift_kernel *k = &ks->generic;
+   const char *prev = g->kernel_name;
+
+   if (g->mmio && !timing.counter_wait && g->pins.ngang) {
+      k = &ks->mmio_gang;
+   } else if (g->mmio && !timing.counter_wait) {
+      k = &ks->mmio;
+      for (int i = 0; i < KERNEL_FIXED_DELAYS; i++)
+         if (ks->mmio_fixed[i].delay == g->delay.loops)
+            k = &ks->mmio_fixed[i];
+   }
+   if (g->be->shift) {
+      /* The backend sends whole vectors; its delay is not ours to keep */
+      g->kernel = g->kernel_wo = g->be->shift;
+      g->kernel_name = g->be->name;
+   } else {
+      g->kernel = k->fn;
+      g->kernel_wo = k->fn_wo;
+      g->kernel_name = k->name;
+   }
+   g->kernel_gen = g->delay.generation;
+
+   if (verbose && g->kernel_name != prev)
+      printf("Shift kernel: %s\n", g->kernel_name);
+}
+
+/*
+ * Shift a whole XVC vector: bits TMS/TDI bits, LSB first, from byte
+ * buffers.  TDO is written to tdo, which must hold (bits + 7) / 8 bytes.
+ */
+void jtag_shift(struct jtag_gpio *g, int bits, const uint8_t *tms,
+                const uint8_t *tdi, uint8_t *tdo)
+{
+   if (g->delay.timing_gen != __atomic_load_n(&timing.generation, __ATOMIC_ACQUIRE))
+      delay_apply(&g->delay);
+   if (!g->kernel || g->kernel_gen != g->delay.generation)
+      jtag_select_kernel(g);
+
+   uint64_t t0 = g->vcd ? now_ns() : 0;
+   if (tdo)
+      memset(tdo, 0, (bits + 7) / 8);
+   g->gang.shifts++;
+
+   gpio_write(g, 0, 1, 1);
+   if (bits > 0)
+      (tdo ? g->kernel : g->kernel_wo)(g, bits, tms, tdi, tdo);
+   gpio_write(g, 0, 1, 0);
+   if (g->vcd)
+      vcd_shift(g->vcd, t0, now_ns() - t0, bits, tms, tdi, tdo);
+}
+
+/*
+ * Gang mode: several identical boards share TCK/TMS/TDI and each has
+ * its own TDO pin.  The primary board's TDO goes back to the client;
+ * the kernels call gang_mismatch() for bits where another board's TDO
+ * differs from it.
+ */
+void gang_reset(struct jtag_gpio *g)
+{
+   memset(&g->gang, 0, sizeof(g->gang));
+}
+
+void gang_mismatch(struct jtag_gpio *g, int bit, uint32_t boards)
+{
+   struct gang_stats *gs = &g->gang;
+
+   for (int b = 0; b < g->pins.ngang; b++) {
+      if (!((boards >> b) & 1))
+         continue;
+      if (!gs->mismatches[b]++) {
+         gs->first_shift[b] = gs->shifts;
+         gs->first_bit[b] = bit;
+         printf("Gang board %d (TDO GPIO%d): TDO differs from the primary "
+                "in shift %llu, bit %d\n", b + 1, g->pins.gang[b],
+                (unsigned long long)gs->shifts, bit);
+      }
+   }
+}
+
+void gang_report(struct jtag_gpio *g, const char *name)
+{
+   const struct gang_stats *gs = &g->gang;
+
+   for (int b = 0; b < g->pins.ngang; b++) {
+      if (gs->mismatches[b])
+         printf("%s: gang board %d (TDO GPIO%d): %llu TDO bits differ, first "
+                "in shift %llu bit %d\n", name, b + 1, g->pins.gang[b],
+                (unsigned long long)gs->mismatches[b],
+                (unsigned long long)gs->first_shift[b], gs->first_bit[b]);
+      else if (verbose)
+         printf("%s: gang board %d (TDO GPIO%d): matches the primary in %llu shifts\n",
+                name, b + 1, g->pins.gang[b], (unsigned long long)gs->shifts);
+   }
+}
+
+/*
+ * This work, "jtag_dispatch.c", is part of "xvcpi.c"
+ * Updated for modern Raspberry Pi systems using libgpiod
+ *
+ * Original "xvcpi.c" is licensed under CC0 1.0 Universal
+ * by Derek Mulcahy.
+ */
@@ -0,0 +1,959 @@
+/*
+ * Description :  GPIO backends for the xvcpi JTAG engine
+ *
+ *                gpiod       libgpiod v1, one request per line
+ *                gpiod-bulk  libgpiod v1, TCK/TMS/TDI in one bulk request
+ *                gpiomem     BCM2835/6/7/2711 registers via /dev/gpiomem
+ *                rp1         Raspberry Pi 5 RP1 RIO via /dev/gpiomem0
+ *                mock        simulated single-device TAP, no hardware
+ *                cosim       RTL simulation of the target, over shared memory
+ *
+ * See Licensing information at End of File.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <gpiod.h>
+#include "jtag.h"
+#include "vcd.h"
+#include "cosim.h"
+
+#define DRY_RUN_BITS (2000)
+
+uint32_t gpio_xfer(struct jtag_gpio *g, int n, uint32_t tms, uint32_t tdi)
+{
+   uint64_t t0 = g->vcd ? now_ns() : 0;
+   uint32_t tdo = 0;
+
+   for (int i = 0; i < n; i++) {
+      gpio_write(g, 0, (tms >> i) & 1, (tdi >> i) & 1);
+      gpio_write(g, 1, (tms >> i) & 1, (tdi >> i) & 1);
+      tdo |= gpio_read(g) << i;
+   }
+   if (g->vcd) {
+      uint8_t b[3][4];
+      for (int i = 0; i < 4; i++) {
+         b[0][i] = tms >> (8 * i);
+         b[1][i] = tdi >> (8 * i);
+         b[2][i] = tdo >> (8 * i);
+      }
+      vcd_shift(g->vcd, t0, now_ns() - t0, n, b[0], b[1], b[2]);
+   }
+   return tdo;
+}
+
+/* Raspberry Pi 5 (BCM2712) exposes its header GPIOs through RP1 */
+static bool is_bcm2712(void)
+{
+   char buf[256];
+   int fd = open("/proc/device-tree/compatible", O_RDONLY);
+   if (fd < 0)
+      return false;
+   ssize_t n = read(fd, buf, sizeof(buf) - 1);
+   close(fd);
+   if (n <= 0)
+      return false;
+   /* The property is a list of NUL separated strings */
+   for (ssize_t i = 0; i < n; i++)
+      if (!buf[i])
+         buf[i] = ' ';
+   buf[n] = 0;
+   return strstr(buf, "brcm,bcm2712") != NULL;
+}
+
+static void *map_gpiomem(const char *dev, size_t len)
+{
+   int fd = open(dev, O_RDWR | O_SYNC);
+   if (fd < 0)
+      return NULL;
+   void *p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+   close(fd);
+   return p == MAP_FAILED ? NULL : p;
+}
+
+static bool pins_below(const struct jtag_pins *p, int limit)
+{
+   for (int b = 0; b < p->ngang; b++)
+      if (p->gang[b] >= limit)
+         return false;
+   return p->tck < limit && p->tms < limit && p->tdi < limit && p->tdo < limit;
+}
+
+/* libgpiod, one line at a time */
+
+struct gpiod_priv {
+   struct gpiod_chip *chip;
+   int tdi;                    /* TDI level last written */
+   struct gpiod_line *tck_line;
+   struct gpiod_line *tms_line;
+   struct gpiod_line *tdi_line;
+   struct gpiod_line *tdo_line;
+};
+
+static void gpiod_close(struct jtag_gpio *g)
+{
+   struct gpiod_priv *p = g->priv;
+
+   if (p) {
+      if (p->chip)
+         gpiod_chip_close(p->chip);
+      free(p);
+      g->priv = NULL;
+   }
+}
+
+/* The libgpiod backends read one TDO line and cannot gang boards */
+static bool gpiod_open(struct jtag_gpio *g)
+{
+   struct gpiod_priv *p;
+
+   if (g->pins.ngang)
+      return false;
+   p = calloc(1, sizeof(*p));
+   if (!p)
+      return false;
+   g->priv = p;
+
+   // Open GPIO chip
+   p->chip = gpiod_chip_open_by_name("gpiochip0");
+   if (!p->chip) {
+      if (verbose)
+         perror("Failed to open GPIO chip");
+      goto fail;
+   }
+
+   // Get GPIO lines
+   p->tck_line = gpiod_chip_get_line(p->chip, g->pins.tck);
+   p->tms_line = gpiod_chip_get_line(p->chip, g->pins.tms);
+   p->tdi_line = gpiod_chip_get_line(p->chip, g->pins.tdi);
+   p->tdo_line = gpiod_chip_get_line(p->chip, g->pins.tdo);
+
+   if (!p->tck_line || !p->tms_line || !p->tdi_line || !p->tdo_line) {
+      perror("Failed to get GPIO lines");
+      goto fail;
+   }
+
+   // Configure TDO as input
+   if (gpiod_line_request_input(p->tdo_line, "xvcpi-tdo") < 0) {
+      perror("Failed to configure TDO as input");
+      goto fail;
+   }
+
+   // Configure TDI, TCK, TMS as outputs
+   if (gpiod_line_request_output(p->tdi_line, "xvcpi-tdi", 0) < 0) {
+      perror("Failed to configure TDI as output");
+      goto fail;
+   }
+
+   if (gpiod_line_request_output(p->tck_line, "xvcpi-tck", 0) < 0) {
+      perror("Failed to configure TCK as output");
+      goto fail;
+   }
+
+   if (gpiod_line_request_output(p->tms_line, "xvcpi-tms", 1) < 0) {
+      perror("Failed to configure TMS as output");
+      goto fail;
+   }
+   return true;
+
+fail:
+   gpiod_close(g);
+   return false;
+}
+
+static void gpiod_write(struct jtag_gpio *g, int tck, int tms, int tdi)
+{
+   struct gpiod_priv *p = g->priv;
+
+   gpiod_line_set_value(p->tck_line, tck);
+   gpiod_line_set_value(p->tms_line, tms);
+   gpiod_line_set_value(p->tdi_line, tdi);
+   p->tdi = tdi;
+}
+
+/* One request per line: skipping TMS and an unchanged TDI saves ioctls */
+static void gpiod_write_data(struct jtag_gpio *g, int tck, int tdi)
+{
+   struct gpiod_priv *p = g->priv;
+
+   gpiod_line_set_value(p->tck_line, tck);
+   if (tdi != p->tdi) {
+      gpiod_line_set_value(p->tdi_line, tdi);
+      p->tdi = tdi;
+   }
+}
+
+static int gpiod_read(struct jtag_gpio *g)
+{
+   struct gpiod_priv *p = g->priv;
+   int val = gpiod_line_get_value(p->tdo_line);
+   return val < 0 ? 0 : val;
+}
+
+static const struct gpio_backend gpiod_backend = {
+   .name = "gpiod",
+   .autoselect = true,
+   .open = gpiod_open,
+   .close = gpiod_close,
+   .write = gpiod_write,
+   .write_data = gpiod_write_data,
+   .read = gpiod_read,
+};
+
+/* libgpiod, outputs set with a single bulk request */
+
+struct gpiod_bulk_priv {
+   struct gpiod_chip *chip;
+   struct gpiod_line_bulk out;  /* TCK, TMS, TDI */
+   struct gpiod_line *tdo_line;
+};
+
+static void gpiod_bulk_close(struct jtag_gpio *g)
+{
+   struct gpiod_bulk_priv *p = g->priv;
+
+   if (p) {
+      if (p->chip)
+         gpiod_chip_close(p->chip);
+      free(p);
+      g->priv = NULL;
+   }
+}
+
+static bool gpiod_bulk_open(struct jtag_gpio *g)
+{
+   struct gpiod_bulk_priv *p;
+   const int init[3] = { 0, 1, 0 };
+
+   if (g->pins.ngang)
+      return false;
+   p = calloc(1, sizeof(*p));
+   if (!p)
+      return false;
+   g->priv = p;
+
+   p->chip = gpiod_chip_open_by_name("gpiochip0");
+   if (!p->chip)
+      goto fail;
+
+   gpiod_line_bulk_init(&p->out);
+   const int out_pins[3] = { g->pins.tck, g->pins.tms, g->pins.tdi };
+   for (int i = 0; i < 3; i++) {
+      struct gpiod_line *line = gpiod_chip_get_line(p->chip, out_pins[i]);
+      if (!line)
+         goto fail;
+      gpiod_line_bulk_add(&p->out, line);
+   }
+   p->tdo_line = gpiod_chip_get_line(p->chip, g->pins.tdo);
+   if (!p->tdo_line)
+      goto fail;
+
+   if (gpiod_line_request_input(p->tdo_line, "xvcpi-tdo") < 0 ||
+       gpiod_line_request_bulk_output(&p->out, "xvcpi", init) < 0) {
+      if (verbose)
+         perror("gpiod-bulk: failed to request lines");
+      goto fail;
+   }
+   return true;
+
+fail:
+   gpiod_bulk_close(g);
+   return false;
+}
+
+static void gpiod_bulk_write(struct jtag_gpio *g, int tck, int tms, int tdi)
+{
+   struct gpiod_bulk_priv *p = g->priv;
+   const int val[3] = { tck, tms, tdi };
+
+   gpiod_line_set_value_bulk(&p->out, val);
+}
+
+static int gpiod_bulk_read(struct jtag_gpio *g)
+{
+   struct gpiod_bulk_priv *p = g->priv;
+   int val = gpiod_line_get_value(p->tdo_line);
+   return val < 0 ? 0 : val;
+}
+
+static const struct gpio_backend gpiod_bulk_backend = {
+   .name = "gpiod-bulk",
+   .autoselect = true,
+   .open = gpiod_bulk_open,
+   .close = gpiod_bulk_close,
+   .write = gpiod_bulk_write,
+   .read = gpiod_bulk_read,
+};
+
+/*
+ * Memory-mapped GPIO.  Both register blocks keep all header pins in one
+ * 32-bit bank, so a pin write is one set and one clear store.  g->mmio
+ * lets jtag_kernel.c drive the registers directly.
+ */
+struct mmio_priv {
+   struct gpio_mmio regs;
+   volatile uint32_t *base;
+   size_t len;
+};
+
+static void mmio_close(struct jtag_gpio *g)
+{
+   struct mmio_priv *p = g->priv;
+
+   if (p) {
+      munmap((void *)p->base, p->len);
+      free(p);
+      g->priv = NULL;
+      g->mmio = NULL;
+   }
+}
+
+static struct gpio_mmio *mmio_alloc(struct jtag_gpio *g, volatile uint32_t *base,
+                                    size_t len)
+{
+   struct mmio_priv *p = calloc(1, sizeof(*p));
+   struct gpio_mmio *m;
+
+   if (!p) {
+      munmap((void *)base, len);
+      return NULL;
+   }
+   m = &p->regs;
+   p->base = base;
+   p->len = len;
+   m->tck_mask = 1u << g->pins.tck;
+   m->tms_mask = 1u << g->pins.tms;
+   m->tdi_mask = 1u << g->pins.tdi;
+   m->out_mask = m->tck_mask | m->tms_mask | m->tdi_mask;
+   m->data_mask = m->tck_mask | m->tdi_mask;
+   m->tdo = g->pins.tdo;
+   for (int b = 0; b < g->pins.ngang; b++)
+      m->gang_mask |= 1u << g->pins.gang[b];
+   g->priv = p;
+   g->mmio = m;
+   return m;
+}
+
+static void mmio_write(struct jtag_gpio *g, int tck, int tms, int tdi)
+{
+   struct gpio_mmio *m = g->mmio;
+   uint32_t set = (tck ? m->tck_mask : 0) | (tms ? m->tms_mask : 0) |
+                  (tdi ? m->tdi_mask : 0);
+
+   *m->set = set;
+   *m->clr = m->out_mask & ~set;
+}
+
+static void mmio_write_data(struct jtag_gpio *g, int tck, int tdi)
+{
+   struct gpio_mmio *m = g->mmio;
+   uint32_t set = (tck ? m->tck_mask : 0) | (tdi ? m->tdi_mask : 0);
+
+   *m->set = set;
+   *m->clr = m->data_mask & ~set;
+}
+
+static int mmio_read(struct jtag_gpio *g)
+{
+   struct gpio_mmio *m = g->mmio;
+   return (*m->lev >> m->tdo) & 1;
+}
+
+static uint32_t mmio_read_gang(struct jtag_gpio *g)
+{
+   struct gpio_mmio *m = g->mmio;
+   uint32_t l = *m->lev, v = (l >> m->tdo) & 1;
+
+   for (int b = 0; b < g->pins.ngang; b++)
+      v |= ((l >> g->pins.gang[b]) & 1) << (b + 1);
+   return v;
+}
+
+/* BCM2835/6/7 and BCM2711 GPIO block */
+#define BCM_GPFSEL0  (0x00 / 4)
+#define BCM_GPSET0   (0x1c / 4)
+#define BCM_GPCLR0   (0x28 / 4)
+#define BCM_GPLEV0   (0x34 / 4)
+#define BCM_MAP_LEN  (4096)
+
+static void bcm_fsel(volatile uint32_t *base, int pin, bool output)
+{
+   volatile uint32_t *fsel = &base[BCM_GPFSEL0 + pin / 10];
+   int shift = (pin % 10) * 3;
+   *fsel = (*fsel & ~(7u << shift)) | ((output ? 1u : 0u) << shift);
+}
+
+static bool gpiomem_open(struct jtag_gpio *g)
+{
+   if (is_bcm2712() || !pins_below(&g->pins, 32))
+      return false;
+
+   volatile uint32_t *base = map_gpiomem("/dev/gpiomem", BCM_MAP_LEN);
+   if (!base)
+      return false;
+   struct gpio_mmio *m = mmio_alloc(g, base, BCM_MAP_LEN);
+   if (!m)
+      return false;
+   m->set = &base[BCM_GPSET0];
+   m->clr = &base[BCM_GPCLR0];
+   m->lev = &base[BCM_GPLEV0];
+
+   mmio_write(g, 0, 1, 0);
+   bcm_fsel(base, g->pins.tdo, false);
+   for (int b = 0; b < g->pins.ngang; b++)
+      bcm_fsel(base, g->pins.gang[b], false);
+   bcm_fsel(base, g->pins.tck, true);
+   bcm_fsel(base, g->pins.tms, true);
+   bcm_fsel(base, g->pins.tdi, true);
+   return true;
+}
+
+static const struct gpio_backend gpiomem_backend = {
+   .name = "gpiomem",
+   .autoselect = true,
+   .open = gpiomem_open,
+   .close = mmio_close,
+   .write = mmio_write,
+   .write_data = mmio_write_data,
+   .read = mmio_read,
+   .read_gang = mmio_read_gang,
+};
+
+/* RP1 (Raspberry Pi 5): IO_BANK0, SYS_RIO0 and PADS_BANK0 */
+#define RP1_IO_BANK0     (0x00000 / 4)
+#define RP1_SYS_RIO0     (0x10000 / 4)
+#define RP1_PADS_BANK0   (0x20000 / 4)
+#define RP1_MAP_LEN      (0x30000)
+#define RP1_RIO_OUT      (0x00 / 4)
+#define RP1_RIO_OE       (0x04 / 4)
+#define RP1_RIO_SYNC_IN  (0x08 / 4)
+#define RP1_SET          (0x2000 / 4)  /* atomic set alias */
+#define RP1_CLR          (0x3000 / 4)  /* atomic clear alias */
+#define RP1_FUNC_SYS_RIO (5)
+#define RP1_PAD_IE       (1u << 6)
+#define RP1_PAD_OD       (1u << 7)
+
+static void rp1_setup_pin(volatile uint32_t *base, int pin, bool output)
+{
+   volatile uint32_t *ctrl = &base[RP1_IO_BANK0 + pin * 2 + 1];
+   volatile uint32_t *pad = &base[RP1_PADS_BANK0 + 1 + pin];
+   volatile uint32_t *rio = &base[RP1_SYS_RIO0];
+
+   *pad = (*pad & ~RP1_PAD_OD) | RP1_PAD_IE;
+   *ctrl = (*ctrl & ~0x1fu) | RP1_FUNC_SYS_RIO;
+   if (output)
+      rio[RP1_SET + RP1_RIO_OE] = 1u << pin;
+   else
+      rio[RP1_CLR + RP1_RIO_OE] = 1u << pin;
+}
+
+static bool rp1_open(struct jtag_gpio *g)
+{
+   if (!is_bcm2712() || !pins_below(&g->pins, 28))
+      return false;
+
+   volatile uint32_t *base = map_gpiomem("/dev/gpiomem0", RP1_MAP_LEN);
+   if (!base)
+      return false;
+   struct gpio_mmio *m = mmio_alloc(g, base, RP1_MAP_LEN);
+   if (!m)
+      return false;
+   m->set = &base[RP1_SYS_RIO0 + RP1_SET + RP1_RIO_OUT];
+   m->clr = &base[RP1_SYS_RIO0 + RP1_CLR + RP1_RIO_OUT];
+   m->lev = &base[RP1_SYS_RIO0 + RP1_RIO_SYNC_IN];
+
+   mmio_write(g, 0, 1, 0);
+   rp1_setup_pin(base, g->pins.tdo, false);
+   for (int b = 0; b < g->pins.ngang; b++)
+      rp1_setup_pin(base, g->pins.gang[b], false);
+   rp1_setup_pin(base, g->pins.tck, true);
+   rp1_setup_pin(base, g->pins.tms, true);
+   rp1_setup_pin(base, g->pins.tdi, true);
+   return true;
+}
+
+static const struct gpio_backend rp1_backend = {
+   .name = "rp1",
+   .autoselect = true,
+   .open = rp1_open,
+   .close = mmio_close,
+   .write = mmio_write,
+   .write_data = mmio_write_data,
+   .read = mmio_read,
+   .read_gang = mmio_read_gang,
+};
+
+/*
+ * Mock: one simulated TAP with a 6-bit IR (Xilinx encoding), IDCODE
+ * and BYPASS.  TDI is sampled on the rising TCK edge and TDO changes on
+ * the falling edge, as on real hardware.  In gang mode every TDO pin
+ * has its own, identical TAP.  Used for testing without a board; never
+ * chosen automatically.
+ *
+ * Configuration is modelled just far enough for the programmer: the IR
+ * capture value carries INIT_COMPLETE and DONE, JPROGRAM clears the
+ * device, CFG_IN watches for the sync word, JSTART after a sync sets
+ * DONE, and CFG_OUT always reads the STAT register.
+ */
+#define MOCK_IDCODE      (0x0362d093)  /* XC7A35T */
+#define MOCK_IR_LEN      (6)
+#define MOCK_IR_CFG_OUT  (0x04)
+#define MOCK_IR_CFG_IN   (0x05)
+#define MOCK_IR_IDCODE   (0x09)
+#define MOCK_IR_JPROGRAM (0x0b)
+#define MOCK_IR_JSTART   (0x0c)
+#define MOCK_SYNC_WORD   (0xaa995566)
+
+struct mock_tap {
+   int state;
+   int tck;
+   int tdo;
+   uint32_t ir;
+   uint32_t sr;                /* active shift register */
+   int sr_len;
+   bool init, synced, done;    /* configuration */
+   uint32_t cfg_word;          /* last 32 bits into CFG_IN, MSB first */
+};
+
+static uint32_t mock_bitrev32(uint32_t x)
+{
+   uint32_t r = 0;
+   for (int i = 0; i < 32; i++, x >>= 1)
+      r = (r << 1) | (x & 1);
+   return r;
+}
+
+struct mock_priv {
+   struct mock_tap tap[1 + MAX_GANG];
+};
+
+static bool mock_open(struct jtag_gpio *g)
+{
+   struct mock_priv *p = calloc(1, sizeof(*p));
+
+   if (!p)
+      return false;
+   for (int t = 0; t <= g->pins.ngang; t++) {
+      p->tap[t].state = TAP_RESET;
+      p->tap[t].ir = MOCK_IR_IDCODE;
+   }
+   g->priv = p;
+   return true;
+}
+
+static void mock_close(struct jtag_gpio *g)
+{
+   free(g->priv);
+   g->priv = NULL;
+}
+
+static void mock_tap_write(struct mock_tap *p, int tck, int tms, int tdi)
+{
+   if (tck && !p->tck) {
+      switch (p->state) {
+      case TAP_DRCAPTURE:
+         if (p->ir == MOCK_IR_IDCODE) {
+            p->sr = MOCK_IDCODE;
+            p->sr_len = 32;
+         } else if (p->ir == MOCK_IR_CFG_OUT) {
+            /* STAT: DONE (14), INIT_B (12); shifted out MSB first */
+            p->sr = mock_bitrev32(p->done << 14 | p->init << 12);
+            p->sr_len = 32;
+         } else {
+            p->sr = 0;
+            p->sr_len = 1;
+         }
+         break;
+      case TAP_IRCAPTURE:
+         p->sr = 0x01 | p->init << 4 | p->done << 5;
+         p->sr_len = MOCK_IR_LEN;
+         break;
+      case TAP_DRSHIFT:
+         if (p->ir == MOCK_IR_CFG_IN) {
+            p->cfg_word = p->cfg_word << 1 | (tdi & 1);
+            p->synced |= p->cfg_word == MOCK_SYNC_WORD;
+         }
+         /* fall through */
+      case TAP_IRSHIFT:
+         p->sr = (p->sr >> 1) | ((uint32_t)(tdi & 1) << (p->sr_len - 1));
+         break;
+      }
+      p->state = tap_next[p->state][tms & 1];
+      if (p->state == TAP_IRUPDATE) {
+         p->ir = p->sr & ((1u << MOCK_IR_LEN) - 1);
+         if (p->ir == MOCK_IR_JPROGRAM) {
+            p->init = true;
+            p->synced = p->done = false;
+         } else if (p->ir == MOCK_IR_JSTART && p->synced) {
+            p->done = true;
+         }
+      } else if (p->state == TAP_RESET)
+         p->ir = MOCK_IR_IDCODE;
+   } else if (!tck && p->tck) {
+      if (p->state == TAP_DRSHIFT || p->state == TAP_IRSHIFT)
+         p->tdo = p->sr & 1;
+   }
+   p->tck = tck;
+}
+
+static void mock_write(struct jtag_gpio *g, int tck, int tms, int tdi)
+{
+   struct mock_priv *p = g->priv;
+
+   for (int t = 0; t <= g->pins.ngang; t++)
+      mock_tap_write(&p->tap[t], tck, tms, tdi);
+}
+
+static int mock_read(struct jtag_gpio *g)
+{
+   struct mock_priv *p = g->priv;
+   return p->tap[0].tdo;
+}
+
+static uint32_t mock_read_gang(struct jtag_gpio *g)
+{
+   struct mock_priv *p = g->priv;
+   uint32_t v = 0;
+
+   for (int t = 0; t <= g->pins.ngang; t++)
+      v |= (uint32_t)p->tap[t].tdo << t;
+   return v;
+}
+
+static const struct gpio_backend mock_backend = {
+   .name = "mock",
+   .autoselect = false,
+   .open = mock_open,
+   .close = mock_close,
+   .write = mock_write,
+   .read = mock_read,
+   .read_gang = mock_read_gang,
+};
+
+/*
+ * Co-simulation: the TAP is an RTL model running in Verilator or Icarus
+ * with cosim_shim.c, reached through the ring of cosim.h.  jtag_shift()
+ * hands over whole vectors, so the simulator clocks them at its own speed
+ * with one exchange per vector.  Bits clocked by pin writes (gpio_xfer)
+ * are collected and sent when TDO is read.  Without a simulator attached
+ * TDO reads 0, as with no cable.
+ */
+#define COSIM_PIN_BITS    (64)
+#define COSIM_ATTACH_WAIT (30)     /* s, for the first simulator */
+
+struct cosim_priv {
+   struct cosim_ring *ring;
+   char path[64];
+   int tck;
+   int pend;                   /* bits clocked by pin writes, not yet sent */
+   uint8_t tms[COSIM_PIN_BITS / 8];
+   uint8_t tdi[COSIM_PIN_BITS / 8];
+   int tdo;
+   bool detached;              /* reported, until a simulator attaches */
+   bool seen;                  /* a simulator has attached at least once */
+};
+
+static bool cosim_open(struct jtag_gpio *g)
+{
+   struct cosim_priv *p;
+
+   if (g->pins.ngang)
+      return false;
+   p = calloc(1, sizeof(*p));
+   if (!p)
+      return false;
+   snprintf(p->path, sizeof(p->path), COSIM_PATH, g->pins.tck);
+   unlink(p->path);
+   int fd = open(p->path, O_RDWR | O_CREAT | O_EXCL, 0666);
+   if (fd < 0 || ftruncate(fd, sizeof(struct cosim_ring)) < 0) {
+      perror(p->path);
+      if (fd >= 0) {
+         close(fd);
+         unlink(p->path);
+      }
+      free(p);
+      return false;
+   }
+   p->ring = mmap(NULL, sizeof(*p->ring), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+   close(fd);
+   if (p->ring == MAP_FAILED) {
+      perror("mmap");
+      unlink(p->path);
+      free(p);
+      return false;
+   }
+   p->ring->version = COSIM_VERSION;
+   __atomic_store_n(&p->ring->magic, COSIM_MAGIC, __ATOMIC_RELEASE);
+   g->priv = p;
+   printf("Co-simulation: attach the simulator to %s\n", p->path);
+   return true;
+}
+
+/*
+ * A simulator is attached and still running; a dead one's vectors are
+ * dropped.  The first vector waits for one to start, as it cannot attach
+ * before the ring exists, e.g. for -P.
+ */
+static bool cosim_attached(struct cosim_priv *p)
+{
+   struct cosim_ring *r = p->ring;
+   int32_t pid = __atomic_load_n(&r->sim_pid, __ATOMIC_ACQUIRE);
+
+   if (!p->seen && !pid) {
+      fprintf(stderr, "%s: waiting %d s for a simulator\n", p->path, COSIM_ATTACH_WAIT);
+      for (int i = 0; i < COSIM_ATTACH_WAIT * 10 && !pid; i++) {
+         usleep(100000);
+         pid = __atomic_load_n(&r->sim_pid, __ATOMIC_ACQUIRE);
+      }
+   }
+   p->seen = true;
+
+   if (pid && kill(pid, 0) < 0 && errno == ESRCH) {
+      fprintf(stderr, "%s: simulator %d has gone\n", p->path, (int)pid);
+      cosim_store(&r->done, r->posted);
+      __atomic_compare_exchange_n(&r->sim_pid, &pid, 0, false,
+                                  __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+      pid = 0;
+   }
+   if (!pid && !p->detached)
+      fprintf(stderr, "%s: no simulator attached, TDO reads 0\n", p->path);
+   p->detached = !pid;
+   return pid != 0;
+}
+
+/*
+ * Post one vector; with tdo, wait for the simulator to finish it.  A
+ * slow simulator is waited for as long as it runs.
+ */
+static void cosim_send(struct cosim_priv *p, int bits, const uint8_t *tms,
+                       const uint8_t *tdi, uint8_t *tdo)
+{
+   struct cosim_ring *r = p->ring;
+   const size_t nb = (bits + 7) / 8;
+   const uint32_t n = r->posted;
+   uint32_t d;
+
+   if (!cosim_attached(p))
+      return;
+   while (n - (d = cosim_load(&r->done)) >= COSIM_SLOTS) {
+      cosim_wait(&r->done, d, 100);
+      if (cosim_load(&r->done) == d && !cosim_attached(p))
+         return;
+   }
+
+   struct cosim_slot *s = &r->slot[n % COSIM_SLOTS];
+   s->bits = bits;
+   s->flags = tdo ? 0 : COSIM_NO_TDO;
+   memcpy(s->tms, tms, nb);
+   memcpy(s->tdi, tdi, nb);
+   cosim_store(&r->posted, n + 1);
+   if (!tdo)
+      return;
+
+   while ((int32_t)((d = cosim_load(&r->done)) - (n + 1)) < 0) {
+      cosim_wait(&r->done, d, 100);
+      if (cosim_load(&r->done) == d && !cosim_attached(p))
+         return;
+   }
+   memcpy(tdo, s->tdo, nb);
+}
+
+/* Send the bits clocked by pin writes; TDO of the last one is kept */
+static void cosim_pin_flush(struct cosim_priv *p)
+{
+   uint8_t tdo[COSIM_PIN_BITS / 8] = { 0 };
+   int last = p->pend - 1;
+
+   cosim_send(p, p->pend, p->tms, p->tdi, tdo);
+   p->tdo = (tdo[last / 8] >> (last % 8)) & 1;
+   p->pend = 0;
+}
+
+static void cosim_shift(struct jtag_gpio *g, int bits, const uint8_t *tms,
+                        const uint8_t *tdi, uint8_t *tdo)
+{
+   struct cosim_priv *p = g->priv;
+
+   if (p->pend)
+      cosim_pin_flush(p);
+   for (int off = 0; off < bits; off += COSIM_MAX_BITS) {
+      int n = bits - off < COSIM_MAX_BITS ? bits - off : COSIM_MAX_BITS;
+      cosim_send(p, n, tms + off / 8, tdi + off / 8, tdo ? tdo + off / 8 : NULL);
+   }
+}
+
+static void cosim_write(struct jtag_gpio *g, int tck, int tms, int tdi)
+{
+   struct cosim_priv *p = g->priv;
+
+   if (tck && !p->tck) {
+      if (p->pend == COSIM_PIN_BITS)
+         cosim_pin_flush(p);
+      int i = p->pend++;
+      uint8_t m = 1 << (i % 8);
+      p->tms[i / 8] = tms ? p->tms[i / 8] | m : p->tms[i / 8] & ~m;
+      p->tdi[i / 8] = tdi ? p->tdi[i / 8] | m : p->tdi[i / 8] & ~m;
+   }
+   p->tck = tck;
+}
+
+static int cosim_read(struct jtag_gpio *g)
+{
+   struct cosim_priv *p = g->priv;
+
+   if (p->pend)
+      cosim_pin_flush(p);
+   return p->tdo;
+}
+
+static void cosim_close(struct jtag_gpio *g)
+{
+   struct cosim_priv *p = g->priv;
+   struct cosim_ring *r = p->ring;
+
+   if (p->pend)
+      cosim_pin_flush(p);
+   cosim_store(&r->closed, 1);
+   cosim_store(&r->posted, r->posted);      /* wakes a simulator waiting for work */
+   munmap(r, sizeof(*r));
+   unlink(p->path);
+   free(p);
+   g->priv = NULL;
+}
+
+static const struct gpio_backend cosim_backend = {
+   .name = "cosim",
+   .autoselect = false,
+   .open = cosim_open,
+   .close = cosim_close,
+   .write = cosim_write,
+   .read = cosim_read,
+   .shift = cosim_shift,
+};
+
+const struct gpio_backend *const gpio_backends[] = {
+   &rp1_backend,
+   &gpiomem_backend,
+   &gpiod_bulk_backend,
+   &gpiod_backend,
+   &mock_backend,
+   &cosim_backend,
+   NULL
+};
+
+const struct gpio_backend *gpio_backend_find(const char *name)
+{
+   for (int i = 0; gpio_backends[i]; i++)
+      if (strcmp(gpio_backends[i]->name, name) == 0)
+         return gpio_backends[i];
+   return NULL;
+}
+
+/*
+ * Time a burst of pin accesses with TCK held low, so the target sees no
+ * clock edges.  Returns picoseconds per bit (two writes and one read).
+ */
+uint64_t gpio_dry_run_ps(struct jtag_gpio *g, int bits)
+{
+   uint64_t t0 = now_ns();
+
+   for (int i = 0; i < bits; i++) {
+      g->be->write(g, 0, 1, i & 1);
+      g->be->write(g, 0, 1, i & 1);
+      g->be->read(g);
+   }
+   uint64_t t = now_ns() - t0;
+   g->be->write(g, 0, 1, 0);
+   return t * 1000 / bits;
+}
+
+/*
+ * Open the named backend, or probe every automatic candidate and keep
+ * the one with the fastest dry run.
+ */
+bool gpio_open(struct jtag_gpio *g, const char *backend)
+{
+   g->kernel = NULL;
+   g->mmio = NULL;
+   if (!g->delay.ps)
+      delay_set_loops(&g->delay, jtag_delay);
+   if (backend) {
+      g->be = gpio_backend_find(backend);
+      if (!g->be) {
+         fprintf(stderr, "Unknown GPIO backend '%s'\n", backend);
+         return false;
+      }
+      if (!g->be->open(g)) {
+         fprintf(stderr, "GPIO backend '%s' is not usable\n", backend);
+         g->be = NULL;           /* nothing for gpio_close() to close */
+         return false;
+      }
+   } else {
+      const struct gpio_backend *best = NULL;
+      uint64_t best_ps = UINT64_MAX;
+
+      for (int i = 0; gpio_backends[i]; i++) {
+         g->be = gpio_backends[i];
+         if (!g->be->autoselect || !g->be->open(g)) {
+            if (verbose && g->be->autoselect)
+               printf("Backend %-10s : not usable\n", g->be->name);
+            continue;
+         }
+         uint64_t ps = gpio_dry_run_ps(g, DRY_RUN_BITS);
+         g->be->close(g);
+         if (verbose)
+            printf("Backend %-10s : %llu.%03llu ns/bit\n", g->be->name,
+                   (unsigned long long)ps / 1000, (unsigned long long)ps % 1000);
+         if (ps < best_ps) {
+            best_ps = ps;
+            best = g->be;
+         }
+      }
+      if (!best) {
+         fprintf(stderr, "No usable GPIO backend\n");
+         g->be = NULL;
+         return false;
+      }
+      g->be = best;
+      if (!g->be->open(g)) {
+         g->be = NULL;
+         return false;
+      }
+      printf("Using GPIO backend '%s' (%llu.%03llu ns/bit)\n", best->name,
+             (unsigned long long)best_ps / 1000, (unsigned long long)best_ps % 1000);
+   }
+
+   if (verbose) {
+      printf("GPIO lines configured successfully\n");
+      printf("TMS=GPIO%d, TDI=GPIO%d, TCK=GPIO%d, TDO=GPIO%d\n",
+             g->pins.tms, g->pins.tdi, g->pins.tck, g->pins.tdo);
+      for (int b = 0; b < g->pins.ngang; b++)
+         printf("Gang board %d: TDO=GPIO%d\n", b + 1, g->pins.gang[b]);
+   }
+
+   // Initialize JTAG state
+   gpio_write(g, 0, 1, 0);
+   return true;
+}
+
+void gpio_close(struct jtag_gpio *g)
+{
+   if (g->be) {
+      g->be->close(g);
+      g->be = NULL;
+   }
+}
+
+/*
+ * This work, "jtag_gpio.c", is part of "xvcpi.c"
+ * Updated for modern Raspberry Pi systems using libgpiod
+ *
+ * Original "xvcpi.c" is licensed under CC0 1.0 Universal
+ * by Derek Mulcahy.
+ */
@@ -0,0 +1,328 @@
+/*
+ * Description :  Shift kernels for the xvcpi JTAG engine
+ *
+ *                This file is compiled once generically and, on ARM, once
+ *                per supported core with -mcpu and -DKERNEL_VARIANT, so
+ *                each Pi model gets kernels scheduled for its pipeline.
+ *
+ * See Licensing information at End of File.
+ */
+
+#include "jtag.h"
+
+/*
+ * Vectors are split into runs of constant TMS.  Runs of at least
+ * TMS_RUN_MIN bits (Shift-DR/IR payloads, Run-Test/Idle waits) go to a
+ * kernel that sets TMS once and then only drives TCK and TDI; the short
+ * mixed runs of state navigation take the general path.
+ */
+#define TMS_RUN_MIN (16)
+
+static inline int bit_at(const uint8_t *buf, int i)
+{
+   return (buf[i >> 3] >> (i & 7)) & 1;
+}
+
+/* End of the run of equal TMS bits starting at bit i */
+static int tms_run_end(const uint8_t *tms, int i, int bits)
+{
+   int v = bit_at(tms, i);
+   uint8_t fill = v ? 0xff : 0x00;
+
+   for (i++; i < bits && (i & 7); i++)
+      if (bit_at(tms, i) != v)
+         return i;
+   while (i + 8 <= bits && tms[i >> 3] == fill)
+      i += 8;
+   while (i < bits && bit_at(tms, i) == v)
+      i++;
+   return i;
+}
+
+/*
+ * Split the vector at bit i into [i, *mid) of short mixed runs and the
+ * long run [*mid, *end) that follows them, which may be empty.
+ */
+static inline void next_segment(const uint8_t *tms, int i, int bits, int *mid, int *end)
+{
+   while (i < bits) {
+      int e = tms_run_end(tms, i, bits);
+      if (e - i >= TMS_RUN_MIN) {
+         *mid = i;
+         *end = e;
+         return;
+      }
+      i = e;
+   }
+   *mid = *end = bits;
+}
+
+/*
+ * Generic kernel: any backend, any delay mode, pins driven through the
+ * backend ops.  Both halves work a byte of TMS/TDI/TDO at a time.  Like
+ * the memory-mapped kernels it comes in two instances, with TDO capture
+ * and write-only (capture false, tdo NULL), which never reads the pin.
+ */
+static inline __attribute__((always_inline))
+void shift_general(struct jtag_gpio *g, int i, int end, const uint8_t *tms,
+                   const uint8_t *tdi, uint8_t *tdo, const bool capture)
+{
+   while (i < end) {
+      int b = i >> 3, sh = i & 7;
+      int n = end - i < 8 - sh ? end - i : 8 - sh;
+      unsigned int m = tms[b] >> sh, d = tdi[b] >> sh, out = 0;
+
+      for (int k = 0; k < n; k++) {
+         gpio_write(g, 0, m & 1, d & 1);
+         gpio_write(g, 1, m & 1, d & 1);
+         if (capture)
+            out |= gpio_sample(g, i + k) << k;
+         m >>= 1;
+         d >>= 1;
+      }
+      if (capture)
+         tdo[b] |= out << sh;
+      i += n;
+   }
+}
+
+static inline __attribute__((always_inline))
+void shift_tms_run(struct jtag_gpio *g, int i, int end, int tms,
+                   const uint8_t *tdi, uint8_t *tdo, const bool capture)
+{
+   /* The first falling edge sets TMS for the whole run */
+   gpio_write(g, 0, tms, bit_at(tdi, i));
+   gpio_write_data(g, 1, bit_at(tdi, i));
+   if (capture)
+      tdo[i >> 3] |= gpio_sample(g, i) << (i & 7);
+   i++;
+
+   while (i < end) {
+      int b = i >> 3, sh = i & 7;
+      int n = end - i < 8 - sh ? end - i : 8 - sh;
+      unsigned int d = tdi[b] >> sh, out = 0;
+
+      for (int k = 0; k < n; k++) {
+         gpio_write_data(g, 0, d & 1);
+         gpio_write_data(g, 1, d & 1);
+         if (capture)
+            out |= gpio_sample(g, i + k) << k;
+         d >>= 1;
+      }
+      if (capture)
+         tdo[b] |= out << sh;
+      i += n;
+   }
+}
+
+static inline __attribute__((always_inline))
+void generic_shift(struct jtag_gpio *g, int bits, const uint8_t *tms,
+                   const uint8_t *tdi, uint8_t *tdo, const bool capture)
+{
+   int mid, end;
+
+   for (int i = 0; i < bits; i = end) {
+      next_segment(tms, i, bits, &mid, &end);
+      if (mid > i)
+         shift_general(g, i, mid, tms, tdi, tdo, capture);
+      if (end > mid)
+         shift_tms_run(g, mid, end, bit_at(tms, mid), tdi, tdo, capture);
+   }
+}
+
+static void generic_kernel(struct jtag_gpio *g, int bits, const uint8_t *tms,
+                           const uint8_t *tdi, uint8_t *tdo)
+{
+   generic_shift(g, bits, tms, tdi, tdo, true);
+}
+
+static void generic_kernel_wo(struct jtag_gpio *g, int bits, const uint8_t *tms,
+                              const uint8_t *tdi, uint8_t *tdo)
+{
+   generic_shift(g, bits, tms, tdi, tdo, false);
+}
+
+/* Gang boards whose TDO pins are set in pins */
+static __attribute__((noinline, cold))
+void mmio_gang_mismatch(struct jtag_gpio *g, int bit, uint32_t pins)
+{
+   uint32_t boards = 0;
+
+   for (int b = 0; b < g->pins.ngang; b++)
+      if ((pins >> g->pins.gang[b]) & 1)
+         boards |= 1u << b;
+   gang_mismatch(g, bit, boards);
+}
+
+/* One TDO sample; in gang mode the other boards come from the same read */
+static inline __attribute__((always_inline))
+uint32_t mmio_sample(struct jtag_gpio *g, volatile const uint32_t *lev, int tdo_pin,
+                     uint32_t gang_mask, int bit, const bool gang)
+{
+   uint32_t l = *lev, t = (l >> tdo_pin) & 1;
+
+   if (gang) {
+      uint32_t d = (l ^ -t) & gang_mask;
+      if (__builtin_expect(d != 0, 0))
+         mmio_gang_mismatch(g, bit, d);
+   }
+   return t;
+}
+
+/*
+ * Memory-mapped kernels.  mmio_kernel() is instantiated below for fixed
+ * spin delays, which the compiler unrolls or drops, and once for a
+ * runtime delay read at entry.  Register addresses and pin masks are
+ * held in locals, TMS/TDI levels become masks without branches, and the
+ * rising edge is a single store since only TCK changes.  The gang
+ * instance also compares every gang board's TDO with the primary's; the
+ * write-only instances (capture false) never read the level register.
+ */
+static inline __attribute__((always_inline))
+void mmio_kernel(struct jtag_gpio *g, int bits, const uint8_t *tms,
+                 const uint8_t *tdi, uint8_t *tdo, const unsigned int delay,
+                 const bool gang, const bool capture)
+{
+   const struct gpio_mmio *m = g->mmio;
+   volatile uint32_t *const set = m->set;
+   volatile uint32_t *const clr = m->clr;
+   volatile const uint32_t *const lev = m->lev;
+   const uint32_t tck_mask = m->tck_mask;
+   const uint32_t tms_mask = m->tms_mask;
+   const uint32_t tdi_mask = m->tdi_mask;
+   const uint32_t out_mask = m->out_mask;
+   const uint32_t data_mask = m->data_mask;
+   const uint32_t gang_mask = m->gang_mask;
+   const int tdo_pin = m->tdo;
+   int mid, end;
+
+   for (int i = 0; i < bits; i = end) {
+      next_segment(tms, i, bits, &mid, &end);
+
+      while (i < mid) {
+         int b = i >> 3, sh = i & 7;
+         int n = mid - i < 8 - sh ? mid - i : 8 - sh;
+         uint32_t mb = tms[b] >> sh, db = tdi[b] >> sh, out = 0;
+
+         for (int k = 0; k < n; k++) {
+            uint32_t v = (-(mb & 1) & tms_mask) | (-(db & 1) & tdi_mask);
+            *set = v;
+            *clr = out_mask & ~v;
+            spin_delay(delay);
+            *set = tck_mask;
+            spin_delay(delay);
+            if (capture)
+               out |= mmio_sample(g, lev, tdo_pin, gang_mask, i + k, gang) << k;
+            mb >>= 1;
+            db >>= 1;
+         }
+         if (capture)
+            tdo[b] |= out << sh;
+         i += n;
+      }
+
+      if (i == end)
+         continue;
+
+      /* Constant TMS: set it once while TCK is still high */
+      if (bit_at(tms, i))
+         *set = tms_mask;
+      else
+         *clr = tms_mask;
+
+      while (i < end) {
+         int b = i >> 3, sh = i & 7;
+         int n = end - i < 8 - sh ? end - i : 8 - sh;
+         uint32_t db = tdi[b] >> sh, out = 0;
+
+         for (int k = 0; k < n; k++) {
+            uint32_t v = -(db & 1) & tdi_mask;
+            *set = v;
+            *clr = data_mask & ~v;
+            spin_delay(delay);
+            *set = tck_mask;
+            spin_delay(delay);
+            if (capture)
+               out |= mmio_sample(g, lev, tdo_pin, gang_mask, i + k, gang) << k;
+            db >>= 1;
+         }
+         if (capture)
+            tdo[b] |= out << sh;
+         i += n;
+      }
+   }
+   g->tms = bit_at(tms, bits - 1);
+}
+
+#define MMIO_FIXED_KERNEL(D)                                                 \
+   static void mmio_d##D(struct jtag_gpio *g, int bits, const uint8_t *tms,  \
+                         const uint8_t *tdi, uint8_t *tdo)                   \
+   {                                                                         \
+      mmio_kernel(g, bits, tms, tdi, tdo, D, false, true);                   \
+   }                                                                         \
+   static void mmio_d##D##_wo(struct jtag_gpio *g, int bits,                 \
+                              const uint8_t *tms, const uint8_t *tdi,        \
+                              uint8_t *tdo)                                  \
+   {                                                                         \
+      mmio_kernel(g, bits, tms, tdi, tdo, D, false, false);                  \
+   }
+
+MMIO_FIXED_KERNEL(0)
+MMIO_FIXED_KERNEL(1)
+MMIO_FIXED_KERNEL(2)
+MMIO_FIXED_KERNEL(4)
+MMIO_FIXED_KERNEL(8)
+MMIO_FIXED_KERNEL(16)
+MMIO_FIXED_KERNEL(32)
+
+static void mmio_dn(struct jtag_gpio *g, int bits, const uint8_t *tms,
+                    const uint8_t *tdi, uint8_t *tdo)
+{
+   mmio_kernel(g, bits, tms, tdi, tdo, g->delay.loops, false, true);
+}
+
+/* Also the gang kernel's write-only twin: without TDO there is nothing to compare */
+static void mmio_dn_wo(struct jtag_gpio *g, int bits, const uint8_t *tms,
+                       const uint8_t *tdi, uint8_t *tdo)
+{
+   mmio_kernel(g, bits, tms, tdi, tdo, g->delay.loops, false, false);
+}
+
+static void mmio_gang(struct jtag_gpio *g, int bits, const uint8_t *tms,
+                      const uint8_t *tdi, uint8_t *tdo)
+{
+   mmio_kernel(g, bits, tms, tdi, tdo, g->delay.loops, true, true);
+}
+
+/* Exported as kernels_<variant>; jtag_dispatch.c picks one per CPU */
+#ifndef KERNEL_VARIANT
+#define KERNEL_VARIANT generic
+#endif
+#define KERNEL_SET_NAME(v)  KERNEL_SET_NAME_(v)
+#define KERNEL_SET_NAME_(v) kernels_##v
+#define STR(v)  STR_(v)
+#define STR_(v) #v
+
+const struct kernel_set KERNEL_SET_NAME(KERNEL_VARIANT) = {
+   .variant = STR(KERNEL_VARIANT),
+   .generic = { 0, generic_kernel, generic_kernel_wo, "generic/" STR(KERNEL_VARIANT) },
+   .mmio = { 0, mmio_dn, mmio_dn_wo, "mmio/" STR(KERNEL_VARIANT) },
+   .mmio_fixed = {
+      { 0, mmio_d0, mmio_d0_wo, "mmio-d0/" STR(KERNEL_VARIANT) },
+      { 1, mmio_d1, mmio_d1_wo, "mmio-d1/" STR(KERNEL_VARIANT) },
+      { 2, mmio_d2, mmio_d2_wo, "mmio-d2/" STR(KERNEL_VARIANT) },
+      { 4, mmio_d4, mmio_d4_wo, "mmio-d4/" STR(KERNEL_VARIANT) },
+      { 8, mmio_d8, mmio_d8_wo, "mmio-d8/" STR(KERNEL_VARIANT) },
+      { 16, mmio_d16, mmio_d16_wo, "mmio-d16/" STR(KERNEL_VARIANT) },
+      { 32, mmio_d32, mmio_d32_wo, "mmio-d32/" STR(KERNEL_VARIANT) },
+   },
+   .mmio_gang = { 0, mmio_gang, mmio_dn_wo, "mmio-gang/" STR(KERNEL_VARIANT) },
+};
+
+/*
+ * This work, "jtag_kernel.c", is part of "xvcpi.c"
+ * Updated for modern Raspberry Pi systems using libgpiod
+ *
+ * Original "xvcpi.c" is licensed under CC0 1.0 Universal
+ * by Derek Mulcahy.
+ */
@@ -0,0 +1,273 @@
+/*
+ * Description :  IEEE 1149.1 TAP controller state machine
+ *
+ *                Shared by the mock backend, the SVF player and the
+ *                tracer: the state table, SVF state names, TMS paths
+ *                between states and a tracker that decodes scans.
+ *
+ * See Licensing information at End of File.
+ */
+
+#include <pthread.h>
+#include <string.h>
+#include <strings.h>
+#include "jtag.h"
+
+/* Next TAP state for TMS=0 and TMS=1 */
+const uint8_t tap_next[TAP_STATES][2] = {
+   [TAP_RESET]     = { TAP_IDLE,      TAP_RESET     },
+   [TAP_IDLE]      = { TAP_IDLE,      TAP_DRSELECT  },
+   [TAP_DRSELECT]  = { TAP_DRCAPTURE, TAP_IRSELECT  },
+   [TAP_DRCAPTURE] = { TAP_DRSHIFT,   TAP_DREXIT1   },
+   [TAP_DRSHIFT]   = { TAP_DRSHIFT,   TAP_DREXIT1   },
+   [TAP_DREXIT1]   = { TAP_DRPAUSE,   TAP_DRUPDATE  },
+   [TAP_DRPAUSE]   = { TAP_DRPAUSE,   TAP_DREXIT2   },
+   [TAP_DREXIT2]   = { TAP_DRSHIFT,   TAP_DRUPDATE  },
+   [TAP_DRUPDATE]  = { TAP_IDLE,      TAP_DRSELECT  },
+   [TAP_IRSELECT]  = { TAP_IRCAPTURE, TAP_RESET     },
+   [TAP_IRCAPTURE] = { TAP_IRSHIFT,   TAP_IREXIT1   },
+   [TAP_IRSHIFT]   = { TAP_IRSHIFT,   TAP_IREXIT1   },
+   [TAP_IREXIT1]   = { TAP_IRPAUSE,   TAP_IRUPDATE  },
+   [TAP_IRPAUSE]   = { TAP_IRPAUSE,   TAP_IREXIT2   },
+   [TAP_IREXIT2]   = { TAP_IRSHIFT,   TAP_IRUPDATE  },
+   [TAP_IRUPDATE]  = { TAP_IDLE,      TAP_DRSELECT  },
+};
+
+/* SVF spelling */
+const char *const tap_names[TAP_STATES] = {
+   "RESET", "IDLE",
+   "DRSELECT", "DRCAPTURE", "DRSHIFT", "DREXIT1", "DRPAUSE", "DREXIT2", "DRUPDATE",
+   "IRSELECT", "IRCAPTURE", "IRSHIFT", "IREXIT1", "IRPAUSE", "IREXIT2", "IRUPDATE",
+};
+
+int tap_state_find(const char *name, size_t len)
+{
+   for (int s = 0; s < TAP_STATES; s++)
+      if (strlen(tap_names[s]) == len && strncasecmp(tap_names[s], name, len) == 0)
+         return s;
+   return -1;
+}
+
+/* States a TAP may be left in: the SVF end states */
+bool tap_stable(int s)
+{
+   return s == TAP_RESET || s == TAP_IDLE || s == TAP_DRPAUSE || s == TAP_IRPAUSE;
+}
+
+/*
+ * Shortest TMS sequence from one state to another, LSB first; returns
+ * its length.  Reset is always five TMS=1 clocks, which reach it from
+ * anywhere, including an unknown state.
+ */
+int tap_path(int from, int to, uint32_t *tms)
+{
+   uint8_t prev[TAP_STATES], seen[TAP_STATES] = { 0 };
+   uint8_t queue[TAP_STATES];
+   int head = 0, tail = 0, n = 0;
+
+   *tms = 0;
+   if (to == TAP_RESET) {
+      *tms = 0x1f;
+      return 5;
+   }
+   if (from == to)
+      return 0;
+
+   seen[from] = 1;
+   queue[tail++] = from;
+   while (head < tail && !seen[to]) {
+      int s = queue[head++];
+      for (int v = 0; v < 2; v++) {
+         int t = tap_next[s][v];
+         if (!seen[t]) {
+            seen[t] = 1;
+            prev[t] = s;
+            queue[tail++] = t;
+         }
+      }
+   }
+
+   /* Walk back from the target, then reverse into TMS order */
+   uint8_t bits[TAP_STATES];
+   for (int s = to; s != from; s = prev[s])
+      bits[n++] = tap_next[prev[s]][1] == s;
+   for (int i = 0; i < n; i++)
+      *tms |= (uint32_t)bits[n - 1 - i] << i;
+   return n;
+}
+
+/*
+ * Tracker table: for each state and TMS byte, the state after it, the
+ * bits clocked in Shift-IR, the number clocked in Shift-DR, and whether
+ * the byte has to be walked bit by bit because a scan starts or ends
+ * in it.
+ */
+struct tap_step {
+   uint8_t next;
+   uint8_t ir_mask;
+   uint8_t dr_count;
+   uint8_t slow;
+};
+
+static struct tap_step tap_steps[TAP_STATES][256];
+static pthread_once_t tap_steps_once = PTHREAD_ONCE_INIT;
+
+static inline bool tap_step_event(int from, int to)
+{
+   return to == TAP_IRCAPTURE || to == TAP_DRCAPTURE || to == TAP_IRUPDATE ||
+          to == TAP_DRUPDATE || (to == TAP_RESET && from != TAP_RESET);
+}
+
+static void tap_steps_build(void)
+{
+   for (int s = 0; s < TAP_STATES; s++) {
+      for (int b = 0; b < 256; b++) {
+         struct tap_step *st = &tap_steps[s][b];
+         int state = s;
+         for (int i = 0; i < 8; i++) {
+            int next = tap_next[state][(b >> i) & 1];
+            if (state == TAP_IRSHIFT)
+               st->ir_mask |= 1 << i;
+            if (state == TAP_DRSHIFT)
+               st->dr_count++;
+            st->slow |= tap_step_event(state, next);
+            state = next;
+         }
+         st->next = state;
+      }
+   }
+}
+
+void tap_trace_init(struct tap_trace *t, tap_event_fn event, void *arg)
+{
+   pthread_once(&tap_steps_once, tap_steps_build);
+   memset(t, 0, sizeof(*t));
+   t->state = TAP_RESET;
+   t->event = event;
+   t->arg = arg;
+}
+
+static inline void tap_trace_ir_bit(struct tap_trace *t, int v)
+{
+   if (t->ir_bits < 64)
+      t->ir_shift |= (uint64_t)v << t->ir_bits;
+   t->ir_bits++;
+}
+
+/* A state entered where a scan starts or ends */
+static void tap_trace_enter(struct tap_trace *t, int state, int next)
+{
+   switch (next) {
+   case TAP_IRCAPTURE:
+      t->ir_shift = 0;
+      t->ir_bits = 0;
+      break;
+   case TAP_DRCAPTURE:
+      t->dr_bits = 0;
+      break;
+   case TAP_IRUPDATE:
+      t->ir = t->ir_shift;
+      t->ir_len = t->ir_bits;
+      t->event(t, TAP_EVENT_IR);
+      break;
+   case TAP_DRUPDATE:
+      t->event(t, TAP_EVENT_DR);
+      break;
+   case TAP_RESET:
+      if (state != TAP_RESET) {
+         t->ir_len = 0;
+         t->event(t, TAP_EVENT_RESET);
+      }
+      break;
+   }
+}
+
+static inline __attribute__((always_inline))
+void tap_trace_bit(struct tap_trace *t, int tms, int tdi)
+{
+   int state = t->state, next = tap_next[state][tms];
+
+   if (state == TAP_IRSHIFT)
+      tap_trace_ir_bit(t, tdi);
+   else if (state == TAP_DRSHIFT)
+      t->dr_bits++;
+   t->state = next;
+   if (tap_step_event(state, next))
+      tap_trace_enter(t, state, next);
+}
+
+void tap_trace_shift(struct tap_trace *t, int bits, const uint8_t *tms, const uint8_t *tdi)
+{
+   const int bytes = bits / 8;
+   unsigned int state = t->state;
+   uint64_t dr_bits = t->dr_bits;
+
+   /* State and DR count stay in registers until a byte needs the slow path */
+   for (int b = 0; b < bytes; b++) {
+      const struct tap_step *st = &tap_steps[state][tms[b]];
+      if (__builtin_expect(st->slow, 0)) {
+         t->state = state;
+         t->dr_bits = dr_bits;
+         for (int k = 0; k < 8; k++)
+            tap_trace_bit(t, (tms[b] >> k) & 1, (tdi[b] >> k) & 1);
+         state = t->state;
+         dr_bits = t->dr_bits;
+         continue;
+      }
+      dr_bits += st->dr_count;
+      if (__builtin_expect(st->ir_mask, 0)) {
+         if (st->ir_mask == 0xff && t->ir_bits <= 56) {
+            t->ir_shift |= (uint64_t)tdi[b] << t->ir_bits;
+            t->ir_bits += 8;
+         } else if (t->ir_bits >= 64) {
+            t->ir_bits += __builtin_popcount(st->ir_mask);
+         } else {
+            for (unsigned int m = st->ir_mask; m; m &= m - 1)
+               tap_trace_ir_bit(t, (tdi[b] >> __builtin_ctz(m)) & 1);
+         }
+      }
+      state = st->next;
+   }
+   t->state = state;
+   t->dr_bits = dr_bits;
+   for (int i = bytes * 8; i < bits; i++)
+      tap_trace_bit(t, (tms[i / 8] >> (i % 8)) & 1, (tdi[i / 8] >> (i % 8)) & 1);
+}
+
+/* 7-series and UltraScale instructions (UG470, UG570) */
+const char *tap_xilinx_ir_name(unsigned int ir)
+{
+   switch (ir) {
+   case 0x01: return "SAMPLE";
+   case 0x02: return "USER1";
+   case 0x03: return "USER2";
+   case 0x04: return "CFG_OUT";
+   case 0x05: return "CFG_IN";
+   case 0x07: return "INTEST";
+   case 0x08: return "USERCODE";
+   case 0x09: return "IDCODE";
+   case 0x0a: return "HIGHZ";
+   case 0x0b: return "JPROGRAM";
+   case 0x0c: return "JSTART";
+   case 0x0d: return "JSHUTDOWN";
+   case 0x10: return "ISC_ENABLE";
+   case 0x11: return "ISC_PROGRAM";
+   case 0x14: return "ISC_NOOP";
+   case 0x16: return "ISC_DISABLE";
+   case 0x17: return "ISC_DNA";
+   case 0x22: return "USER3";
+   case 0x23: return "USER4";
+   case 0x26: return "EXTEST";
+   case 0x37: return "XADC_DRP";
+   case 0x3f: return "BYPASS";
+   }
+   return NULL;
+}
+
+/*
+ * This work, "jtag_tap.c", is part of "xvcpi.c"
+ * Updated for modern Raspberry Pi systems using libgpiod
+ *
+ * Original "xvcpi.c" is licensed under CC0 1.0 Universal
+ * by Derek Mulcahy.
+ */
@@ -0,0 +1,282 @@
+/*
+ * Description :  DVFS-aware JTAG timing for xvcpi
+ *
+ * See Licensing information at End of File.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include "jtag.h"
+
+/*
+ * DVFS-aware timing.
+ *
+ * The -d value is a spin-loop count, which only means a fixed time while
+ * the CPU clock is fixed.  At startup we measure how long one loop takes
+ * and turn the requested delay into picoseconds, referenced to the CPU's
+ * maximum frequency (the clock a delay is normally tuned at).  Between
+ * shifts the cpufreq/thermal state is polled and the loop time is
+ * rescaled, or re-measured, so TCK keeps its period when the governor
+ * moves the clock; each chain converts its delay again on its next
+ * shift.  Alternatively the delay can be timed against the system
+ * counter, which does not depend on the CPU clock at all.
+ *
+ * Every chain's engine thread calls timing_poll(); whichever gets there
+ * first does the poll and the others carry on shifting.
+ */
+#define CPUFREQ_DIR        "/sys/devices/system/cpu/cpu0/cpufreq/"
+#define THERMAL_TEMP       "/sys/class/thermal/thermal_zone0/temp"
+#define TIMING_POLL_NS     (50 * 1000000ULL)    /* cpufreq poll interval */
+#define TIMING_VERIFY_NS   (1000 * 1000000ULL)  /* re-measurement interval */
+#define THERMAL_HOT_MC     (80000)              /* Pi firmware soft limit */
+
+struct jtag_timing timing;
+unsigned int jtag_delay = JTAG_DELAY;
+
+/* Optional performance governor while a client is connected (-g) */
+bool want_performance = false;
+static char saved_governor[32];
+static pthread_mutex_t governor_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t poll_lock = PTHREAD_MUTEX_INITIALIZER;
+
+uint64_t now_ns(void)
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+   return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t counter_freq(void)
+{
+#if defined(__aarch64__)
+   uint64_t v;
+   asm volatile ("mrs %0, cntfrq_el0" : "=r" (v));
+   return v;
+#else
+   return 1000000000ULL;
+#endif
+}
+
+long read_sysfs_long(const char *path)
+{
+   char buf[32];
+   long val = -1;
+   int fd = open(path, O_RDONLY);
+
+   if (fd < 0)
+      return -1;
+   ssize_t n = read(fd, buf, sizeof(buf) - 1);
+   if (n > 0) {
+      buf[n] = 0;
+      val = strtol(buf, NULL, 10);
+   }
+   close(fd);
+   return val;
+}
+
+static unsigned int measure_loop_ps(void)
+{
+   const unsigned int loops = 20000;
+   uint64_t best = UINT64_MAX;
+
+   for (int r = 0; r < 3; r++) {
+      uint64_t t0 = now_ns();
+      spin_delay(loops);
+      uint64_t t = now_ns() - t0;
+      if (t < best)
+         best = t;
+   }
+   best = best * 1000 / loops;
+   return best ? best : 1;
+}
+
+/* Convert the delay into the form used by jtag_wait() */
+void delay_apply(struct jtag_delay *d)
+{
+   d->timing_gen = __atomic_load_n(&timing.generation, __ATOMIC_ACQUIRE);
+   d->generation++;
+   if (timing.counter_wait) {
+      d->ticks = (d->ps * timing.counter_hz + 999999999999ULL) / 1000000000000ULL;
+   } else {
+      const unsigned int loop_ps = __atomic_load_n(&timing.loop_ps, __ATOMIC_RELAXED);
+      d->loops = (d->ps + loop_ps / 2) / loop_ps;
+   }
+}
+
+void delay_set_ps(struct jtag_delay *d, uint64_t ps)
+{
+   d->ps = ps;
+   delay_apply(d);
+}
+
+/* Set the delay from a loop count, which -d gives at full CPU speed */
+void delay_set_loops(struct jtag_delay *d, unsigned int loops)
+{
+   uint64_t loop_ps_at_max = __atomic_load_n(&timing.loop_ps, __ATOMIC_RELAXED);
+   const unsigned int cur_khz = __atomic_load_n(&timing.cur_khz, __ATOMIC_RELAXED);
+
+   if (timing.max_khz && cur_khz)
+      loop_ps_at_max = loop_ps_at_max * cur_khz / timing.max_khz;
+   delay_set_ps(d, (uint64_t)loops * loop_ps_at_max);
+}
+
+/* loop_ps changed: chains convert their delays again */
+static void timing_changed(void)
+{
+   __atomic_add_fetch(&timing.generation, 1, __ATOMIC_RELEASE);
+}
+
+void timing_init(void)
+{
+   long khz;
+
+   timing.counter_hz = counter_freq();
+   khz = read_sysfs_long(CPUFREQ_DIR "cpuinfo_max_freq");
+   timing.max_khz = khz > 0 ? khz : 0;
+   khz = read_sysfs_long(CPUFREQ_DIR "scaling_cur_freq");
+   timing.cur_khz = khz > 0 ? khz : 0;
+   timing.temp_mc = read_sysfs_long(THERMAL_TEMP);
+
+   timing.loop_ps = measure_loop_ps();
+   timing.next_poll_ns = now_ns() + TIMING_POLL_NS;
+   timing.next_verify_ns = timing.next_poll_ns + TIMING_VERIFY_NS;
+
+   if (verbose) {
+      struct jtag_delay d = { 0 };
+
+      delay_set_loops(&d, jtag_delay);
+      printf("Timing: %u.%03u ns/loop at %u kHz (max %u kHz), delay %llu ps",
+             timing.loop_ps / 1000, timing.loop_ps % 1000,
+             timing.cur_khz, timing.max_khz, (unsigned long long)d.ps);
+      if (timing.counter_wait)
+         printf(" = %llu counter ticks\n", (unsigned long long)d.ticks);
+      else
+         printf(" = %u loops\n", d.loops);
+   }
+}
+
+/*
+ * Called between shifts.  Frequency changes reported by cpufreq are
+ * followed by rescaling the loop time; firmware throttling that cpufreq
+ * does not report is caught by periodically timing the loop itself.
+ */
+void timing_poll(void)
+{
+   uint64_t now = now_ns();
+
+   if (now < __atomic_load_n(&timing.next_poll_ns, __ATOMIC_RELAXED) ||
+       pthread_mutex_trylock(&poll_lock))
+      return;
+   if (now < timing.next_poll_ns) {
+      pthread_mutex_unlock(&poll_lock);
+      return;
+   }
+   __atomic_store_n(&timing.next_poll_ns, now + TIMING_POLL_NS, __ATOMIC_RELAXED);
+
+   long khz = read_sysfs_long(CPUFREQ_DIR "scaling_cur_freq");
+   if (khz > 0 && timing.cur_khz && (unsigned int)khz != timing.cur_khz) {
+      unsigned int loop_ps = (uint64_t)timing.loop_ps * timing.cur_khz / khz;
+      if (!loop_ps)
+         loop_ps = 1;
+      __atomic_store_n(&timing.loop_ps, loop_ps, __ATOMIC_RELAXED);
+      __atomic_store_n(&timing.cur_khz, khz, __ATOMIC_RELAXED);
+      timing.rescales++;
+      timing_changed();
+      if (verbose)
+         printf("CPU clock now %ld kHz, %u ps/loop\n", khz, loop_ps);
+   }
+
+   timing.temp_mc = read_sysfs_long(THERMAL_TEMP);
+   if (!timing.counter_wait &&
+       (now >= timing.next_verify_ns || timing.temp_mc >= THERMAL_HOT_MC)) {
+      unsigned int expected = timing.loop_ps;
+      unsigned int measured = measure_loop_ps();
+      timing.next_verify_ns = now + TIMING_VERIFY_NS;
+      /* Allow 5% of measurement noise before trusting the new value */
+      if (measured * 20ULL < expected * 19ULL || measured * 20ULL > expected * 21ULL) {
+         __atomic_store_n(&timing.loop_ps, measured, __ATOMIC_RELAXED);
+         timing.recalibrations++;
+         timing_changed();
+         if (verbose)
+            printf("Loop time now %u ps\n", measured);
+      }
+   }
+   pthread_mutex_unlock(&poll_lock);
+}
+
+bool write_sysfs(const char *path, const char *val)
+{
+   int fd = open(path, O_WRONLY);
+   if (fd < 0)
+      return false;
+   bool ok = write(fd, val, strlen(val)) == (ssize_t)strlen(val);
+   close(fd);
+   return ok;
+}
+
+/* Held open, so that -g still works once a set-user-ID server drops root */
+static int governor_fd = -1;
+
+void governor_open(void)
+{
+   if (want_performance && governor_fd < 0)
+      governor_fd = open(CPUFREQ_DIR "scaling_governor", O_RDWR | O_CLOEXEC);
+}
+
+static bool governor_write(const char *val)
+{
+   return pwrite(governor_fd, val, strlen(val), 0) == (ssize_t)strlen(val);
+}
+
+static void governor_set(bool enable)
+{
+   governor_open();
+   if (enable && !saved_governor[0]) {
+      if (governor_fd < 0) {
+         if (errno != ENOENT)
+            perror("Failed to select performance governor");
+         return;
+      }
+      ssize_t n = pread(governor_fd, saved_governor, sizeof(saved_governor) - 1, 0);
+      if (n <= 0) {
+         saved_governor[0] = 0;
+         return;
+      }
+      saved_governor[strcspn(saved_governor, "\n")] = 0;
+      if (!governor_write("performance")) {
+         perror("Failed to select performance governor");
+         saved_governor[0] = 0;
+      } else if (verbose) {
+         printf("Governor '%s' -> 'performance'\n", saved_governor);
+      }
+   } else if (!enable && saved_governor[0]) {
+      if (!governor_write(saved_governor))
+         perror("Failed to restore governor");
+      else if (verbose)
+         printf("Governor restored to '%s'\n", saved_governor);
+      saved_governor[0] = 0;
+   }
+}
+
+void governor_performance(bool enable)
+{
+   if (!want_performance)
+      return;
+   pthread_mutex_lock(&governor_lock);
+   governor_set(enable);
+   pthread_mutex_unlock(&governor_lock);
+}
+
+/*
+ * This work, "jtag_timing.c", is part of "xvcpi.c"
+ * Updated for modern Raspberry Pi systems using libgpiod
+ *
+ * Original "xvcpi.c" is licensed under CC0 1.0 Universal
+ * by Derek Mulcahy.
+ */
@@ -0,0 +1,113 @@
+/*
+ * Description :  OpenOCD remote_bitbang front end of the xvcpi JTAG engine
+ *
+ * See Licensing information at End of File.
+ */
+
+#include <string.h>
+#include "rbb.h"
+
+void rbb_init(struct rbb *r, struct jtag_gpio *g, rbb_shift_fn shift, void *arg)
+{
+   memset(r, 0, sizeof(*r));
+   r->g = g;
+   r->shift = shift;
+   r->arg = arg;
+   r->tms = 1;                 /* as gpio_open() leaves the pins */
+}
+
+static inline int bit_at(const uint8_t *buf, int i)
+{
+   return (buf[i / 8] >> (i % 8)) & 1;
+}
+
+static inline void bit_set(uint8_t *buf, int i, int v)
+{
+   uint8_t m = 1 << (i % 8);
+
+   buf[i / 8] = v ? buf[i / 8] | m : buf[i / 8] & ~m;
+}
+
+/*
+ * Shift the bits clocked so far and answer the reads waiting for them.
+ * TDO is sampled if a read wants it, or if the client holds TCK high
+ * and may still ask for the last bit's.
+ */
+static int rbb_shift(struct rbb *r, char *out)
+{
+   bool capture = (r->nreads && r->read_at[0] < r->bits) || r->tck;
+   int next = -1;
+
+   if (r->bits) {
+      r->shift(r->arg, r->bits, r->tms_buf, r->tdi_buf, capture ? r->tdo_buf : NULL);
+      if (capture)
+         r->last_tdo = bit_at(r->tdo_buf, r->bits - 1);
+   }
+   for (int i = 0; i < r->nreads; i++) {
+      int v;
+      if (r->read_at[i] < r->bits)
+         v = bit_at(r->tdo_buf, r->read_at[i]);
+      else
+         v = next < 0 ? (next = gpio_read(r->g)) : next;
+      out[i] = '0' + v;
+   }
+
+   int n = r->nreads;
+   r->nreads = 0;
+   r->bits = 0;
+   return n;
+}
+
+int rbb_feed(struct rbb *r, const char *in, size_t n, char *out)
+{
+   int nout = 0;
+
+   for (size_t i = 0; i < n && !r->quit; i++) {
+      int c = in[i];
+
+      if (c >= '0' && c <= '7') {
+         int tck = (c >> 2) & 1;
+         r->tms = (c >> 1) & 1;
+         r->tdi = c & 1;
+         if (tck && !r->tck) {
+            if (r->bits == RBB_MAX_BITS)
+               nout += rbb_shift(r, out + nout);
+            bit_set(r->tms_buf, r->bits, r->tms);
+            bit_set(r->tdi_buf, r->bits, r->tdi);
+            r->bits++;
+         }
+         r->tck = tck;
+         continue;
+      }
+      switch (c) {
+      case 'R':
+         if (r->tck && !r->bits) {
+            out[nout++] = '0' + r->last_tdo;
+         } else {
+            if (r->nreads == RBB_MAX_BITS)
+               nout += rbb_shift(r, out + nout);
+            r->read_at[r->nreads++] = r->tck ? r->bits - 1 : r->bits;
+         }
+         break;
+      case 'Q':
+         r->quit = true;
+         break;
+      case 'B': case 'b':
+      case 'r': case 's': case 't': case 'u':
+      case '\n': case '\r':
+         break;
+      default:
+         rbb_shift(r, out + nout);
+         return -1;
+      }
+   }
+   return nout + rbb_shift(r, out + nout);
+}
+
+/*
+ * This work, "rbb.c", is part of "xvcpi.c"
+ * Updated for modern Raspberry Pi systems using libgpiod
+ *
+ * Original "xvcpi.c" is licensed under CC0 1.0 Universal
+ * by Derek Mulcahy.
+ */
@@ -0,0 +1,67 @@
+/*
+ * Description :  OpenOCD remote_bitbang front end of the xvcpi JTAG engine
+ *
+ * See Licensing information at End of File.
+ */
+
+#ifndef XVCPI_RBB_H
+#define XVCPI_RBB_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "jtag.h"
+
+/*
+ * remote_bitbang sends one character per pin write:
+ *
+ *    '0'..'7'        TCK in bit 2, TMS in bit 1, TDI in bit 0
+ *    'R'             read TDO, answered with '0' or '1'
+ *    'B', 'b'        LED on/off, ignored
+ *    'r'..'u'        TRST/SRST, ignored (no such pins)
+ *    'Q'             quit
+ *
+ * Rising TCK edges are collected as bits of a vector and shifted by the
+ * engine in one call, when the client's data runs out or at a read it
+ * cannot answer without one.  A read with TCK low wants the TDO the next
+ * rising edge would sample, which is what the pin shows after a shift
+ * (jtag_shift() leaves TCK low); with TCK high it wants the TDO of the
+ * last bit, which the shift samples.
+ */
+#define RBB_MAX_BITS    (32 * 1024)    /* per engine call */
+
+typedef void (*rbb_shift_fn)(void *arg, int bits, const uint8_t *tms,
+                             const uint8_t *tdi, uint8_t *tdo);
+
+struct rbb {
+   struct jtag_gpio *g;
+   rbb_shift_fn shift;         /* shifts a vector; tdo NULL if not wanted */
+   void *arg;
+   int tck, tms, tdi;          /* levels the client last wrote */
+   int last_tdo;               /* TDO of the last bit shifted */
+   bool quit;
+   int bits;                   /* clocked, not yet shifted */
+   uint8_t tms_buf[RBB_MAX_BITS / 8];
+   uint8_t tdi_buf[RBB_MAX_BITS / 8];
+   uint8_t tdo_buf[RBB_MAX_BITS / 8];
+   int nreads;                 /* 'R's waiting for the shift */
+   int read_at[RBB_MAX_BITS];  /* the bit whose TDO answers each, or bits */
+};
+
+void rbb_init(struct rbb *r, struct jtag_gpio *g, rbb_shift_fn shift, void *arg);
+/*
+ * Decode n characters and shift them.  The answers to their reads go to
+ * out, which holds n; returns their number, or -1 on a command other
+ * than the above (e.g. SWD).  r->quit is set on 'Q'.
+ */
+int rbb_feed(struct rbb *r, const char *in, size_t n, char *out);
+
+#endif
+
+/*
+ * This work, "rbb.h", is part of "xvcpi.c"
+ * Updated for modern Raspberry Pi systems using libgpiod
+ *
+ * Original "xvcpi.c" is licensed under CC0 1.0 Universal
+ * by Derek Mulcahy.
+ */
@@ -0,0 +1,67 @@
+/*
+ * Description :  Run-length coding of XVC vectors
+ *
+ * See Licensing information at End of File.
+ */
+
+#include <string.h>
+#include "rle.h"
+
+size_t rle_pack(const uint8_t *in, size_t n, uint8_t *out)
+{
+   size_t i = 0, o = 0;
+
+   while (i < n) {
+      size_t run = 1;
+      while (i + run < n && run < 128 && in[i + run] == in[i])
+         run++;
+      if (run >= 2) {
+         out[o++] = 257 - run;
+         out[o++] = in[i];
+         i += run;
+         continue;
+      }
+      /* Literals up to the next run of two or more */
+      size_t lit = 1;
+      while (i + lit < n && lit < 128 &&
+             !(i + lit + 1 < n && in[i + lit] == in[i + lit + 1]))
+         lit++;
+      out[o++] = lit - 1;
+      memcpy(out + o, in + i, lit);
+      o += lit;
+      i += lit;
+   }
+   return o;
+}
+
+ssize_t rle_unpack(const uint8_t *in, size_t n, uint8_t *out, size_t size)
+{
+   size_t i = 0, o = 0;
+
+   while (i < n) {
+      unsigned int c = in[i++];
+      if (c < 128) {
+         size_t lit = c + 1;
+         if (lit > n - i || lit > size - o)
+            return -1;
+         memcpy(out + o, in + i, lit);
+         i += lit;
+         o += lit;
+      } else if (c > 128) {
+         size_t run = 257 - c;
+         if (i >= n || run > size - o)
+            return -1;
+         memset(out + o, in[i++], run);
+         o += run;
+      }
+   }
+   return o;
+}
+
+/*
+ * This work, "rle.c", is part of "xvcpi.c"
+ * Updated for modern Raspberry Pi systems using libgpiod
+ *
+ * Original "xvcpi.c" is licensed under CC0 1.0 Universal
+ * by Derek Mulcahy.
+ */
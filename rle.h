@@ -0,0 +1,43 @@
+/*
+ * Description :  Run-length coding of XVC vectors
+ *
+ * See Licensing information at End of File.
+ */
+
+#ifndef XVCPI_RLE_H
+#define XVCPI_RLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * PackBits: a control byte n followed by
+ *
+ *    n = 0..127      n + 1 literal bytes
+ *    n = 129..255    one byte, repeated 257 - n times (2..128)
+ *    n = 128         nothing (never written)
+ *
+ * TMS vectors are almost all zero and bitstreams are full of 0x00/0xff
+ * runs, which pack 64:1; random data grows by at most 1 byte in 128.
+ */
+#define RLE_MAX_PACKED(n)  ((n) + ((n) + 127) / 128)
+
+/* Pack n bytes into out, which holds RLE_MAX_PACKED(n); returns the size */
+size_t rle_pack(const uint8_t *in, size_t n, uint8_t *out);
+
+/*
+ * Unpack into out, at most size bytes.  Returns the bytes unpacked, or
+ * -1 if the input is malformed or would overflow out.
+ */
+ssize_t rle_unpack(const uint8_t *in, size_t n, uint8_t *out, size_t size);
+
+#endif
+
+/*
+ * This work, "rle.h", is part of "xvcpi.c"
+ * Updated for modern Raspberry Pi systems using libgpiod
+ *
+ * Original "xvcpi.c" is licensed under CC0 1.0 Universal
+ * by Derek Mulcahy.
+ */
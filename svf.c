@@ -0,0 +1,849 @@
+/*
+ * Description :  SVF player for the xvcpi JTAG engine
+ *
+ *                Plays Serial Vector Format files directly on the shift
+ *                engine.  A parser thread walks the memory-mapped file
+ *                and turns it into TMS/TDI vectors with expected TDO and
+ *                mask; the calling thread shifts them and compares TDO
+ *                while the parser works on the next ones.
+ *
+ * See Licensing information at End of File.
+ */
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "svf.h"
+#include "vec.h"
+
+/*
+ * Scans and RUNTEST clocks are packed into vectors of up to
+ * SVF_CHUNK_BITS, so small scans share one engine call and a bitstream
+ * SDR of any length streams through in pieces.  Each vector remembers
+ * where the SVF commands it carries start, for mismatch reports.
+ */
+#define SVF_CHUNK_BITS  VEC_MAX_BITS
+#define SVF_QUEUE_LEN   (8)
+#define SVF_MARKS       (64)
+#define SVF_MAX_TOKENS  (32)
+
+enum svf_op_kind { SVF_SHIFT, SVF_FREQUENCY };
+
+struct svf_op {
+   enum svf_op_kind kind;
+   int bits;
+   bool compare;               /* some mask bit is set */
+   bool mark;                  /* RUNTEST min_time is counted from here */
+   uint64_t min_ns;            /* RUNTEST min_time, waited for after this */
+   double hz;                  /* FREQUENCY, 0 for full speed */
+   int nmarks;
+   struct vec_mark marks[SVF_MARKS];
+   uint8_t *tms, *tdi, *exp, *mask;
+};
+
+/* Hex digits of a TDI/TDO/MASK value, MSB first as written */
+struct svf_field {
+   const char *lo, *hi;
+};
+
+/* SIR, SDR and their headers and trailers, with SVF's sticky values */
+struct svf_scan {
+   long len;
+   struct svf_field tdi, tdo, mask;
+};
+
+struct svf_token {
+   const char *s;
+   int len;
+   bool paren;                 /* (hex) value, s/len without the parens */
+};
+
+struct svf_player {
+   struct jtag_gpio *g;
+   const char *path;
+
+   /* Parser */
+   const char *pos, *end;
+   int line, cmd_line;
+   int state, enddr, endir, run_state, run_end;
+   struct svf_scan sir, sdr, hir, hdr, tir, tdr;
+   struct svf_op *op;
+   bool trst_warned;
+
+   /* Queue from the parser to the engine */
+   pthread_mutex_t lock;
+   pthread_cond_t cond;
+   struct svf_op *queue[SVF_QUEUE_LEN];
+   int head, count;
+   bool done;                  /* parser finished */
+   bool failed;                /* parser error */
+   bool stop;                  /* engine gave up */
+
+   uint64_t scans, bits;
+};
+
+static void svf_error(struct svf_player *p, const char *msg)
+{
+   fprintf(stderr, "%s:%d: %s\n", p->path, p->cmd_line, msg);
+}
+
+static struct svf_op *op_new(void)
+{
+   const size_t bytes = SVF_CHUNK_BITS / 8;
+   struct svf_op *op = calloc(1, sizeof(*op) + 4 * bytes);
+
+   if (!op)
+      return NULL;
+   op->tms = (uint8_t *)(op + 1);
+   op->tdi = op->tms + bytes;
+   op->exp = op->tdi + bytes;
+   op->mask = op->exp + bytes;
+   return op;
+}
+
+/* Hand a vector to the engine; false once the engine has stopped */
+static bool queue_push(struct svf_player *p, struct svf_op *op)
+{
+   pthread_mutex_lock(&p->lock);
+   while (p->count == SVF_QUEUE_LEN && !p->stop)
+      pthread_cond_wait(&p->cond, &p->lock);
+   if (p->stop) {
+      pthread_mutex_unlock(&p->lock);
+      free(op);
+      return false;
+   }
+   p->queue[(p->head + p->count++) % SVF_QUEUE_LEN] = op;
+   pthread_cond_broadcast(&p->cond);
+   pthread_mutex_unlock(&p->lock);
+   return true;
+}
+
+static struct svf_op *queue_pop(struct svf_player *p)
+{
+   struct svf_op *op = NULL;
+
+   pthread_mutex_lock(&p->lock);
+   while (!p->count && !p->done)
+      pthread_cond_wait(&p->cond, &p->lock);
+   if (p->count) {
+      op = p->queue[p->head];
+      p->head = (p->head + 1) % SVF_QUEUE_LEN;
+      p->count--;
+      pthread_cond_broadcast(&p->cond);
+   }
+   pthread_mutex_unlock(&p->lock);
+   return op;
+}
+
+/* Queue the vector being built, if it has anything in it */
+static bool op_flush(struct svf_player *p)
+{
+   struct svf_op *op = p->op;
+
+   if (!op->bits && !op->min_ns)
+      return true;
+   if (!(p->op = op_new()) || !queue_push(p, op))
+      return false;
+   return true;
+}
+
+/* Make room for at least one bit; a command continuing into a new vector is marked again */
+static inline bool op_room(struct svf_player *p, uint64_t scan_bit, bool mark)
+{
+   if (p->op->bits < SVF_CHUNK_BITS)
+      return true;
+   if (!op_flush(p))
+      return false;
+   if (mark) {
+      struct vec_mark *m = &p->op->marks[p->op->nmarks++];
+      m->bit = 0;
+      m->line = p->cmd_line;
+      m->scan_bit = scan_bit;
+   }
+   return true;
+}
+
+static bool op_mark(struct svf_player *p)
+{
+   if (p->op->nmarks == SVF_MARKS && !op_flush(p))
+      return false;
+   struct vec_mark *m = &p->op->marks[p->op->nmarks++];
+   m->bit = p->op->bits;
+   m->line = p->cmd_line;
+   m->scan_bit = 0;
+   return true;
+}
+
+/* n clocks with constant TMS and TDI=0, e.g. RUNTEST */
+static bool op_clocks(struct svf_player *p, uint64_t n, int tms)
+{
+   while (n) {
+      if (!op_room(p, 0, false))
+         return false;
+      struct svf_op *op = p->op;
+      uint64_t k = SVF_CHUNK_BITS - op->bits;
+      if (k > n)
+         k = n;
+      if (tms)
+         for (uint64_t i = 0; i < k; i++)
+            op->tms[(op->bits + i) >> 3] |= 1 << ((op->bits + i) & 7);
+      op->bits += k;
+      n -= k;
+   }
+   return true;
+}
+
+/* Move the TAP to a state */
+static bool op_goto(struct svf_player *p, int state)
+{
+   uint32_t tms;
+   int n = tap_path(p->state, state, &tms);
+
+   for (int i = 0; i < n; i++) {
+      if (!op_room(p, 0, false))
+         return false;
+      if ((tms >> i) & 1)
+         p->op->tms[p->op->bits >> 3] |= 1 << (p->op->bits & 7);
+      p->op->bits++;
+   }
+   p->state = state;
+   return true;
+}
+
+/*
+ * Bits of a hex value, LSB first: the digits are read from the end of
+ * the text backwards.  Past the written digits the value is padded with
+ * zeros, or ones for a default MASK.
+ */
+struct bitsrc {
+   const char *lo, *p;
+   unsigned int cur;
+   int left;
+   unsigned int pad;
+};
+
+static void bitsrc_init(struct bitsrc *b, const struct svf_field *f, bool ones)
+{
+   b->lo = f->lo;
+   b->p = f->hi;
+   b->cur = 0;
+   b->left = 0;
+   b->pad = ones ? 0xf : 0;
+}
+
+static inline unsigned int bitsrc_nibble(struct bitsrc *b)
+{
+   while (b->p > b->lo) {
+      int c = *--b->p;
+      if (c >= '0' && c <= '9')
+         return c - '0';
+      c |= 0x20;
+      if (c >= 'a' && c <= 'f')
+         return c - 'a' + 10;
+   }
+   return b->pad;
+}
+
+static inline int bitsrc_bit(struct bitsrc *b)
+{
+   if (!b->left) {
+      b->cur = bitsrc_nibble(b);
+      b->left = 4;
+   }
+   int v = b->cur & 1;
+   b->cur >>= 1;
+   b->left--;
+   return v;
+}
+
+/* Append one scan segment (header, data or trailer) */
+static bool op_segment(struct svf_player *p, const struct svf_scan *sc, uint64_t *scan_bit)
+{
+   const bool cmp = sc->tdo.hi != NULL;
+   struct bitsrc tdi, tdo, mask;
+   long j = 0;
+
+   bitsrc_init(&tdi, &sc->tdi, false);
+   bitsrc_init(&tdo, &sc->tdo, false);
+   bitsrc_init(&mask, &sc->mask, !sc->mask.hi);
+
+   while (j < sc->len) {
+      if (!op_room(p, *scan_bit + j, true))
+         return false;
+      struct svf_op *op = p->op;
+      int i = op->bits, sh = i & 7;
+
+      /* Whole digits when both sides are nibble aligned */
+      if (!(i & 3) && !tdi.left && !tdo.left && !mask.left && sc->len - j >= 4) {
+         op->tdi[i >> 3] |= bitsrc_nibble(&tdi) << sh;
+         if (cmp) {
+            unsigned int m = bitsrc_nibble(&mask);
+            op->mask[i >> 3] |= m << sh;
+            op->exp[i >> 3] |= (bitsrc_nibble(&tdo) & m) << sh;
+            op->compare |= m != 0;
+         }
+         op->bits += 4;
+         j += 4;
+         continue;
+      }
+
+      if (bitsrc_bit(&tdi))
+         op->tdi[i >> 3] |= 1 << sh;
+      if (cmp) {
+         int m = bitsrc_bit(&mask), e = bitsrc_bit(&tdo);
+         if (m) {
+            op->mask[i >> 3] |= 1 << sh;
+            op->exp[i >> 3] |= e << sh;
+            op->compare = true;
+         }
+      }
+      op->bits++;
+      j++;
+   }
+   *scan_bit += sc->len;
+   return true;
+}
+
+/* SIR/SDR: header, data and trailer in one pass through Shift-xR */
+static bool op_scan(struct svf_player *p, bool ir)
+{
+   const struct svf_scan *h = ir ? &p->hir : &p->hdr;
+   const struct svf_scan *d = ir ? &p->sir : &p->sdr;
+   const struct svf_scan *t = ir ? &p->tir : &p->tdr;
+   uint64_t scan_bit = 0;
+
+   if (!op_goto(p, ir ? TAP_IRSHIFT : TAP_DRSHIFT))
+      return false;
+   if (h->len + d->len + t->len > 0) {
+      if (!op_mark(p) || !op_segment(p, h, &scan_bit) ||
+          !op_segment(p, d, &scan_bit) || !op_segment(p, t, &scan_bit))
+         return false;
+      /* The last bit leaves Shift-xR */
+      int last = p->op->bits - 1;
+      p->op->tms[last >> 3] |= 1 << (last & 7);
+      p->state = ir ? TAP_IREXIT1 : TAP_DREXIT1;
+      p->scans++;
+      p->bits += scan_bit;
+   }
+   return op_goto(p, ir ? p->endir : p->enddr);
+}
+
+/* Tokens of the next statement; 0 at the end of the file, -1 on error */
+static int next_statement(struct svf_player *p, struct svf_token *tok)
+{
+   int n = 0;
+
+   for (;;) {
+      while (p->pos < p->end && isspace((unsigned char)*p->pos)) {
+         if (*p->pos == '\n')
+            p->line++;
+         p->pos++;
+      }
+      if (p->pos == p->end) {
+         if (n) {
+            svf_error(p, "missing ';' at end of file");
+            return -1;
+         }
+         return 0;
+      }
+      char c = *p->pos;
+      if (c == '!' || (c == '/' && p->pos + 1 < p->end && p->pos[1] == '/')) {
+         while (p->pos < p->end && *p->pos != '\n')
+            p->pos++;
+         continue;
+      }
+      if (!n)
+         p->cmd_line = p->line;
+      if (c == ';') {
+         p->pos++;
+         if (n)
+            return n;
+         continue;
+      }
+      if (n == SVF_MAX_TOKENS) {
+         svf_error(p, "statement too long");
+         return -1;
+      }
+      if (c == '(') {
+         const char *s = ++p->pos;
+         while (p->pos < p->end && *p->pos != ')') {
+            if (*p->pos == '\n')
+               p->line++;
+            else if (!isxdigit((unsigned char)*p->pos) && !isspace((unsigned char)*p->pos)) {
+               svf_error(p, "invalid hex value");
+               return -1;
+            }
+            p->pos++;
+         }
+         if (p->pos == p->end) {
+            svf_error(p, "missing ')'");
+            return -1;
+         }
+         tok[n++] = (struct svf_token){ s, p->pos - s, true };
+         p->pos++;
+         continue;
+      }
+      const char *s = p->pos;
+      while (p->pos < p->end && !isspace((unsigned char)*p->pos) &&
+             *p->pos != ';' && *p->pos != '(')
+         p->pos++;
+      tok[n++] = (struct svf_token){ s, p->pos - s, false };
+   }
+}
+
+static bool tok_is(const struct svf_token *t, const char *word)
+{
+   return !t->paren && (int)strlen(word) == t->len && strncasecmp(t->s, word, t->len) == 0;
+}
+
+static bool tok_number(const struct svf_token *t, double *v)
+{
+   char buf[40], *end;
+
+   if (t->paren || t->len >= (int)sizeof(buf))
+      return false;
+   memcpy(buf, t->s, t->len);
+   buf[t->len] = 0;
+   *v = strtod(buf, &end);
+   return end != buf && !*end && *v >= 0;
+}
+
+static int tok_state(const struct svf_token *t)
+{
+   return t->paren ? -1 : tap_state_find(t->s, t->len);
+}
+
+/* SIR/SDR/HIR/HDR/TIR/TDR length [TDI (..)] [TDO (..)] [MASK (..)] [SMASK (..)] */
+static bool parse_scan(struct svf_player *p, const struct svf_token *tok, int n,
+                       struct svf_scan *sc)
+{
+   double len;
+
+   if (n < 2 || !tok_number(&tok[1], &len) || len > 0x7fffffff) {
+      svf_error(p, "invalid scan length");
+      return false;
+   }
+   /* TDI and MASK carry over while the length stays the same */
+   if ((long)len != sc->len) {
+      sc->len = len;
+      sc->tdi.lo = sc->tdi.hi = NULL;
+      sc->mask.lo = sc->mask.hi = NULL;
+   }
+   sc->tdo.lo = sc->tdo.hi = NULL;
+
+   for (int i = 2; i < n; i += 2) {
+      struct svf_field *f = NULL;
+
+      if (i + 1 == n || !tok[i + 1].paren) {
+         svf_error(p, "expected a (hex) value");
+         return false;
+      }
+      if (tok_is(&tok[i], "TDI"))
+         f = &sc->tdi;
+      else if (tok_is(&tok[i], "TDO"))
+         f = &sc->tdo;
+      else if (tok_is(&tok[i], "MASK"))
+         f = &sc->mask;
+      else if (!tok_is(&tok[i], "SMASK")) {
+         svf_error(p, "unknown scan parameter");
+         return false;
+      }
+      if (f) {
+         f->lo = tok[i + 1].s;
+         f->hi = tok[i + 1].s + tok[i + 1].len;
+      }
+   }
+   return true;
+}
+
+/* RUNTEST [run_state] [count TCK|SCK] [min SEC] [MAXIMUM max SEC] [ENDSTATE state] */
+static bool parse_runtest(struct svf_player *p, const struct svf_token *tok, int n)
+{
+   double count = 0, min_sec = 0, v;
+   int i = 1, s;
+
+   if (i < n && (s = tok_state(&tok[i])) >= 0) {
+      if (!tap_stable(s))
+         goto bad;
+      p->run_state = s;
+      p->run_end = s;
+      i++;
+   }
+   while (i < n) {
+      if (tok_is(&tok[i], "MAXIMUM") && i + 2 < n && tok_is(&tok[i + 2], "SEC")) {
+         i += 3;
+      } else if (tok_is(&tok[i], "ENDSTATE") && i + 1 < n &&
+                 (s = tok_state(&tok[i + 1])) >= 0 && tap_stable(s)) {
+         p->run_end = s;
+         i += 2;
+      } else if (i + 1 < n && tok_number(&tok[i], &v)) {
+         if (tok_is(&tok[i + 1], "TCK") || tok_is(&tok[i + 1], "SCK"))
+            count = v;
+         else if (tok_is(&tok[i + 1], "SEC"))
+            min_sec = v;
+         else
+            goto bad;
+         i += 2;
+      } else {
+         goto bad;
+      }
+   }
+
+   /* A minimum time is measured from the first clock: start a fresh vector */
+   if (min_sec > 0) {
+      if (!op_flush(p))
+         return false;
+      p->op->mark = true;
+   }
+   if (!op_goto(p, p->run_state))
+      return false;
+   if (!op_clocks(p, (uint64_t)count, p->run_state == TAP_RESET))
+      return false;
+   if (min_sec > 0) {
+      p->op->min_ns = (uint64_t)(min_sec * 1e9);
+      if (!op_flush(p))
+         return false;
+   }
+   return op_goto(p, p->run_end);
+
+bad:
+   svf_error(p, "invalid RUNTEST");
+   return false;
+}
+
+static bool parse_statement(struct svf_player *p, const struct svf_token *tok, int n)
+{
+   const struct svf_token *cmd = &tok[0];
+   int s;
+
+   if (tok_is(cmd, "SIR"))
+      return parse_scan(p, tok, n, &p->sir) && op_scan(p, true);
+   if (tok_is(cmd, "SDR"))
+      return parse_scan(p, tok, n, &p->sdr) && op_scan(p, false);
+   if (tok_is(cmd, "HIR"))
+      return parse_scan(p, tok, n, &p->hir);
+   if (tok_is(cmd, "HDR"))
+      return parse_scan(p, tok, n, &p->hdr);
+   if (tok_is(cmd, "TIR"))
+      return parse_scan(p, tok, n, &p->tir);
+   if (tok_is(cmd, "TDR"))
+      return parse_scan(p, tok, n, &p->tdr);
+   if (tok_is(cmd, "RUNTEST"))
+      return parse_runtest(p, tok, n);
+
+   if (tok_is(cmd, "ENDIR") || tok_is(cmd, "ENDDR")) {
+      if (n != 2 || (s = tok_state(&tok[1])) < 0 || !tap_stable(s)) {
+         svf_error(p, "invalid end state");
+         return false;
+      }
+      *(tok_is(cmd, "ENDIR") ? &p->endir : &p->enddr) = s;
+      return true;
+   }
+   if (tok_is(cmd, "STATE")) {
+      for (int i = 1; i < n; i++) {
+         if ((s = tok_state(&tok[i])) < 0 || (i == n - 1 && !tap_stable(s))) {
+            svf_error(p, "invalid STATE");
+            return false;
+         }
+         if (!op_goto(p, s))
+            return false;
+      }
+      return true;
+   }
+   if (tok_is(cmd, "FREQUENCY")) {
+      double hz = 0;
+      if ((n != 1 && n != 3) || (n == 3 && (!tok_number(&tok[1], &hz) || !tok_is(&tok[2], "HZ")))) {
+         svf_error(p, "invalid FREQUENCY");
+         return false;
+      }
+      if (!op_flush(p))
+         return false;
+      struct svf_op *op = p->op;
+      op->kind = SVF_FREQUENCY;
+      op->hz = hz;
+      return (p->op = op_new()) != NULL && queue_push(p, op);
+   }
+   if (tok_is(cmd, "TRST")) {
+      /* There is no TRST pin; only asserting it matters */
+      if (n == 2 && tok_is(&tok[1], "ON") && !p->trst_warned) {
+         fprintf(stderr, "%s:%d: no TRST pin, TRST ON ignored\n", p->path, p->cmd_line);
+         p->trst_warned = true;
+      }
+      return true;
+   }
+   if (tok_is(cmd, "PIOMAP") || tok_is(cmd, "PIO")) {
+      svf_error(p, "PIO is not supported");
+      return false;
+   }
+   svf_error(p, "unknown command");
+   return false;
+}
+
+static void *svf_parser(void *arg)
+{
+   struct svf_player *p = arg;
+   struct svf_token tok[SVF_MAX_TOKENS];
+   bool ok = (p->op = op_new()) != NULL;
+   int n;
+
+   /* The TAP state is unknown until the first reset */
+   p->state = TAP_RESET;
+   ok = ok && op_clocks(p, 5, 1);
+
+   while (ok && (n = next_statement(p, tok)) > 0)
+      ok = parse_statement(p, tok, n);
+   if (ok && n < 0)
+      ok = false;
+   if (ok)
+      ok = op_flush(p);
+   free(p->op);
+
+   pthread_mutex_lock(&p->lock);
+   p->failed = !ok && !p->stop;
+   p->done = true;
+   pthread_cond_broadcast(&p->cond);
+   pthread_mutex_unlock(&p->lock);
+   return NULL;
+}
+
+/*
+ * Run the parsed vectors: shift them on g and check TDO, write them to
+ * w, or both.  The text is the mapped SVF file.
+ */
+static int svf_run(struct jtag_gpio *g, const char *path, const char *text,
+                   size_t size, const volatile sig_atomic_t *running,
+                   struct vec_writer *w)
+{
+   struct svf_player *p;
+   pthread_t parser;
+   uint8_t *tdo;
+   int result = 0;
+
+   p = calloc(1, sizeof(*p));
+   tdo = malloc(SVF_CHUNK_BITS / 8);
+   if (!p || !tdo) {
+      free(p);
+      free(tdo);
+      return -1;
+   }
+   p->g = g;
+   p->path = path;
+   p->pos = text;
+   p->end = text + size;
+   p->line = 1;
+   p->enddr = p->endir = p->run_state = p->run_end = TAP_IDLE;
+   pthread_mutex_init(&p->lock, NULL);
+   pthread_cond_init(&p->cond, NULL);
+
+   if (pthread_create(&parser, NULL, svf_parser, p)) {
+      perror("pthread_create");
+      result = -1;
+      goto out;
+   }
+
+   /* FREQUENCY may slow TCK down from the configured delay, never speed it up */
+   const uint64_t base_ps = g ? g->delay.ps : 0;
+   uint64_t mark_ns = 0, t0 = now_ns(), shifted = 0, vectors = 0;
+   struct svf_op *op;
+
+   while ((op = queue_pop(p))) {
+      vectors++;
+      if (running && !*running) {
+         fprintf(stderr, "%s: cancelled\n", path);
+         result = -1;
+         free(op);
+         break;
+      }
+      if (op->kind == SVF_FREQUENCY) {
+         if (w && !vec_write_frequency(w, op->hz))
+            result = -1;
+         if (g) {
+            uint64_t ps = op->hz > 0 ? (uint64_t)(1e12 / op->hz / 2) : 0;
+            delay_set_ps(&g->delay, ps > base_ps ? ps : base_ps);
+         }
+         free(op);
+         if (result)
+            break;
+         continue;
+      }
+      if (w && !vec_write_shift(w, op->bits, (op->compare ? VEC_COMPARE : 0) |
+                                (op->mark ? VEC_MARK : 0), op->min_ns, op->marks,
+                                op->nmarks, op->tms, op->tdi, op->exp, op->mask)) {
+         fprintf(stderr, "%s: cannot write compiled vectors\n", path);
+         result = -1;
+         free(op);
+         break;
+      }
+      shifted += op->bits;
+      if (!g) {
+         free(op);
+         continue;
+      }
+      timing_poll();
+      if (op->mark)
+         mark_ns = now_ns();
+      if (op->bits)
+         jtag_shift(g, op->bits, op->tms, op->tdi, tdo);
+      if (op->compare) {
+         int bit = vec_first_mismatch(op->bits, tdo, op->exp, op->mask);
+         if (bit >= 0) {
+            vec_report_mismatch(path, false, op->marks, op->nmarks, bit, tdo, op->exp);
+            result = 1;
+            free(op);
+            break;
+         }
+      }
+      if (op->min_ns) {
+         uint64_t until = mark_ns + op->min_ns, now;
+         while ((now = now_ns()) < until) {
+            uint64_t left = until - now;
+            struct timespec ts = { left / 1000000000ULL, left % 1000000000ULL };
+            nanosleep(&ts, NULL);
+         }
+      }
+      free(op);
+   }
+
+   /* Stop the parser if we gave up early, then drain what it queued */
+   pthread_mutex_lock(&p->lock);
+   p->stop = true;
+   pthread_cond_broadcast(&p->cond);
+   pthread_mutex_unlock(&p->lock);
+   pthread_join(parser, NULL);
+   while (p->count) {
+      free(p->queue[p->head]);
+      p->head = (p->head + 1) % SVF_QUEUE_LEN;
+      p->count--;
+   }
+   if (g)
+      delay_set_ps(&g->delay, base_ps);
+   if (p->failed && !result)
+      result = -1;
+
+   double secs = (now_ns() - t0) / 1e9;
+   if (g)
+      printf("%s: %s, %llu scans, %llu scan bits, %llu TCKs in %.3f s (%.1f kHz)\n",
+             path, result == 0 ? "PASS" : result > 0 ? "FAIL" : "ERROR",
+             (unsigned long long)p->scans, (unsigned long long)p->bits,
+             (unsigned long long)shifted, secs, secs > 0 ? shifted / secs / 1000 : 0);
+   else if (verbose && !result)
+      printf("%s: %llu scans compiled to %llu vectors, %llu TCKs in %.3f s\n",
+             path, (unsigned long long)p->scans, (unsigned long long)vectors,
+             (unsigned long long)shifted, secs);
+
+out:
+   pthread_mutex_destroy(&p->lock);
+   pthread_cond_destroy(&p->cond);
+   free(p);
+   free(tdo);
+   return result;
+}
+
+static const char *map_file(const char *path, size_t *size)
+{
+   struct stat st;
+   int fd = open(path, O_RDONLY);
+
+   if (fd < 0 || fstat(fd, &st) < 0) {
+      perror(path);
+      if (fd >= 0)
+         close(fd);
+      return NULL;
+   }
+   *size = st.st_size;
+   /* An empty file is a valid, empty SVF file */
+   void *text = st.st_size ? mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : (void *)"";
+   close(fd);
+   if (text == MAP_FAILED) {
+      perror(path);
+      return NULL;
+   }
+   if (st.st_size)
+      madvise(text, st.st_size, MADV_SEQUENTIAL);
+   return text;
+}
+
+static void unmap_file(const char *text, size_t size)
+{
+   if (size)
+      munmap((void *)text, size);
+}
+
+int svf_play(struct jtag_gpio *g, const char *path,
+             const volatile sig_atomic_t *running)
+{
+   char cache[512];
+   size_t size;
+   int result;
+
+   if (vec_is_vector_file(path))
+      return vec_replay(g, path, NULL, running, NULL);
+
+   const char *text = map_file(path, &size);
+   if (!text)
+      return -1;
+   uint64_t hash = vec_hash(text, size);
+
+   /* Replay an earlier compilation, or compile while playing */
+   if (vec_cache_path(cache, sizeof(cache), hash) && access(cache, R_OK) == 0) {
+      if (vec_check(cache, hash)) {
+         unmap_file(text, size);
+         if (verbose)
+            printf("%s: using compiled vectors %s\n", path, cache);
+         return vec_replay(g, cache, path, running, NULL);
+      }
+      fprintf(stderr, "%s: compiled vectors %s unusable, compiling again\n", path, cache);
+      unlink(cache);
+   }
+   struct vec_writer *w = vec_cache_path(cache, sizeof(cache), hash) ?
+                          vec_writer_open(cache, hash, 0) : NULL;
+   result = svf_run(g, path, text, size, running, w);
+   /* Only a complete run leaves a complete compilation */
+   if (vec_writer_close(w, result == 0) && verbose)
+      printf("%s: compiled vectors saved as %s\n", path, cache);
+   unmap_file(text, size);
+   return result;
+}
+
+int svf_compile(const char *path, const char *out, bool crc)
+{
+   char cache[512];
+   size_t size;
+
+   const char *text = map_file(path, &size);
+   if (!text)
+      return -1;
+   uint64_t hash = vec_hash(text, size);
+   if (!out) {
+      if (!vec_cache_path(cache, sizeof(cache), hash)) {
+         fprintf(stderr, "%s: no cache directory for the compiled vectors\n", path);
+         unmap_file(text, size);
+         return -1;
+      }
+      out = cache;
+   }
+   struct vec_writer *w = vec_writer_open(out, hash, crc ? VEC_CRC_CHECKS : 0);
+   int result = w ? svf_run(NULL, path, text, size, NULL, w) : -1;
+   if (!vec_writer_close(w, result == 0) && !result)
+      result = -1;
+   if (!result)
+      printf("%s: compiled to %s\n", path, out);
+   unmap_file(text, size);
+   return result;
+}
+
+/*
+ * This work, "svf.c", is part of "xvcpi.c"
+ * Updated for modern Raspberry Pi systems using libgpiod
+ *
+ * Original "xvcpi.c" is licensed under CC0 1.0 Universal
+ * by Derek Mulcahy.
+ */
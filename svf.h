@@ -0,0 +1,39 @@
+/*
+ * Description :  SVF player for the xvcpi JTAG engine
+ *
+ * See Licensing information at End of File.
+ */
+
+#ifndef XVCPI_SVF_H
+#define XVCPI_SVF_H
+
+#include <signal.h>
+#include "jtag.h"
+
+/*
+ * Play an SVF file on a chain.  Returns 0 when it ran to the end with
+ * every TDO check passing, 1 on a TDO mismatch and -1 on any other
+ * error.  Playing stops between vectors once *running drops to zero.
+ *
+ * A complete run leaves the compiled vectors in the cache (vec.h),
+ * keyed by the file's content, and later plays of the same content
+ * replay those.  Vector files themselves are replayed directly.
+ */
+int svf_play(struct jtag_gpio *g, const char *path,
+             const volatile sig_atomic_t *running);
+
+/*
+ * Compile an SVF file to a vector file, or into the cache for out == NULL.
+ * With crc the TDO checks are kept as CRC-32s (VEC_CRC_CHECKS).
+ */
+int svf_compile(const char *path, const char *out, bool crc);
+
+#endif
+
+/*
+ * This work, "svf.h", is part of "xvcpi.c"
+ * Updated for modern Raspberry Pi systems using libgpiod
+ *
+ * Original "xvcpi.c" is licensed under CC0 1.0 Universal
+ * by Derek Mulcahy.
+ */
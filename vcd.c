@@ -0,0 +1,454 @@
+/*
+ * Description :  VCD waveform capture of the shifts of the xvcpi JTAG engine
+ *
+ * See Licensing information at End of File.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "jtag.h"
+#include "vcd.h"
+
+/*
+ * Shifts are queued as records in blocks: the vectors as shifted, with
+ * their time.  Longer shifts are split so that a record always fits.
+ */
+#define VCD_BLOCK_SIZE     (256 * 1024)
+#define VCD_RECORD_BITS    (16 * 1024)
+#define VCD_STREAM_BLOCKS  (16)        /* queued before the engine waits */
+#define VCD_OUT_SIZE       (64 * 1024)
+#define VCD_TIME_DIGITS    (24)
+
+struct vcd_record {
+   uint64_t start_ns;
+   uint64_t ns;
+   uint32_t bits;
+   uint32_t sampled;           /* TDO follows TMS and TDI */
+   uint8_t data[];
+};
+
+struct vcd_block {
+   struct vcd_block *next;
+   size_t used;
+   uint64_t bits;
+   uint8_t data[VCD_BLOCK_SIZE];
+};
+
+struct vcd_writer {
+   FILE *f;
+   char *path;
+   uint64_t ring_bits;         /* 0: stream everything */
+   uint64_t origin_ns;         /* time 0 of the dump */
+
+   /* Engine side */
+   struct vcd_block *cur;
+   struct vcd_block *held, **held_tail;    /* ring, oldest first */
+   uint64_t held_bits;
+   bool stopped;               /* ring triggered, or out of memory */
+   bool triggered;
+   uint64_t stalls;
+
+   /* Shared with the writer thread */
+   pthread_t thread;
+   pthread_mutex_t lock;
+   pthread_cond_t cond;
+   struct vcd_block *queue, **queue_tail;
+   struct vcd_block *spare;
+   int blocks;
+   uint64_t skip_bits;         /* at the start of the queue, beyond the ring */
+   bool done;
+
+   /* Writer thread */
+   uint64_t t;                 /* last time written */
+   char tline[VCD_TIME_DIGITS + 32];   /* "#t\n", right-aligned */
+   int tfirst;                 /* first digit */
+   char tck, tms, tdi, tdo;
+   char out[VCD_OUT_SIZE];
+   size_t out_len;
+   bool error;
+};
+
+static size_t pad8(size_t n)
+{
+   return (n + 7) & ~(size_t)7;
+}
+
+static void out_flush(struct vcd_writer *w)
+{
+   if (w->out_len && fwrite(w->out, 1, w->out_len, w->f) != w->out_len)
+      w->error = true;
+   w->out_len = 0;
+}
+
+/*
+ * "#t", kept strictly increasing so no edge is lost to rounding.  The
+ * line is kept in decimal as well and the step added to it there, which
+ * for the few digits of a half TCK period beats converting every time.
+ */
+static void out_time(struct vcd_writer *w, uint64_t t)
+{
+   uint64_t step = t > w->t ? t - w->t : 1;
+   int i = VCD_TIME_DIGITS - 1, carry = 0;
+
+   w->t += step;
+   while (step || carry) {
+      int d = (i < w->tfirst ? 0 : w->tline[i] - '0') + step % 10 + carry;
+      carry = d >= 10;
+      w->tline[i--] = '0' + d - (carry ? 10 : 0);
+      step /= 10;
+   }
+   if (i < w->tfirst - 1) {
+      w->tfirst = i + 1;
+      w->tline[i] = '#';
+   }
+   /* A fixed-size copy, the out buffer has the room */
+   memcpy(w->out + w->out_len, w->tline + w->tfirst - 1, 32);
+   w->out_len += VCD_TIME_DIGITS + 2 - w->tfirst;
+}
+
+/* A value, written only if it changed, without branching on it */
+static inline void out_value(struct vcd_writer *w, char *cur, char v, char id)
+{
+   char *p = w->out + w->out_len;
+
+   p[0] = v;
+   p[1] = id;
+   p[2] = '\n';
+   w->out_len += (v != *cur) * 3;
+   *cur = v;
+}
+
+/*
+ * Each bit: TCK falls with TMS, TDI and the TDO sampled for it, and
+ * rises half way through.  TCK rests low between shifts.  The half
+ * periods are stepped through without dividing for each edge.
+ */
+static void write_record(struct vcd_writer *w, const struct vcd_record *r)
+{
+   const size_t nb = (r->bits + 7) / 8;
+   const uint8_t *tms = r->data, *tdi = tms + nb, *tdo = tdi + nb;
+   const uint64_t halves = 2 * (uint64_t)r->bits;
+   const uint64_t half = r->ns / halves, rem = r->ns % halves;
+   uint64_t t = r->start_ns > w->origin_ns ? r->start_ns - w->origin_ns : 0;
+   uint64_t frac = 0;
+
+#define NEXT_HALF() \
+   do { t += half; frac += rem; if (frac >= halves) { frac -= halves; t++; } } while (0)
+
+   for (uint32_t i = 0; i < r->bits; i++) {
+      char m = '0' + ((tms[i / 8] >> (i % 8)) & 1);
+      char d = '0' + ((tdi[i / 8] >> (i % 8)) & 1);
+      char o = r->sampled ? '0' + ((tdo[i / 8] >> (i % 8)) & 1) : 'x';
+
+      /* Room for two times and five values */
+      if (w->out_len > VCD_OUT_SIZE - 128)
+         out_flush(w);
+      if (w->tck != '0' || m != w->tms || d != w->tdi || o != w->tdo) {
+         out_time(w, t);
+         out_value(w, &w->tck, '0', '!');
+         out_value(w, &w->tms, m, '"');
+         out_value(w, &w->tdi, d, '#');
+         out_value(w, &w->tdo, o, '$');
+      }
+      NEXT_HALF();
+      out_time(w, t);
+      out_value(w, &w->tck, '1', '!');
+      NEXT_HALF();
+   }
+#undef NEXT_HALF
+   out_time(w, t);
+   out_value(w, &w->tck, '0', '!');
+}
+
+static void write_block(struct vcd_writer *w, const struct vcd_block *b)
+{
+   for (size_t p = 0; p < b->used; ) {
+      const struct vcd_record *r = (const void *)(b->data + p);
+      p += sizeof(*r) + pad8((r->bits + 7) / 8 * (r->sampled ? 3 : 2));
+      if (w->skip_bits >= r->bits) {
+         w->skip_bits -= r->bits;
+         continue;
+      }
+      w->skip_bits = 0;
+      write_record(w, r);
+   }
+   out_flush(w);
+}
+
+static void *writer_thread(void *arg)
+{
+   struct vcd_writer *w = arg;
+
+   pthread_mutex_lock(&w->lock);
+   for (;;) {
+      while (!w->queue && !w->done)
+         pthread_cond_wait(&w->cond, &w->lock);
+      struct vcd_block *b = w->queue;
+      if (!b)
+         break;
+      w->queue = b->next;
+      if (!w->queue)
+         w->queue_tail = &w->queue;
+      pthread_mutex_unlock(&w->lock);
+
+      write_block(w, b);
+
+      pthread_mutex_lock(&w->lock);
+      b->next = w->spare;
+      w->spare = b;
+      pthread_cond_broadcast(&w->cond);
+   }
+   pthread_mutex_unlock(&w->lock);
+   return NULL;
+}
+
+static struct vcd_block *block_alloc(struct vcd_writer *w)
+{
+   struct vcd_block *b = malloc(sizeof(*b));
+
+   if (!b) {
+      perror("malloc");
+      return NULL;
+   }
+   w->blocks++;
+   return b;
+}
+
+static void block_free_list(struct vcd_block *b)
+{
+   while (b) {
+      struct vcd_block *next = b->next;
+      free(b);
+      b = next;
+   }
+}
+
+static void queue_append(struct vcd_writer *w, struct vcd_block *first,
+                         struct vcd_block **last_next)
+{
+   *w->queue_tail = first;
+   w->queue_tail = last_next;
+}
+
+/* Ring: the block filled joins the held ones */
+static void ring_hold(struct vcd_writer *w)
+{
+   w->cur->next = NULL;
+   *w->held_tail = w->cur;
+   w->held_tail = &w->cur->next;
+   w->held_bits += w->cur->bits;
+   w->cur = NULL;
+}
+
+/*
+ * Start a new block.  Streaming, the full one goes to the writer thread
+ * and the engine waits only when VCD_STREAM_BLOCKS are queued.  A ring
+ * reuses its oldest block once the others hold ring_bits without it.
+ */
+static void next_block(struct vcd_writer *w)
+{
+   struct vcd_block *b = NULL;
+
+   if (w->ring_bits) {
+      ring_hold(w);
+      struct vcd_block *old = w->held;
+      if (old->next && w->held_bits - old->bits >= w->ring_bits) {
+         w->held = old->next;
+         w->held_bits -= old->bits;
+         b = old;
+      } else {
+         b = block_alloc(w);
+      }
+   } else {
+      pthread_mutex_lock(&w->lock);
+      w->cur->next = NULL;
+      queue_append(w, w->cur, &w->cur->next);
+      pthread_cond_broadcast(&w->cond);
+      if (!w->spare && w->blocks >= VCD_STREAM_BLOCKS) {
+         w->stalls++;
+         while (!w->spare)
+            pthread_cond_wait(&w->cond, &w->lock);
+      }
+      if (w->spare) {
+         b = w->spare;
+         w->spare = b->next;
+      } else {
+         b = block_alloc(w);
+      }
+      pthread_mutex_unlock(&w->lock);
+   }
+
+   w->cur = b;
+   if (!b) {
+      fprintf(stderr, "%s: capture stopped\n", w->path);
+      w->stopped = true;
+      return;
+   }
+   b->used = 0;
+   b->bits = 0;
+}
+
+struct vcd_writer *vcd_open(const char *path, uint64_t ring_bits)
+{
+   struct vcd_writer *w = calloc(1, sizeof(*w));
+
+   if (!w)
+      return NULL;
+   w->path = strdup(path);
+   w->ring_bits = ring_bits;
+   w->held_tail = &w->held;
+   w->queue_tail = &w->queue;
+   w->cur = block_alloc(w);
+   if (!w->path || !w->cur)
+      goto fail;
+   w->cur->used = 0;
+   w->cur->bits = 0;
+   w->f = fopen(path, "w");
+   if (!w->f) {
+      perror(path);
+      goto fail;
+   }
+
+   time_t now = time(NULL);
+   char date[64];
+   strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", localtime(&now));
+   fprintf(w->f,
+           "$date %s $end\n"
+           "$version xvcpi $end\n"
+           "$timescale 1ns $end\n"
+           "$scope module jtag $end\n"
+           "$var wire 1 ! tck $end\n"
+           "$var wire 1 \" tms $end\n"
+           "$var wire 1 # tdi $end\n"
+           "$var wire 1 $ tdo $end\n"
+           "$upscope $end\n"
+           "$enddefinitions $end\n"
+           "#0\n"
+           "$dumpvars\n0!\n1\"\n0#\nx$\n$end\n", date);
+   w->tck = '0';
+   w->tms = '1';
+   w->tdi = '0';
+   w->tdo = 'x';
+   memset(w->tline, '0', sizeof(w->tline));
+   w->tline[VCD_TIME_DIGITS - 2] = '#';
+   w->tline[VCD_TIME_DIGITS] = '\n';
+   w->tfirst = VCD_TIME_DIGITS - 1;
+   w->origin_ns = now_ns();
+
+   pthread_mutex_init(&w->lock, NULL);
+   pthread_cond_init(&w->cond, NULL);
+   if (pthread_create(&w->thread, NULL, writer_thread, w) != 0) {
+      fprintf(stderr, "%s: cannot start the writer thread\n", path);
+      fclose(w->f);
+      unlink(path);
+      goto fail;
+   }
+   return w;
+
+fail:
+   free(w->cur);
+   free(w->path);
+   free(w);
+   return NULL;
+}
+
+void vcd_shift(struct vcd_writer *w, uint64_t start_ns, uint64_t ns, int bits,
+               const uint8_t *tms, const uint8_t *tdi, const uint8_t *tdo)
+{
+   for (int off = 0; off < bits && !w->stopped; off += VCD_RECORD_BITS) {
+      int n = bits - off < VCD_RECORD_BITS ? bits - off : VCD_RECORD_BITS;
+      size_t nb = (n + 7) / 8;
+      size_t size = sizeof(struct vcd_record) + pad8(nb * (tdo ? 3 : 2));
+
+      if (VCD_BLOCK_SIZE - w->cur->used < size) {
+         next_block(w);
+         if (w->stopped)
+            return;
+      }
+      struct vcd_record *r = (void *)(w->cur->data + w->cur->used);
+      uint64_t from = ns * off / bits;
+      r->start_ns = start_ns + from;
+      r->ns = ns * (off + n) / bits - from;
+      r->bits = n;
+      r->sampled = tdo != NULL;
+      memcpy(r->data, tms + off / 8, nb);
+      memcpy(r->data + nb, tdi + off / 8, nb);
+      if (tdo)
+         memcpy(r->data + 2 * nb, tdo + off / 8, nb);
+      w->cur->used += size;
+      w->cur->bits += n;
+   }
+}
+
+void vcd_flush(struct vcd_writer *w)
+{
+   if (!w->ring_bits && !w->stopped && w->cur->used)
+      next_block(w);
+}
+
+void vcd_trigger(struct vcd_writer *w, const char *why)
+{
+   if (!w->ring_bits || w->stopped)
+      return;
+   w->stopped = true;
+   w->triggered = true;
+   ring_hold(w);
+
+   uint64_t bits = w->held_bits < w->ring_bits ? w->held_bits : w->ring_bits;
+   pthread_mutex_lock(&w->lock);
+   w->skip_bits = w->held_bits - bits;
+   queue_append(w, w->held, w->held_tail);
+   w->held = NULL;
+   w->held_tail = &w->held;
+   pthread_cond_broadcast(&w->cond);
+   pthread_mutex_unlock(&w->lock);
+   printf("%s: last %llu bits before %s\n", w->path, (unsigned long long)bits, why);
+}
+
+bool vcd_close(struct vcd_writer *w)
+{
+   bool keep = !w->ring_bits || w->triggered;
+
+   vcd_flush(w);
+   pthread_mutex_lock(&w->lock);
+   w->done = true;
+   pthread_cond_broadcast(&w->cond);
+   pthread_mutex_unlock(&w->lock);
+   pthread_join(w->thread, NULL);
+
+   if (fclose(w->f) != 0 || w->error) {
+      perror(w->path);
+      keep = false;
+      w->error = true;
+   }
+   if (!keep) {
+      if (!w->error)
+         printf("%s: not triggered, nothing written\n", w->path);
+      unlink(w->path);
+   } else if (verbose && w->stalls) {
+      printf("%s: the engine waited for the writer %llu times\n", w->path,
+             (unsigned long long)w->stalls);
+   }
+
+   block_free_list(w->held);
+   block_free_list(w->spare);
+   free(w->cur);
+   pthread_mutex_destroy(&w->lock);
+   pthread_cond_destroy(&w->cond);
+   free(w->path);
+   bool ok = !w->error;
+   free(w);
+   return ok;
+}
+
+/*
+ * This work, "vcd.c", is part of "xvcpi.c"
+ * Updated for modern Raspberry Pi systems using libgpiod
+ *
+ * Original "xvcpi.c" is licensed under CC0 1.0 Universal
+ * by Derek Mulcahy.
+ */
@@ -0,0 +1,44 @@
+/*
+ * Description :  VCD waveform capture of the shifts of the xvcpi JTAG engine
+ *
+ * See Licensing information at End of File.
+ */
+
+#ifndef XVCPI_VCD_H
+#define XVCPI_VCD_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * A capture writes TCK, TMS, TDI and TDO of every bit the engine shifts
+ * to a Value Change Dump for GTKWave.  The engine thread only copies the
+ * vectors and their time into blocks; a writer thread formats them, so
+ * a shift costs a memcpy rather than the text.  Bits of a shift are
+ * spread evenly over the time it took, timed with now_ns().
+ *
+ * With ring_bits, only the last ring_bits are kept in memory and nothing
+ * is written until vcd_trigger(); capture then stops.
+ */
+struct vcd_writer;
+
+struct vcd_writer *vcd_open(const char *path, uint64_t ring_bits);
+/* A shift that started at start_ns and took ns; tdo NULL if not sampled */
+void vcd_shift(struct vcd_writer *w, uint64_t start_ns, uint64_t ns, int bits,
+               const uint8_t *tms, const uint8_t *tdi, const uint8_t *tdo);
+/* Hand what is buffered to the writer thread, e.g. when a client leaves */
+void vcd_flush(struct vcd_writer *w);
+/* Ring capture: write the bits before this point, for the reason given */
+void vcd_trigger(struct vcd_writer *w, const char *why);
+/* Finish the file; false on a write error.  An untriggered ring leaves none */
+bool vcd_close(struct vcd_writer *w);
+
+#endif
+
+/*
+ * This work, "vcd.h", is part of "xvcpi.c"
+ * Updated for modern Raspberry Pi systems using libgpiod
+ *
+ * Original "xvcpi.c" is licensed under CC0 1.0 Universal
+ * by Derek Mulcahy.
+ */
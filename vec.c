@@ -0,0 +1,603 @@
+/*
+ * Description :  Compiled JTAG vector files for the xvcpi JTAG engine
+ *
+ *                Writer, cache and replay for the vector format in
+ *                vec.h.  SVF files compile to it (svf.c) and XVC
+ *                sessions can be recorded into it (xvcpi -R); replay
+ *                maps the file and shifts TDI straight out of the
+ *                mapping, with only the run-length coded TMS expanded.
+ *
+ * See Licensing information at End of File.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#if defined(__aarch64__)
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+#include "vec.h"
+
+struct vec_writer {
+   FILE *f;
+   char *path, *tmp;
+   struct vec_header h;
+   uint8_t *runs;              /* TMS run buffer */
+   uint8_t *masked;            /* expected TDO under the mask, for VEC_CRC */
+   bool error;
+};
+
+static inline size_t pad8(size_t n)
+{
+   return (n + 7) & ~(size_t)7;
+}
+
+static uint32_t crc_table[256];
+#if defined(__aarch64__)
+static bool crc_hw;
+#endif
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+static void crc_init(void)
+{
+   for (uint32_t i = 0; i < 256; i++) {
+      uint32_t c = i;
+      for (int k = 0; k < 8; k++)
+         c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+      crc_table[i] = c;
+   }
+#if defined(__aarch64__) && defined(HWCAP_CRC32)
+   crc_hw = getauxval(AT_HWCAP) & HWCAP_CRC32;
+#endif
+}
+
+#if defined(__aarch64__)
+__attribute__((target("+crc")))
+static uint32_t crc32_arm(uint32_t crc, const uint8_t *p, size_t len)
+{
+   for (; len >= 8; len -= 8, p += 8) {
+      uint64_t v;
+      memcpy(&v, p, 8);
+      crc = __crc32d(crc, v);
+   }
+   while (len--)
+      crc = __crc32b(crc, *p++);
+   return crc;
+}
+#endif
+
+uint32_t vec_crc32(const void *data, size_t len)
+{
+   const uint8_t *p = data;
+   uint32_t crc = 0xffffffff;
+
+   pthread_once(&crc_once, crc_init);
+#if defined(__aarch64__)
+   if (crc_hw)
+      return ~crc32_arm(crc, p, len);
+#endif
+   while (len--)
+      crc = crc_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+   return ~crc;
+}
+
+uint64_t vec_hash(const void *data, size_t len)
+{
+   const uint8_t *p = data;
+   uint64_t h = 0xcbf29ce484222325ULL;
+
+   for (size_t i = 0; i < len; i++) {
+      h ^= p[i];
+      h *= 0x100000001b3ULL;
+   }
+   return h;
+}
+
+/*
+ * $XVCPI_CACHE, else $XDG_CACHE_HOME/xvcpi, else ~/.cache/xvcpi; an
+ * empty XVCPI_CACHE turns the cache off.
+ */
+bool vec_cache_path(char *path, size_t size, uint64_t source_hash)
+{
+   const char *dir = getenv("XVCPI_CACHE");
+   char buf[256];
+
+   if (dir && !*dir)
+      return false;
+   if (!dir) {
+      const char *base = getenv("XDG_CACHE_HOME");
+      if (base && *base) {
+         snprintf(buf, sizeof(buf), "%s", base);
+      } else {
+         const char *home = getenv("HOME");
+         if (!home)
+            return false;
+         snprintf(buf, sizeof(buf), "%s/.cache", home);
+      }
+      mkdir(buf, 0755);
+      strncat(buf, "/xvcpi", sizeof(buf) - strlen(buf) - 1);
+      dir = buf;
+   }
+   if (mkdir(dir, 0755) < 0 && errno != EEXIST)
+      return false;
+   return snprintf(path, size, "%s/%016llx.xvec", dir,
+                   (unsigned long long)source_hash) < (int)size;
+}
+
+bool vec_is_vector_file(const char *path)
+{
+   char magic[8];
+   int fd = open(path, O_RDONLY);
+   bool is = fd >= 0 && read(fd, magic, 8) == 8 && !memcmp(magic, VEC_MAGIC, 8);
+
+   if (fd >= 0)
+      close(fd);
+   return is;
+}
+
+struct vec_writer *vec_writer_open(const char *path, uint64_t source_hash, uint32_t flags)
+{
+   struct vec_writer *w = calloc(1, sizeof(*w));
+
+   if (!w)
+      return NULL;
+   w->path = strdup(path);
+   w->tmp = malloc(strlen(path) + 32);
+   w->runs = malloc(VEC_MAX_BITS + 16);
+   w->masked = malloc(VEC_MAX_BITS / 8);
+   if (!w->path || !w->tmp || !w->runs || !w->masked)
+      goto fail;
+   /* Written under a temporary name, so a cache entry is complete or absent */
+   sprintf(w->tmp, "%s.%d.tmp", path, (int)getpid());
+   w->f = fopen(w->tmp, "wb");
+   if (!w->f) {
+      perror(w->tmp);
+      goto fail;
+   }
+   memcpy(w->h.magic, VEC_MAGIC, 8);
+   w->h.version = VEC_VERSION;
+   w->h.flags = flags;
+   w->h.source_hash = source_hash;
+   if (fwrite(&w->h, sizeof(w->h), 1, w->f) != 1)
+      w->error = true;
+   return w;
+
+fail:
+   free(w->path);
+   free(w->tmp);
+   free(w->runs);
+   free(w->masked);
+   free(w);
+   return NULL;
+}
+
+static void write_padded(struct vec_writer *w, const void *data, size_t len)
+{
+   static const uint8_t zero[8];
+
+   if (fwrite(data, 1, len, w->f) != len || fwrite(zero, 1, pad8(len) - len, w->f) != pad8(len) - len)
+      w->error = true;
+}
+
+/* TMS as LEB128 runs of (length << 1 | value); whole 0x00/0xff bytes go at once */
+static size_t tms_encode(uint8_t *out, const uint8_t *tms, int bits)
+{
+   size_t n = 0;
+   int i = 0;
+
+   while (i < bits) {
+      const int v = (tms[i >> 3] >> (i & 7)) & 1;
+      const uint8_t fill = v ? 0xff : 0x00;
+      uint64_t run = 0;
+
+      while (i < bits) {
+         if (!(i & 7) && bits - i >= 8 && tms[i >> 3] == fill) {
+            run += 8;
+            i += 8;
+         } else if (((tms[i >> 3] >> (i & 7)) & 1) == v) {
+            run++;
+            i++;
+         } else {
+            break;
+         }
+      }
+      uint64_t x = run << 1 | v;
+      do {
+         out[n++] = (x & 0x7f) | (x > 0x7f ? 0x80 : 0);
+         x >>= 7;
+      } while (x);
+   }
+   return n;
+}
+
+static void set_bits(uint8_t *buf, int pos, int n)
+{
+   while (n && (pos & 7)) {
+      buf[pos >> 3] |= 1 << (pos & 7);
+      pos++;
+      n--;
+   }
+   memset(buf + (pos >> 3), 0xff, n >> 3);
+   pos += n & ~7;
+   for (n &= 7; n; n--, pos++)
+      buf[pos >> 3] |= 1 << (pos & 7);
+}
+
+static bool tms_decode(uint8_t *tms, int bits, const uint8_t *runs, size_t len)
+{
+   size_t i = 0;
+   int pos = 0;
+
+   memset(tms, 0, (bits + 7) / 8);
+   while (i < len) {
+      uint64_t x = 0;
+      int sh = 0;
+      do {
+         if (i == len || sh > 56)
+            return false;
+         x |= (uint64_t)(runs[i] & 0x7f) << sh;
+         sh += 7;
+      } while (runs[i++] & 0x80);
+      uint64_t run = x >> 1;
+      if (run > (uint64_t)(bits - pos))
+         return false;
+      if (x & 1)
+         set_bits(tms, pos, run);
+      pos += run;
+   }
+   return pos == bits;
+}
+
+bool vec_write_shift(struct vec_writer *w, int bits, uint32_t flags, uint64_t min_ns,
+                     const struct vec_mark *marks, int nmarks, const uint8_t *tms,
+                     const uint8_t *tdi, const uint8_t *exp, const uint8_t *mask)
+{
+   /* Anything vec_replay() would call corrupt; a 0-bit record only waits */
+   if (bits < 0 || bits > VEC_MAX_BITS || (!bits && !min_ns))
+      return false;
+
+   const size_t bytes = (bits + 7) / 8;
+   struct vec_record r = {
+      .kind = VEC_SHIFT,
+      .flags = flags,
+      .bits = bits,
+      .nmarks = nmarks,
+      .min_ns = min_ns,
+   };
+
+   if ((flags & VEC_COMPARE) && (w->h.flags & VEC_CRC_CHECKS)) {
+      bool all = true;
+      for (size_t i = 0; i < bytes; i++) {
+         w->masked[i] = exp[i] & mask[i];
+         all &= mask[i] == (i < bytes - 1 || !(bits & 7) ? 0xff : (1 << (bits & 7)) - 1);
+      }
+      r.flags = (flags & ~VEC_COMPARE) | VEC_CRC | (all ? VEC_ALL_BITS : 0);
+      r.crc = vec_crc32(w->masked, bytes);
+   }
+
+   r.tms_len = tms_encode(w->runs, tms, bits);
+   write_padded(w, &r, sizeof(r));
+   write_padded(w, marks, nmarks * sizeof(*marks));
+   write_padded(w, w->runs, r.tms_len);
+   write_padded(w, tdi, bytes);
+   if (r.flags & VEC_COMPARE) {
+      write_padded(w, exp, bytes);
+      write_padded(w, mask, bytes);
+   } else if ((r.flags & VEC_CRC) && !(r.flags & VEC_ALL_BITS)) {
+      write_padded(w, mask, bytes);
+   }
+   w->h.records++;
+   w->h.bits += bits;
+   return !w->error;
+}
+
+bool vec_write_frequency(struct vec_writer *w, double hz)
+{
+   struct vec_record r = { .kind = VEC_FREQUENCY, .hz = hz };
+
+   write_padded(w, &r, sizeof(r));
+   w->h.records++;
+   return !w->error;
+}
+
+bool vec_writer_close(struct vec_writer *w, bool keep)
+{
+   bool ok;
+
+   if (!w)
+      return false;
+   if (fseek(w->f, 0, SEEK_SET) || fwrite(&w->h, sizeof(w->h), 1, w->f) != 1)
+      w->error = true;
+   if (fclose(w->f))
+      w->error = true;
+   ok = keep && !w->error;
+   if (!ok || rename(w->tmp, w->path) < 0) {
+      if (ok)
+         perror(w->path);
+      unlink(w->tmp);
+      ok = false;
+   }
+   free(w->path);
+   free(w->tmp);
+   free(w->runs);
+   free(w->masked);
+   free(w);
+   return ok;
+}
+
+int vec_first_mismatch(int bits, const uint8_t *tdo, const uint8_t *exp,
+                       const uint8_t *mask)
+{
+   for (int b = 0; b < (bits + 7) / 8; b++) {
+      uint8_t d = (tdo[b] ^ exp[b]) & mask[b];
+      if (d)
+         return b * 8 + __builtin_ctz(d);
+   }
+   return -1;
+}
+
+/* The mark of the command a bit of a record belongs to */
+static const struct vec_mark *first_mark(const struct vec_mark *marks, int nmarks, int bit)
+{
+   const struct vec_mark *m = NULL;
+
+   for (int i = 0; i < nmarks; i++)
+      if (marks[i].bit <= bit)
+         m = &marks[i];
+   return m;
+}
+
+void vec_report_mismatch(const char *path, bool recorded, const struct vec_mark *marks,
+                         int nmarks, int bit, const uint8_t *tdo, const uint8_t *exp)
+{
+   const struct vec_mark *m = first_mark(marks, nmarks, bit);
+   fprintf(stderr, "%s:%s%d: TDO mismatch at %s bit %llu: expected %d, got %d\n",
+           path, recorded ? " shift " : "", m ? m->line : 0, recorded ? "shift" : "scan",
+           (unsigned long long)(m ? m->scan_bit + bit - m->bit : (uint64_t)bit),
+           (exp[bit >> 3] >> (bit & 7)) & 1, (tdo[bit >> 3] >> (bit & 7)) & 1);
+}
+
+static int corrupt(const char *path, const uint8_t *file, const uint8_t *p)
+{
+   fprintf(stderr, "%s: corrupt vector file at offset %zu\n", path, (size_t)(p - file));
+   return -1;
+}
+
+/* Length of what follows a shift record, if it is sane */
+static size_t record_size(const struct vec_record *r)
+{
+   const size_t bytes = (r->bits + 7) / 8;
+   const int sections = r->flags & VEC_COMPARE ? 3 :
+                        (r->flags & VEC_CRC) && !(r->flags & VEC_ALL_BITS) ? 2 : 1;
+
+   return pad8(r->nmarks * sizeof(struct vec_mark)) + pad8(r->tms_len) +
+          pad8(bytes) * sections;
+}
+
+static bool record_fits(const struct vec_record *r, size_t left)
+{
+   /* Each on its own first: on 32 bits their sum could wrap */
+   return r->bits <= VEC_MAX_BITS && r->nmarks <= left / sizeof(struct vec_mark) &&
+          r->tms_len <= left && record_size(r) <= left;
+}
+
+bool vec_check(const char *path, uint64_t source_hash)
+{
+   const struct vec_header *h;
+   struct stat st;
+   uint8_t *tms = malloc(VEC_MAX_BITS / 8);
+   uint64_t records = 0;
+   bool ok = false;
+   int fd = open(path, O_RDONLY);
+
+   if (!tms || fd < 0 || fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(*h)) {
+      if (fd >= 0)
+         close(fd);
+      free(tms);
+      return false;
+   }
+   const uint8_t *file = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+   close(fd);
+   if (file == MAP_FAILED) {
+      free(tms);
+      return false;
+   }
+   h = (const struct vec_header *)file;
+   const uint8_t *p = file + sizeof(*h), *end = file + st.st_size;
+   if (memcmp(h->magic, VEC_MAGIC, 8) || h->version != VEC_VERSION ||
+       h->source_hash != source_hash)
+      goto out;
+   while (p < end) {
+      const struct vec_record *r = (const struct vec_record *)p;
+
+      if ((size_t)(end - p) < sizeof(*r))
+         goto out;
+      p += sizeof(*r);
+      records++;
+      if (r->kind == VEC_FREQUENCY)
+         continue;
+      if (r->kind != VEC_SHIFT || !record_fits(r, end - p) ||
+          !tms_decode(tms, r->bits, p + pad8(r->nmarks * sizeof(struct vec_mark)),
+                      r->tms_len))
+         goto out;
+      p += record_size(r);
+   }
+   ok = records == h->records;
+
+out:
+   munmap((void *)file, st.st_size);
+   free(tms);
+   return ok;
+}
+
+int vec_replay(struct jtag_gpio *g, const char *path, const char *name,
+               const volatile sig_atomic_t *running, struct vec_result *res)
+{
+   const struct vec_header *h;
+   struct stat st;
+   uint8_t *tms, *tdo;
+   int fd, result = 0;
+
+   if (!name)
+      name = path;
+   fd = open(path, O_RDONLY);
+   if (fd < 0 || fstat(fd, &st) < 0) {
+      perror(path);
+      if (fd >= 0)
+         close(fd);
+      return -1;
+   }
+   if ((size_t)st.st_size < sizeof(*h)) {
+      fprintf(stderr, "%s: not a vector file\n", path);
+      close(fd);
+      return -1;
+   }
+   const uint8_t *file = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+   close(fd);
+   if (file == MAP_FAILED) {
+      perror(path);
+      return -1;
+   }
+   madvise((void *)file, st.st_size, MADV_SEQUENTIAL);
+   h = (const struct vec_header *)file;
+   if (memcmp(h->magic, VEC_MAGIC, 8) || h->version != VEC_VERSION) {
+      fprintf(stderr, "%s: not a version %d vector file\n", path, VEC_VERSION);
+      munmap((void *)file, st.st_size);
+      return -1;
+   }
+
+   tms = malloc(VEC_MAX_BITS / 8);
+   tdo = malloc(VEC_MAX_BITS / 8);
+   if (!tms || !tdo) {
+      perror("malloc");
+      result = -1;
+      goto out;
+   }
+
+   const bool recorded = h->flags & VEC_RECORDED;
+   const uint64_t base_ps = g->delay.ps;
+   const uint8_t *p = file + sizeof(*h), *end = file + st.st_size;
+   uint64_t mark_ns = 0, t0 = now_ns(), shifted = 0, records = 0;
+   uint64_t mismatch_tck = UINT64_MAX;
+   int mismatch_line = 0;
+
+   while (p < end) {
+      const struct vec_record *r = (const struct vec_record *)p;
+
+      if (running && !*running) {
+         fprintf(stderr, "%s: cancelled\n", name);
+         result = -1;
+         break;
+      }
+      if ((size_t)(end - p) < sizeof(*r)) {
+         result = corrupt(path, file, p);
+         break;
+      }
+      p += sizeof(*r);
+      records++;
+
+      if (r->kind == VEC_FREQUENCY) {
+         uint64_t ps = r->hz > 0 ? (uint64_t)(1e12 / r->hz / 2) : 0;
+         delay_set_ps(&g->delay, ps > base_ps ? ps : base_ps);
+         continue;
+      }
+      if (r->kind != VEC_SHIFT || !record_fits(r, end - p)) {
+         result = corrupt(path, file, p);
+         break;
+      }
+
+      const size_t bytes = (r->bits + 7) / 8;
+      const struct vec_mark *marks = (const struct vec_mark *)p;
+      p += pad8(r->nmarks * sizeof(*marks));
+      if (!tms_decode(tms, r->bits, p, r->tms_len)) {
+         result = corrupt(path, file, p);
+         break;
+      }
+      p += pad8(r->tms_len);
+      const uint8_t *tdi = p;
+      p += pad8(bytes);
+
+      timing_poll();
+      if (r->flags & VEC_MARK)
+         mark_ns = now_ns();
+      if (r->bits)
+         jtag_shift(g, r->bits, tms, tdi, tdo);
+
+      if (r->flags & VEC_COMPARE) {
+         const uint8_t *exp = p, *mask = p + pad8(bytes);
+         p += 2 * pad8(bytes);
+         int bit = vec_first_mismatch(r->bits, tdo, exp, mask);
+         if (bit >= 0) {
+            const struct vec_mark *m = first_mark(marks, r->nmarks, bit);
+            vec_report_mismatch(name, recorded, marks, r->nmarks, bit, tdo, exp);
+            mismatch_tck = shifted + bit;
+            mismatch_line = m ? m->line : 0;
+            result = 1;
+            break;
+         }
+      } else if (r->flags & VEC_CRC) {
+         if (!(r->flags & VEC_ALL_BITS)) {
+            for (size_t i = 0; i < bytes; i++)
+               tdo[i] &= p[i];
+            p += pad8(bytes);
+         }
+         uint32_t crc = vec_crc32(tdo, bytes);
+         if (crc != r->crc) {
+            const int first = r->nmarks ? marks[0].line : 0;
+            const int last = r->nmarks ? marks[r->nmarks - 1].line : 0;
+            fprintf(stderr, "%s:%s%d: TDO CRC mismatch in the %u bit vector ", name,
+                    recorded ? " shift " : "", first, r->bits);
+            if (last != first)
+               fprintf(stderr, "up to %s%d ", recorded ? "shift " : "line ", last);
+            fprintf(stderr, "(expected %08x, got %08x)\n", r->crc, crc);
+            mismatch_tck = shifted;
+            mismatch_line = first;
+            result = 1;
+            break;
+         }
+      }
+      shifted += r->bits;
+      if (r->min_ns) {
+         uint64_t until = mark_ns + r->min_ns, now;
+         while ((now = now_ns()) < until) {
+            uint64_t left = until - now;
+            struct timespec ts = { left / 1000000000ULL, left % 1000000000ULL };
+            nanosleep(&ts, NULL);
+         }
+      }
+   }
+   delay_set_ps(&g->delay, base_ps);
+
+   double secs = (now_ns() - t0) / 1e9;
+   printf("%s: %s, %llu vectors, %llu TCKs in %.3f s (%.1f kHz)\n",
+          name, result == 0 ? "PASS" : result > 0 ? "FAIL" : "ERROR",
+          (unsigned long long)records, (unsigned long long)shifted, secs,
+          secs > 0 ? shifted / secs / 1000 : 0);
+   if (res) {
+      res->tcks = shifted;
+      res->mismatch_tck = mismatch_tck;
+      res->line = mismatch_line;
+   }
+
+out:
+   free(tms);
+   free(tdo);
+   munmap((void *)file, st.st_size);
+   return result;
+}
+
+/*
+ * This work, "vec.c", is part of "xvcpi.c"
+ * Updated for modern Raspberry Pi systems using libgpiod
+ *
+ * Original "xvcpi.c" is licensed under CC0 1.0 Universal
+ * by Derek Mulcahy.
+ */
@@ -0,0 +1,134 @@
+/*
+ * Description :  Compiled JTAG vector files for the xvcpi JTAG engine
+ *
+ * See Licensing information at End of File.
+ */
+
+#ifndef XVCPI_VEC_H
+#define XVCPI_VEC_H
+
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "jtag.h"
+
+/*
+ * A vector file holds what the engine shifts, ready to go: a header,
+ * then records, each padded to 8 bytes so the packed bit sections can
+ * be handed to jtag_shift() straight from the mapping.  Fields are in
+ * host byte order.
+ *
+ *    struct vec_record
+ *    struct vec_mark marks[nmarks]
+ *    TMS as runs: LEB128 of (run length << 1 | value), tms_len bytes
+ *    TDI, (bits + 7) / 8 bytes, LSB first
+ *    expected TDO and mask, the same size, with VEC_COMPARE
+ *    mask only, with VEC_CRC unless VEC_ALL_BITS
+ *
+ * A VEC_CRC record keeps just the CRC-32 of the expected TDO under the
+ * mask: a readback verify then stores a checksum instead of the data,
+ * at the price of knowing only which vector failed, not which bit.
+ */
+#define VEC_MAGIC       "XVCVEC\r\n"
+#define VEC_VERSION     (1)
+#define VEC_MAX_BITS    (64 * 1024)    /* per shift record */
+
+/* Header flags */
+#define VEC_RECORDED    (1u << 0)      /* from an XVC session, marks count shifts */
+#define VEC_CRC_CHECKS  (1u << 1)      /* the writer turns VEC_COMPARE into VEC_CRC */
+
+struct vec_header {
+   char magic[8];
+   uint32_t version;
+   uint32_t flags;
+   uint64_t source_hash;       /* of the SVF file compiled, 0 for recordings */
+   uint64_t records;
+   uint64_t bits;
+};
+
+enum vec_kind { VEC_SHIFT = 1, VEC_FREQUENCY = 2 };
+
+/* Record flags */
+#define VEC_COMPARE     (1u << 0)      /* has expected TDO and mask */
+#define VEC_MARK        (1u << 1)      /* min_ns is counted from here */
+#define VEC_CRC         (1u << 2)      /* TDO & mask must have CRC-32 crc */
+#define VEC_ALL_BITS    (1u << 3)      /* with VEC_CRC: mask of all ones, not stored */
+
+struct vec_record {
+   uint32_t kind;
+   uint32_t flags;
+   uint32_t bits;
+   uint32_t nmarks;
+   uint32_t tms_len;
+   uint32_t crc;
+   uint64_t min_ns;            /* wait after the shift, from the last VEC_MARK */
+   double hz;                  /* VEC_FREQUENCY, 0 for the start speed */
+};
+
+/* Where a source command starts, for mismatch reports */
+struct vec_mark {
+   int32_t bit;                /* first bit of the command in the record */
+   int32_t line;               /* SVF line, or shift number when recorded */
+   uint64_t scan_bit;          /* scan bit at that position */
+};
+
+struct vec_writer;
+
+struct vec_writer *vec_writer_open(const char *path, uint64_t source_hash, uint32_t flags);
+bool vec_write_shift(struct vec_writer *w, int bits, uint32_t flags, uint64_t min_ns,
+                     const struct vec_mark *marks, int nmarks, const uint8_t *tms,
+                     const uint8_t *tdi, const uint8_t *exp, const uint8_t *mask);
+bool vec_write_frequency(struct vec_writer *w, double hz);
+/* Finish the file; without keep, or on a write error, it is removed */
+bool vec_writer_close(struct vec_writer *w, bool keep);
+
+/* CRC-32 (IEEE 802.3), with the ARMv8 CRC instructions where present */
+uint32_t vec_crc32(const void *data, size_t len);
+
+/* 64-bit FNV-1a, the cache key of a compiled SVF file */
+uint64_t vec_hash(const void *data, size_t len);
+
+/* Compiled copy of an SVF file with this content in the cache directory */
+bool vec_cache_path(char *path, size_t size, uint64_t source_hash);
+
+/* Whether a file starts like a vector file */
+bool vec_is_vector_file(const char *path);
+
+/*
+ * Whether a cache entry is whole, of this version and compiled from
+ * source_hash: checked before it is replayed, since a bad one would
+ * otherwise fail part way through, after clocking the target.
+ */
+bool vec_check(const char *path, uint64_t source_hash);
+
+/* Outcome of a replay beyond pass/fail */
+struct vec_result {
+   uint64_t tcks;              /* clocks shifted */
+   uint64_t mismatch_tck;      /* first failing clock, or of the failing CRC vector */
+   int line;                   /* SVF line or recorded shift of the mismatch */
+};
+
+/*
+ * Replay a vector file on a chain, with the same results as svf_play():
+ * 0 pass, 1 TDO mismatch, -1 error or stopped through *running.
+ * Messages name the file as name, e.g. the SVF file it was compiled from;
+ * res, if given, gets the details.
+ */
+int vec_replay(struct jtag_gpio *g, const char *path, const char *name,
+               const volatile sig_atomic_t *running, struct vec_result *res);
+
+/* Find the first mismatch of a shift and report it against the record's marks */
+int vec_first_mismatch(int bits, const uint8_t *tdo, const uint8_t *exp,
+                       const uint8_t *mask);
+void vec_report_mismatch(const char *path, bool recorded, const struct vec_mark *marks,
+                         int nmarks, int bit, const uint8_t *tdo, const uint8_t *exp);
+
+#endif
+
+/*
+ * This work, "vec.h", is part of "xvcpi.c"
+ * Updated for modern Raspberry Pi systems using libgpiod
+ *
+ * Original "xvcpi.c" is licensed under CC0 1.0 Universal
+ * by Derek Mulcahy.
+ */
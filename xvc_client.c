@@ -0,0 +1,84 @@
+/*
+ * Description :  Client side of the XVC protocol, for the tools that
+ *                talk to xvcpi: xvc_loadgen, xvc_proxy and xvc_delay
+ *
+ * See Licensing information at End of File.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include "xvc_proto.h"
+
+int xvc_connect(const char *host, const char *port)
+{
+   struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM };
+   struct addrinfo *res, *ai;
+   int fd = -1;
+
+   if (getaddrinfo(host, port, &hints, &res) != 0) {
+      fprintf(stderr, "Cannot resolve %s:%s\n", host, port);
+      return -1;
+   }
+   for (ai = res; ai; ai = ai->ai_next) {
+      fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+      if (fd < 0)
+         continue;
+      if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+         break;
+      close(fd);
+      fd = -1;
+   }
+   freeaddrinfo(res);
+   if (fd < 0) {
+      perror("connect");
+      return -1;
+   }
+   int flag = 1;
+   setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+   return fd;
+}
+
+int xvc_read(int fd, void *target, int len)
+{
+   unsigned char *t = target;
+   while (len) {
+      int r = read(fd, t, len);
+      if (r <= 0) {
+         if (r < 0 && errno == EINTR)
+            continue;
+         return r;
+      }
+      t += r;
+      len -= r;
+   }
+   return 1;
+}
+
+bool xvc_has_extension(const char *info, const char *name)
+{
+   const char *p = strchr(info, ':');
+   size_t n = strlen(name);
+
+   p = p ? strchr(p + 1, ':') : NULL;
+   while (p) {
+      p++;
+      if (strncmp(p, name, n) == 0 && (p[n] == ',' || p[n] == '\n' || !p[n]))
+         return true;
+      p = strchr(p, ',');
+   }
+   return false;
+}
+
+/*
+ * This work, "xvc_client.c", is part of "xvcpi.c"
+ * Updated for modern Raspberry Pi systems using libgpiod
+ *
+ * Original "xvcpi.c" is licensed under CC0 1.0 Universal
+ * by Derek Mulcahy.
+ */
@@ -0,0 +1,212 @@
+/*
+ * Description :  TCP delay shim
+ *
+ *                Forwards connections to a server, holding the data in
+ *                each direction for half the round-trip time and
+ *                optionally limiting the bandwidth, like netem on a WAN
+ *                link.  Used to benchmark xvc_proxy and the protocol
+ *                extensions without a remote lab.
+ *
+ * See Licensing information at End of File.
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include "xvc_proto.h"
+
+static uint64_t delay_ns = 25000000;   /* one way, half of -r */
+static double rate = 0;                /* bytes per ns, 0 for unlimited */
+
+struct chunk {
+   struct chunk *next;
+   uint64_t due;
+   size_t len;
+   uint8_t data[];
+};
+
+struct direction {
+   int from, to;
+};
+
+struct connection {
+   int client, server;
+};
+
+static uint64_t now_ns(void)
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Data read from one side is queued with the time it may leave; the
+ * loop sleeps in poll() until either more arrives or the oldest chunk
+ * is due.  A closed side is passed on once the queue has drained.
+ */
+static void *forward(void *arg)
+{
+   const struct direction *d = arg;
+   struct chunk *head = NULL, **tail = &head;
+   uint64_t link_free = 0;
+   bool eof = false;
+
+   while (!eof || head) {
+      uint64_t t = now_ns();
+      int timeout = -1;
+
+      while (head && head->due <= t) {
+         struct chunk *c = head;
+         if (write(d->to, c->data, c->len) != (ssize_t)c->len)
+            eof = true;
+         head = c->next;
+         if (!head)
+            tail = &head;
+         free(c);
+      }
+      if (head)
+         timeout = (head->due - t + 999999) / 1000000;
+      if (eof) {
+         if (head)
+            usleep((head->due - t) / 1000);
+         continue;
+      }
+
+      struct pollfd p = { .fd = d->from, .events = POLLIN };
+      if (poll(&p, 1, timeout) <= 0)
+         continue;
+
+      struct chunk *c = malloc(sizeof(*c) + 65536);
+      ssize_t n = c ? read(d->from, c->data, 65536) : -1;
+      if (n <= 0) {
+         free(c);
+         eof = true;
+         continue;
+      }
+      t = now_ns();
+      c->next = NULL;
+      c->len = n;
+      /* Serialization at the link rate, then the propagation delay */
+      if (rate > 0) {
+         link_free = (link_free > t ? link_free : t) + (uint64_t)(n / rate);
+         c->due = link_free + delay_ns;
+      } else {
+         c->due = t + delay_ns;
+      }
+      *tail = c;
+      tail = &c->next;
+   }
+   shutdown(d->to, SHUT_WR);
+   return NULL;
+}
+
+static void *connection(void *arg)
+{
+   struct connection *c = arg;
+   struct direction there = { c->client, c->server }, back = { c->server, c->client };
+   pthread_t t;
+
+   pthread_create(&t, NULL, forward, &there);
+   forward(&back);
+   pthread_join(t, NULL);
+   close(c->client);
+   close(c->server);
+   free(c);
+   return NULL;
+}
+
+int main(int argc, char **argv)
+{
+   const char *host = "127.0.0.1", *port = "2542";
+   int listen_port = 2543;
+   int c;
+
+   while ((c = getopt(argc, argv, "r:b:l:h:p:")) != -1) {
+      switch (c) {
+      case 'r':
+         delay_ns = atof(optarg) * 1e6 / 2;
+         break;
+      case 'b':
+         rate = atof(optarg) * 1e3 / 8 / 1e9;
+         break;
+      case 'l':
+         listen_port = atoi(optarg);
+         break;
+      case 'h':
+         host = optarg;
+         break;
+      case 'p':
+         port = optarg;
+         break;
+      default:
+         fprintf(stderr, "usage: %s [-r rtt_ms] [-b kbit/s] [-l port] [-h host] [-p port]\n", *argv);
+         fprintf(stderr, "  -r ms       : round-trip time added (default: 50)\n");
+         fprintf(stderr, "  -b kbit/s   : bandwidth in each direction (default: unlimited)\n");
+         fprintf(stderr, "  -l port     : port to listen on (default: 2543)\n");
+         fprintf(stderr, "  -h host     : server (default: 127.0.0.1)\n");
+         fprintf(stderr, "  -p port     : its port (default: 2542)\n");
+         fprintf(stderr, "Every connection gets its own link of this speed.\n");
+         return 1;
+      }
+   }
+
+   signal(SIGPIPE, SIG_IGN);
+   struct sockaddr_in address = { 0 };
+   int s = socket(AF_INET, SOCK_STREAM, 0), one = 1;
+   setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+   address.sin_family = AF_INET;
+   address.sin_addr.s_addr = INADDR_ANY;
+   address.sin_port = htons(listen_port);
+   if (bind(s, (struct sockaddr *)&address, sizeof(address)) < 0 || listen(s, 4) < 0) {
+      perror("listen");
+      return 1;
+   }
+
+   for (;;) {
+      int client = accept(s, NULL, NULL);
+      if (client < 0) {
+         if (errno == EINTR)
+            continue;
+         perror("accept");
+         return 1;
+      }
+      int server = xvc_connect(host, port);
+      if (server < 0) {
+         close(client);
+         continue;
+      }
+      setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+      struct connection *c = malloc(sizeof(*c));
+      pthread_t t;
+      c->client = client;
+      c->server = server;
+      if (pthread_create(&t, NULL, connection, c) != 0) {
+         close(client);
+         close(server);
+         free(c);
+         continue;
+      }
+      pthread_detach(t);
+   }
+}
+
+/*
+ * This work, "xvc_delay.c", is part of "xvcpi.c"
+ * Updated for modern Raspberry Pi systems using libgpiod
+ *
+ * Original "xvcpi.c" is licensed under CC0 1.0 Universal
+ * by Derek Mulcahy.
+ */
@@ -0,0 +1,344 @@
+/*
+ * Description :  XVC load generator
+ *
+ *                Drives an XVC server with a representative mix of
+ *                traffic: chain scans, ILA/debug-hub style polling with
+ *                many short shifts, and full-length bitstream shifts.
+ *                Used to train the profile-guided build and to compare
+ *                server builds; against "xvcpi -b mock" no hardware is
+ *                needed.
+ *
+ * See Licensing information at End of File.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "rle.h"
+#include "xvc_proto.h"
+
+#define MAX_VECTOR_BYTES (1024)  /* per TMS/TDI half of a 2048-byte shift */
+
+static int verbose = 0;
+static uint64_t total_shifts = 0;
+static uint64_t total_bits = 0;
+static uint64_t total_sent = 0;
+static uint64_t total_received = 0;
+static bool use_wshift = false;    /* server offers wshift: and -s not given */
+static bool use_zshift = false;    /* -z and offered */
+static bool use_mshift = false;    /* -M and offered */
+
+/* Shifts collected for one mshift: */
+static struct {
+   uint8_t msg[11 + MSHIFT_MAX_TDO * 2 + 4 * 256];
+   size_t len;
+   uint32_t count;
+   size_t tdo_bytes;
+} batch;
+
+static uint64_t now_ns(void)
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint32_t xorshift32(uint32_t *state)
+{
+   uint32_t x = *state;
+   x ^= x << 13;
+   x ^= x >> 17;
+   x ^= x << 5;
+   return *state = x;
+}
+
+static bool swrite(int fd, const void *buf, size_t len)
+{
+   total_sent += len;
+   return write(fd, buf, len) == (ssize_t)len;
+}
+
+static int sread_count(int fd, void *target, int len)
+{
+   total_received += len;
+   return xvc_read(fd, target, len);
+}
+
+static bool getinfo(int fd, char *info, size_t size)
+{
+   if (!swrite(fd, "getinfo:", 8))
+      return false;
+   for (size_t i = 0; i < size - 1; i++)
+      if (xvc_read(fd, &info[i], 1) != 1 || info[i] == '\n')
+         break;
+   return true;
+}
+
+/* zshift: with packed vectors, and packed TDO or none */
+static bool zshift(int fd, int bits, const uint8_t *tms, const uint8_t *tdi, uint8_t *tdo)
+{
+   uint8_t vectors[2 * MAX_VECTOR_BYTES];
+   uint8_t msg[16 + RLE_MAX_PACKED(2 * MAX_VECTOR_BYTES)];
+   uint32_t len = bits, size;
+   size_t nr_bytes = (bits + 7) / 8;
+
+   memcpy(vectors, tms, nr_bytes);
+   memcpy(vectors + nr_bytes, tdi, nr_bytes);
+   size = rle_pack(vectors, 2 * nr_bytes, msg + 16);
+   memcpy(msg, "zshift:", 7);
+   msg[7] = tdo ? ZSHIFT_PACK_TDO : ZSHIFT_NO_TDO;
+   memcpy(msg + 8, &len, 4);
+   memcpy(msg + 12, &size, 4);
+   if (!swrite(fd, msg, 16 + size))
+      return false;
+   if (!tdo)
+      return true;
+   if (sread_count(fd, &size, 4) != 1 || size > sizeof(msg) ||
+       sread_count(fd, msg, size) != 1)
+      return false;
+   return rle_unpack(msg, size, tdo, nr_bytes) == (ssize_t)nr_bytes;
+}
+
+/* One XVC shift; tdo may be NULL, then as wshift: where offered */
+static bool shift(int fd, int bits, const uint8_t *tms, const uint8_t *tdi, uint8_t *tdo)
+{
+   if (use_zshift) {
+      if (!zshift(fd, bits, tms, tdi, tdo)) {
+         fprintf(stderr, "zshift of %d bits failed\n", bits);
+         return false;
+      }
+      total_shifts++;
+      total_bits += bits;
+      return true;
+   }
+
+   uint8_t msg[11 + 2 * MAX_VECTOR_BYTES], scratch[MAX_VECTOR_BYTES];
+   uint32_t len = bits;
+   size_t nr_bytes = (bits + 7) / 8;
+   bool write_only = !tdo && use_wshift;
+   size_t cmd = write_only ? 7 : 6;
+
+   memcpy(msg, write_only ? "wshift:" : "shift:", cmd);
+   memcpy(msg + cmd, &len, 4);
+   memcpy(msg + cmd + 4, tms, nr_bytes);
+   memcpy(msg + cmd + 4 + nr_bytes, tdi, nr_bytes);
+   if (!swrite(fd, msg, cmd + 4 + 2 * nr_bytes) ||
+       (!write_only && sread_count(fd, tdo ? tdo : scratch, nr_bytes) != 1)) {
+      fprintf(stderr, "shift of %d bits failed\n", bits);
+      return false;
+   }
+   total_shifts++;
+   total_bits += bits;
+   return true;
+}
+
+static bool batch_flush(int fd)
+{
+   uint8_t tdo[MSHIFT_MAX_TDO];
+
+   if (!batch.count)
+      return true;
+   memcpy(batch.msg, "mshift:", 7);
+   memcpy(batch.msg + 7, &batch.count, 4);
+   if (!swrite(fd, batch.msg, batch.len) ||
+       sread_count(fd, tdo, batch.tdo_bytes) != 1) {
+      fprintf(stderr, "mshift of %u shifts failed\n", batch.count);
+      return false;
+   }
+   batch.len = 0;
+   batch.count = 0;
+   batch.tdo_bytes = 0;
+   return true;
+}
+
+/* Queue a shift for the next mshift:, sending the batch when it is full */
+static bool batch_shift(int fd, int bits, const uint8_t *tms, const uint8_t *tdi)
+{
+   uint32_t len = bits;
+   size_t nr_bytes = (bits + 7) / 8;
+
+   if (batch.count == 256 || batch.tdo_bytes + nr_bytes > MSHIFT_MAX_TDO)
+      if (!batch_flush(fd))
+         return false;
+   if (!batch.count)
+      batch.len = 11;
+   memcpy(batch.msg + batch.len, &len, 4);
+   memcpy(batch.msg + batch.len + 4, tms, nr_bytes);
+   memcpy(batch.msg + batch.len + 4 + nr_bytes, tdi, nr_bytes);
+   batch.len += 4 + 2 * nr_bytes;
+   batch.tdo_bytes += nr_bytes;
+   batch.count++;
+   total_shifts++;
+   total_bits += bits;
+   return true;
+}
+
+/* Test-Logic-Reset, IDCODE read, 6-bit IR scan per device */
+static bool chain_scan(int fd, uint32_t *idcode)
+{
+   /* TLR, RTI, Select-DR, Capture-DR, Shift-DR; 32 bits; Exit1, Update, RTI */
+   uint8_t tms[6] = { 0x5f, 0x00, 0x00, 0x00, 0x00, 0x03 };
+   uint8_t tdi[6] = { 0 }, tdo[6];
+
+   if (!shift(fd, 43, tms, tdi, tdo))
+      return false;
+   *idcode = 0;
+   for (int b = 0; b < 32; b++)
+      *idcode |= (uint32_t)((tdo[(9 + b) / 8] >> ((9 + b) % 8)) & 1) << b;
+
+   /* RTI -> Shift-IR, BYPASS, back to RTI */
+   uint8_t ir_tms[2] = { 0x03, 0x06 }, ir_tdi[2] = { 0xf0, 0x03 }, ir_tdo[2];
+   return shift(fd, 12, ir_tms, ir_tdi, ir_tdo);
+}
+
+/* Debug-hub style polling: a short IR scan followed by a DR read */
+static bool poll_core(int fd, uint32_t *seed)
+{
+   uint8_t tms[32], tdi[32], tdo[32];
+   int dr_bits = 32 + xorshift32(seed) % 96;
+   int bits = 12 + 3 + dr_bits + 2;
+
+   memset(tms, 0, sizeof(tms));
+   for (size_t i = 0; i < sizeof(tdi); i++)
+      tdi[i] = xorshift32(seed);
+   /* IR scan as in chain_scan(), then RTI -> Shift-DR, dr_bits, RTI */
+   tms[0] = 0x03;
+   tms[1] = 0x06 | 0x10;
+   int exit_bit = 15 + dr_bits - 1;
+   tms[exit_bit / 8] |= 1 << (exit_bit % 8);
+   tms[(exit_bit + 1) / 8] |= 1 << ((exit_bit + 1) % 8);
+   if (use_mshift)
+      return batch_shift(fd, bits, tms, tdi);
+   return shift(fd, bits, tms, tdi, tdo);
+}
+
+/* Bitstream download: full-length Shift-DR vectors, TMS=0 */
+static bool bitstream_shift(int fd, uint32_t *seed)
+{
+   static uint8_t tms[MAX_VECTOR_BYTES], tdi[MAX_VECTOR_BYTES];
+
+   for (size_t i = 0; i < sizeof(tdi); i++)
+      tdi[i] = (xorshift32(seed) & 3) ? 0x00 : xorshift32(seed);
+   return shift(fd, MAX_VECTOR_BYTES * 8, tms, tdi, NULL);
+}
+
+int main(int argc, char **argv)
+{
+   const char *host = "127.0.0.1";
+   const char *port = "2542";
+   int rounds = 200;
+   int scans = 4, polls = 20, bitstream = 4;
+   bool quiet = false, stock = false, packed = false, batched = false;
+   uint32_t seed = 0x9e3779b9;
+   int c;
+
+   while ((c = getopt(argc, argv, "vqszMh:p:n:m:")) != -1) {
+      switch (c) {
+      case 'v':
+         verbose = 1;
+         break;
+      case 'q':
+         quiet = true;
+         break;
+      case 's':
+         stock = true;
+         break;
+      case 'z':
+         packed = true;
+         break;
+      case 'M':
+         batched = true;
+         break;
+      case 'h':
+         host = optarg;
+         break;
+      case 'p':
+         port = optarg;
+         break;
+      case 'n':
+         rounds = atoi(optarg);
+         break;
+      case 'm':
+         if (sscanf(optarg, "%d,%d,%d", &scans, &polls, &bitstream) != 3) {
+            fprintf(stderr, "-m expects scans,polls,bitstream\n");
+            return 1;
+         }
+         break;
+      default:
+         fprintf(stderr, "usage: %s [-v] [-q] [-s | -z] [-M] [-h host] [-p port] [-n rounds] [-m scans,polls,bitstream]\n", *argv);
+         fprintf(stderr, "  -n rounds   : rounds of the traffic mix (default: 200)\n");
+         fprintf(stderr, "  -m mix      : shifts per round of each kind (default: 4,20,4)\n");
+         fprintf(stderr, "  -q          : print only the summary line\n");
+         fprintf(stderr, "  -s          : stock XVC 1.0 only, even if the server offers wshift:\n");
+         fprintf(stderr, "  -z          : send all shifts RLE-packed as zshift:, if offered\n");
+         fprintf(stderr, "  -M          : send the polls of each round as one mshift:, if offered\n");
+         return 1;
+      }
+   }
+
+   int fd = xvc_connect(host, port);
+   if (fd < 0)
+      return 1;
+
+   char info[64] = { 0 };
+   uint32_t period = 100, actual;
+   if (!getinfo(fd, info, sizeof(info)))
+      return 1;
+   use_wshift = !stock && xvc_has_extension(info, "wshift");
+   use_zshift = packed && xvc_has_extension(info, "zshift");
+   if (packed && !use_zshift)
+      fprintf(stderr, "Server does not offer zshift:, using plain shifts\n");
+   use_mshift = batched && xvc_has_extension(info, "mshift");
+   if (batched && !use_mshift)
+      fprintf(stderr, "Server does not offer mshift:, using single shifts\n");
+   if (!swrite(fd, "settck:", 7) || !swrite(fd, &period, 4) ||
+       xvc_read(fd, &actual, 4) != 1) {
+      fprintf(stderr, "settck failed\n");
+      return 1;
+   }
+   if (!quiet)
+      printf("Server: %sTCK period %u ns\n", info, actual);
+
+   uint64_t t0 = now_ns();
+   for (int r = 0; r < rounds; r++) {
+      uint32_t idcode;
+      for (int i = 0; i < scans; i++) {
+         if (!chain_scan(fd, &idcode))
+            return 1;
+         if (verbose && r == 0 && i == 0)
+            printf("IDCODE 0x%08x\n", idcode);
+      }
+      for (int i = 0; i < polls; i++)
+         if (!poll_core(fd, &seed))
+            return 1;
+      if (!batch_flush(fd))
+         return 1;
+      for (int i = 0; i < bitstream; i++)
+         if (!bitstream_shift(fd, &seed))
+            return 1;
+   }
+   /* Write-only shifts have no reply; wait until the server is through */
+   char sync[64] = { 0 };
+   if (!getinfo(fd, sync, sizeof(sync)))
+      return 1;
+   double secs = (now_ns() - t0) / 1e9;
+
+   printf("%llu shifts, %llu bits in %.3f s: %.0f shifts/s, %.1f kbit/s, %.1f kB sent, %.1f kB received\n",
+          (unsigned long long)total_shifts, (unsigned long long)total_bits, secs,
+          total_shifts / secs, total_bits / secs / 1000,
+          total_sent / 1e3, total_received / 1e3);
+   close(fd);
+   return 0;
+}
+
+/*
+ * This work, "xvc_loadgen.c", is part of "xvcpi.c"
+ * Updated for modern Raspberry Pi systems using libgpiod
+ *
+ * Original "xvcpi.c" is licensed under CC0 1.0 Universal
+ * by Derek Mulcahy.
+ */
@@ -0,0 +1,48 @@
+/*
+ * Description :  XVC wire protocol, as xvcpi speaks it, and the client
+ *                side socket helpers of the tools that talk to it
+ *
+ * See Licensing information at End of File.
+ */
+
+#ifndef XVCPI_XVC_PROTO_H
+#define XVCPI_XVC_PROTO_H
+
+#include <stdbool.h>
+
+/*
+ * XVC 1.0 is getinfo:, settck:<period> and shift:<bits><tms><tdi>.  With
+ * -x the server lists these extensions after the vector size in the
+ * getinfo reply, where stock clients ignore them:
+ *
+ *    wshift:<bits><tms><tdi>    shift without sampling TDO, no reply
+ *    zshift:<flags><bits><size><TMS and TDI, packed with rle.h>
+ *                               reply TDO, packed as <size><data> with
+ *                               ZSHIFT_PACK_TDO, none with ZSHIFT_NO_TDO
+ *    mshift:<count>{<bits><tms><tdi>}...
+ *                               count shifts, one reply of all their TDO
+ *
+ * flags is one byte; lengths, sizes and counts are 32 bits, little-endian.
+ */
+#define ZSHIFT_PACK_TDO    (1 << 0)
+#define ZSHIFT_NO_TDO      (1 << 1)
+#define MSHIFT_MAX_TDO     (16 * 1024)  /* bytes of TDO per mshift: */
+
+/* TCP connection to host:port with Nagle off, or -1 */
+int xvc_connect(const char *host, const char *port);
+
+/* Read exactly len bytes: 1 when done, 0 at EOF, -1 on error */
+int xvc_read(int fd, void *target, int len);
+
+/* Whether a getinfo reply lists an extension after the vector size */
+bool xvc_has_extension(const char *info, const char *name);
+
+#endif
+
+/*
+ * This work, "xvc_proto.h", is part of "xvcpi.c"
+ * Updated for modern Raspberry Pi systems using libgpiod
+ *
+ * Original "xvcpi.c" is licensed under CC0 1.0 Universal
+ * by Derek Mulcahy.
+ */
@@ -0,0 +1,488 @@
+/*
+ * Description :  XVC proxy for high-latency links
+ *
+ *                Runs next to Vivado/hw_server and serves it plain XVC
+ *                1.0, while talking to xvcpi over one persistent
+ *                connection with the protocol extensions (xvcpi -x):
+ *                the largest vectors the server offers, shifts packed
+ *                as zshift:, and with -w the shifts whose TDO cannot
+ *                matter answered at once and streamed to the server
+ *                behind the client's back.  Vivado waits for the TDO of
+ *                every shift, so without -w each one still costs a
+ *                round trip.
+ *
+ * See Licensing information at End of File.
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include "jtag.h"
+#include "rle.h"
+#include "xvc_proto.h"
+
+#define MAX_VECTOR_BYTES   (8 * 1024)  /* per TMS/TDI half, as xvcpi -S 16384 */
+#define FLUSH_IDLE_MS      (2)         /* client quiet this long: send what is queued */
+
+int verbose = 0;
+static bool stock = false;             /* -s: plain shift: upstream, as a baseline */
+
+/* The server and what it offers */
+static struct {
+   const char *host, *port;
+   int fd;
+   int vector_size;                    /* TMS and TDI bytes of one shift */
+   bool wshift, zshift;
+} up = { "127.0.0.1", "2542", -1, 0, false, false };
+
+/*
+ * -w: TDO is don't-care outside Shift-IR/DR, and in Shift-DR while the
+ * chain's IR holds a write-only instruction such as CFG_IN (0x05 on a
+ * single 7-series or UltraScale device).  Such shifts are answered with
+ * zeros without asking the server.
+ */
+static bool write_behind = false;
+static uint64_t cfg_ir = 0x05;
+static int cfg_ir_len = 6;
+
+/* The TAP, followed from the client's TMS; unknown until a reset is clocked */
+static struct {
+   int state;                          /* -1 while unknown */
+   int ones;                           /* TMS=1 clocks in a row */
+   uint64_t ir, ir_shift;
+   int ir_bits;
+   bool ir_valid;
+} tap;
+
+/* Write-only shifts waiting to go to the server, concatenated */
+static struct {
+   uint8_t tms[MAX_VECTOR_BYTES], tdi[MAX_VECTOR_BYTES];
+   int bits;
+} pending;
+
+static struct {
+   uint64_t shifts, local, round_trips, sent, received;
+} stats;
+
+static bool swrite(int fd, const void *buf, size_t len)
+{
+   return write(fd, buf, len) == (ssize_t)len;
+}
+
+static inline int bit_at(const uint8_t *v, int i)
+{
+   return (v[i >> 3] >> (i & 7)) & 1;
+}
+
+/* Append bits to a zeroed vector at bit position at */
+static void append_bits(uint8_t *dst, int at, const uint8_t *src, int bits)
+{
+   const int sh = at & 7;
+   const size_t bytes = (bits + 7) / 8;
+   uint8_t *d = dst + at / 8;
+
+   for (size_t i = 0; i < bytes; i++) {
+      unsigned int v = src[i];
+      if (i == bytes - 1 && (bits & 7))
+         v &= (1u << (bits & 7)) - 1;
+      d[i] |= v << sh;
+      if (sh && (v >> (8 - sh)))
+         d[i + 1] |= v >> (8 - sh);
+   }
+}
+
+static void up_close(void)
+{
+   if (up.fd >= 0)
+      close(up.fd);
+   up.fd = -1;
+   memset(&pending, 0, sizeof(pending));
+}
+
+static bool up_connect(void)
+{
+   char info[128] = { 0 };
+
+   /* Between clients the server has nothing to say: readable means it hung up */
+   if (up.fd >= 0) {
+      struct pollfd p = { .fd = up.fd, .events = POLLIN };
+      if (poll(&p, 1, 0) == 0)
+         return true;
+      fprintf(stderr, "Server %s:%s closed the connection, reconnecting\n", up.host, up.port);
+      up_close();
+   }
+   up.fd = xvc_connect(up.host, up.port);
+   if (up.fd < 0)
+      return false;
+   if (!swrite(up.fd, "getinfo:", 8)) {
+      up_close();
+      return false;
+   }
+   for (size_t i = 0; i < sizeof(info) - 1; i++)
+      if (xvc_read(up.fd, &info[i], 1) != 1 || info[i] == '\n')
+         break;
+   if (sscanf(info, "xvcServer_v1.0:%d", &up.vector_size) != 1 || up.vector_size < 2) {
+      fprintf(stderr, "Unexpected getinfo reply from %s:%s: %s\n", up.host, up.port, info);
+      up_close();
+      return false;
+   }
+   if (up.vector_size > 2 * MAX_VECTOR_BYTES)
+      up.vector_size = 2 * MAX_VECTOR_BYTES;
+   up.wshift = !stock && xvc_has_extension(info, "wshift");
+   up.zshift = !stock && xvc_has_extension(info, "zshift");
+   printf("Server %s:%s: %d-byte vectors%s%s\n", up.host, up.port, up.vector_size,
+          up.zshift ? ", zshift" : "", up.wshift ? ", wshift" : "");
+   if (write_behind && !up.wshift && !up.zshift)
+      fprintf(stderr, "Server offers no write-only shifts, -w has no effect\n");
+   return true;
+}
+
+/* Send the queued write-only shifts as one */
+static bool up_flush(void)
+{
+   uint8_t msg[16 + RLE_MAX_PACKED(2 * MAX_VECTOR_BYTES)];
+   uint32_t len = pending.bits;
+   size_t nr_bytes = (len + 7) / 8, n;
+
+   if (!pending.bits)
+      return true;
+   if (up.zshift) {
+      uint8_t vectors[2 * MAX_VECTOR_BYTES];
+      memcpy(vectors, pending.tms, nr_bytes);
+      memcpy(vectors + nr_bytes, pending.tdi, nr_bytes);
+      uint32_t size = rle_pack(vectors, 2 * nr_bytes, msg + 16);
+      memcpy(msg, "zshift:", 7);
+      msg[7] = ZSHIFT_NO_TDO;
+      memcpy(msg + 8, &len, 4);
+      memcpy(msg + 12, &size, 4);
+      n = 16 + size;
+   } else {
+      memcpy(msg, "wshift:", 7);
+      memcpy(msg + 7, &len, 4);
+      memcpy(msg + 11, pending.tms, nr_bytes);
+      memcpy(msg + 11 + nr_bytes, pending.tdi, nr_bytes);
+      n = 11 + 2 * nr_bytes;
+   }
+   memset(pending.tms, 0, nr_bytes);
+   memset(pending.tdi, 0, nr_bytes);
+   pending.bits = 0;
+   stats.sent += n;
+   return swrite(up.fd, msg, n);
+}
+
+static bool up_write_only(int bits, const uint8_t *tms, const uint8_t *tdi)
+{
+   if (pending.bits + bits > up.vector_size / 2 * 8 && !up_flush())
+      return false;
+   append_bits(pending.tms, pending.bits, tms, bits);
+   append_bits(pending.tdi, pending.bits, tdi, bits);
+   pending.bits += bits;
+   return true;
+}
+
+/* A shift whose TDO the client needs: one round trip */
+static bool up_shift(int bits, const uint8_t *vectors, uint8_t *tdo)
+{
+   uint8_t msg[16 + RLE_MAX_PACKED(2 * MAX_VECTOR_BYTES)];
+   uint32_t len = bits, size;
+   size_t nr_bytes = (bits + 7) / 8, n;
+
+   if (!up_flush())
+      return false;
+   if (up.zshift) {
+      size = rle_pack(vectors, 2 * nr_bytes, msg + 16);
+      memcpy(msg, "zshift:", 7);
+      msg[7] = ZSHIFT_PACK_TDO;
+      memcpy(msg + 8, &len, 4);
+      memcpy(msg + 12, &size, 4);
+      n = 16 + size;
+   } else {
+      memcpy(msg, "shift:", 6);
+      memcpy(msg + 6, &len, 4);
+      memcpy(msg + 10, vectors, 2 * nr_bytes);
+      n = 10 + 2 * nr_bytes;
+   }
+   stats.sent += n;
+   stats.round_trips++;
+   if (!swrite(up.fd, msg, n))
+      return false;
+   if (!up.zshift) {
+      stats.received += nr_bytes;
+      return xvc_read(up.fd, tdo, nr_bytes) == 1;
+   }
+   if (xvc_read(up.fd, &size, 4) != 1 || size > sizeof(msg) || xvc_read(up.fd, msg, size) != 1)
+      return false;
+   stats.received += 4 + size;
+   return rle_unpack(msg, size, tdo, nr_bytes) == (ssize_t)nr_bytes;
+}
+
+static bool up_settck(uint32_t period, uint32_t *actual)
+{
+   uint8_t msg[11];
+
+   memcpy(msg, "settck:", 7);
+   memcpy(msg + 7, &period, 4);
+   stats.sent += sizeof(msg);
+   stats.round_trips++;
+   stats.received += 4;
+   return up_flush() && swrite(up.fd, msg, sizeof(msg)) && xvc_read(up.fd, actual, 4) == 1;
+}
+
+/* Whether no TDO bit of a shift can matter, from the tracked TAP */
+static bool dont_care(int bits, const uint8_t *tms)
+{
+   int state = tap.state;
+
+   if (!write_behind || (!up.wshift && !up.zshift) || state < 0)
+      return false;
+   for (int i = 0; i < bits; i++) {
+      if (state == TAP_IRSHIFT)
+         return false;
+      if (state == TAP_DRSHIFT && !(tap.ir_valid && tap.ir == cfg_ir))
+         return false;
+      state = tap_next[state][bit_at(tms, i)];
+   }
+   return true;
+}
+
+static void tap_follow(int bits, const uint8_t *tms, const uint8_t *tdi)
+{
+   for (int i = 0; i < bits; i++) {
+      int m = bit_at(tms, i);
+      tap.ones = m ? tap.ones + 1 : 0;
+      if (tap.state < 0) {
+         if (tap.ones >= 5)
+            tap.state = TAP_RESET;
+         continue;
+      }
+      if (tap.state == TAP_IRCAPTURE)
+         tap.ir_bits = 0;
+      if (tap.state == TAP_IRSHIFT) {
+         tap.ir_shift = (tap.ir_shift >> 1) | (uint64_t)bit_at(tdi, i) << (cfg_ir_len - 1);
+         tap.ir_bits++;
+      }
+      tap.state = tap_next[tap.state][m];
+      if (tap.state == TAP_IRUPDATE) {
+         tap.ir = tap.ir_shift;
+         tap.ir_valid = tap.ir_bits >= cfg_ir_len;
+      } else if (tap.state == TAP_RESET) {
+         tap.ir_valid = false;
+      }
+   }
+}
+
+/* Whether the client sends more within ms */
+static bool client_busy(int fd, int ms)
+{
+   struct pollfd p = { .fd = fd, .events = POLLIN };
+   return poll(&p, 1, ms) != 0;
+}
+
+static void serve(int fd)
+{
+   unsigned char cmd[16], buffer[2 * MAX_VECTOR_BYTES], result[MAX_VECTOR_BYTES];
+
+   tap.state = -1;
+   tap.ones = 0;
+   tap.ir_valid = false;
+   memset(&stats, 0, sizeof(stats));
+
+   for (;;) {
+      if (pending.bits && !client_busy(fd, FLUSH_IDLE_MS) && !up_flush())
+         goto upstream;
+      if (xvc_read(fd, cmd, 2) != 1)
+         break;
+
+      if (memcmp(cmd, "ge", 2) == 0) {
+         char info[64];
+         if (xvc_read(fd, cmd, 6) != 1)
+            break;
+         int n = snprintf(info, sizeof(info), "xvcServer_v1.0:%d\n", up.vector_size);
+         if (!swrite(fd, info, n))
+            break;
+         if (verbose)
+            printf("getinfo: %s", info);
+         continue;
+      }
+      if (memcmp(cmd, "se", 2) == 0) {
+         uint32_t period, actual;
+         if (xvc_read(fd, cmd, 5) != 1 || xvc_read(fd, &period, 4) != 1)
+            break;
+         if (!up_settck(period, &actual))
+            goto upstream;
+         if (!swrite(fd, &actual, 4))
+            break;
+         if (verbose)
+            printf("settck: %u ns, got %u ns\n", period, actual);
+         continue;
+      }
+      if (memcmp(cmd, "sh", 2) != 0) {
+         fprintf(stderr, "invalid cmd '%.2s'\n", cmd);
+         break;
+      }
+
+      uint32_t len;
+      if (xvc_read(fd, cmd, 4) != 1 || xvc_read(fd, &len, 4) != 1)
+         break;
+      size_t nr_bytes = ((size_t)len + 7) / 8;
+      if (nr_bytes * 2 > (size_t)up.vector_size) {
+         fprintf(stderr, "buffer size exceeded\n");
+         break;
+      }
+      if (xvc_read(fd, buffer, nr_bytes * 2) != 1)
+         break;
+      stats.shifts++;
+
+      if (dont_care(len, buffer)) {
+         tap_follow(len, buffer, buffer + nr_bytes);
+         memset(result, 0, nr_bytes);
+         if (!swrite(fd, result, nr_bytes))
+            break;
+         stats.local++;
+         if (!up_write_only(len, buffer, buffer + nr_bytes))
+            goto upstream;
+      } else {
+         tap_follow(len, buffer, buffer + nr_bytes);
+         if (!up_shift(len, buffer, result))
+            goto upstream;
+         if (!swrite(fd, result, nr_bytes))
+            break;
+      }
+   }
+
+   if (!up_flush())
+      goto upstream;
+   printf("Client done: %llu shifts, %llu answered locally, %llu round trips, "
+          "%llu bytes sent, %llu received\n",
+          (unsigned long long)stats.shifts, (unsigned long long)stats.local,
+          (unsigned long long)stats.round_trips, (unsigned long long)stats.sent,
+          (unsigned long long)stats.received);
+   return;
+
+upstream:
+   fprintf(stderr, "Connection to %s:%s lost\n", up.host, up.port);
+   up_close();
+}
+
+static int listen_on(int port)
+{
+   struct sockaddr_in address = { 0 };
+   int fd = socket(AF_INET, SOCK_STREAM, 0);
+   int one = 1;
+
+   if (fd < 0) {
+      perror("socket");
+      return -1;
+   }
+   setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+   address.sin_family = AF_INET;
+   address.sin_addr.s_addr = INADDR_ANY;
+   address.sin_port = htons(port);
+   if (bind(fd, (struct sockaddr *)&address, sizeof(address)) < 0) {
+      perror("bind");
+      close(fd);
+      return -1;
+   }
+   if (listen(fd, 1) < 0) {
+      perror("listen");
+      close(fd);
+      return -1;
+   }
+   return fd;
+}
+
+int main(int argc, char **argv)
+{
+   int port = 2542;
+   int c;
+
+   while ((c = getopt(argc, argv, "vswi:l:h:p:")) != -1) {
+      switch (c) {
+      case 'v':
+         verbose = 1;
+         break;
+      case 's':
+         stock = true;
+         break;
+      case 'w':
+         write_behind = true;
+         break;
+      case 'i': {
+         char *end;
+         cfg_ir = strtoull(optarg, &end, 0);
+         if (*end == '/')
+            cfg_ir_len = atoi(end + 1);
+         if ((*end && *end != '/') || cfg_ir_len < 1 || cfg_ir_len > 64) {
+            fprintf(stderr, "-i expects ir[/length]\n");
+            return 1;
+         }
+         break;
+      }
+      case 'l':
+         port = atoi(optarg);
+         break;
+      case 'h':
+         up.host = optarg;
+         break;
+      case 'p':
+         up.port = optarg;
+         break;
+      default:
+         fprintf(stderr, "usage: %s [-v] [-s] [-w [-i ir/length]] [-l port] [-h host] [-p port]\n", *argv);
+         fprintf(stderr, "  -l port     : port Vivado connects to (default: 2542)\n");
+         fprintf(stderr, "  -h host     : xvcpi server (default: 127.0.0.1)\n");
+         fprintf(stderr, "  -p port     : its port (default: 2542)\n");
+         fprintf(stderr, "  -w          : answer shifts whose TDO cannot matter locally and stream them\n");
+         fprintf(stderr, "  -i ir/len   : with -w, write-only IR of the chain (default: 0x05/6, CFG_IN)\n");
+         fprintf(stderr, "  -s          : stock XVC 1.0 to the server too, as a baseline\n");
+         fprintf(stderr, "  -v          : verbose output\n");
+         return 1;
+      }
+   }
+   if (cfg_ir_len < 64)
+      cfg_ir &= (1ull << cfg_ir_len) - 1;
+
+   setvbuf(stdout, NULL, _IOLBF, 0);
+   signal(SIGPIPE, SIG_IGN);
+   if (!up_connect())
+      return 1;
+   int s = listen_on(port);
+   if (s < 0)
+      return 1;
+   printf("Listening on port %d\n", port);
+
+   for (;;) {
+      int fd = accept(s, NULL, NULL);
+      if (fd < 0) {
+         if (errno == EINTR)
+            continue;
+         perror("accept");
+         return 1;
+      }
+      if (!up_connect()) {
+         close(fd);
+         continue;
+      }
+      int flag = 1;
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+      serve(fd);
+      close(fd);
+   }
+}
+
+/*
+ * This work, "xvc_proxy.c", is part of "xvcpi.c"
+ * Updated for modern Raspberry Pi systems using libgpiod
+ *
+ * Original "xvcpi.c" is licensed under CC0 1.0 Universal
+ * by Derek Mulcahy.
+ */
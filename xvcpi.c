@@ -5,7 +5,11 @@
  * See Licensing information at End of File.
  */
 
+#define _GNU_SOURCE
 #include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -15,10 +19,25 @@
 #include <netinet/tcp.h>
 #include <netinet/in.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <sys/wait.h>
 #include <signal.h>
+#include <limits.h>
 #include <time.h>
-#include <gpiod.h>
 #include <errno.h>
+#include <stdarg.h>
+#include "jtag.h"
+#include "svf.h"
+#include "bitstream.h"
+#include "vec.h"
+#include "rle.h"
+#include "vcd.h"
+#include "rbb.h"
+#include "xvc_proto.h"
+
+int verbose = 0;
 
 /* GPIO numbers for each signal. Negative values are invalid */
 static int tck_gpio = 11;
@@ -30,320 +49,2584 @@ static int tdo_gpio = 9;
 // static int tdi_gpio = 19;
 // static int tdo_gpio = 26;
 
-static int verbose = 0;
 static int port = 2542;  // Default port number
 
-/* GPIO chip and line handles */
-static struct gpiod_chip *chip = NULL;
-static struct gpiod_line *tck_line = NULL;
-static struct gpiod_line *tms_line = NULL;
-static struct gpiod_line *tdi_line = NULL;
-static struct gpiod_line *tdo_line = NULL;
+/* -B: OpenOCD remote_bitbang port of the first chain (rbb.h), 0: none */
+static int rbb_port = 0;
 
-/* Transition delay coefficients */
-#define JTAG_DELAY (40)
-static unsigned int jtag_delay = JTAG_DELAY;
+/* Gang mode: TDO pins of further boards sharing TCK/TMS/TDI */
+static int gang_gpio[MAX_GANG];
+static int ngang_gpio = 0;
 
-static int bcm2835gpio_read(void)
+/* GPIO backend for chains that do not name one; NULL means autoselect */
+static const char *gpio_backend = NULL;
+
+/* -x: the protocol extensions of xvc_proto.h, offered in getinfo */
+static bool xvc_extensions = false;
+
+/*
+ * -S: largest shift message (TMS and TDI) offered in getinfo.  XVC 1.0
+ * servers offer 2048; more saves round trips for clients that use it.
+ * The limit keeps every shift within one vector file record.
+ */
+#define XVC_MAX_VECTOR     (2 * VEC_MAX_BITS / 8)
+static int vector_size = 2048;
+
+/* Shift statistics, per connection and per chain */
+struct session_stats {
+   uint64_t bits;
+   uint64_t shifts;
+   uint64_t shift_ns;
+};
+
+/*
+ * Automatic TCK tuning.
+ *
+ * With the chain in a known state we read the IDCODEs and shift random
+ * patterns through the BYPASS registers of every device, first at the
+ * configured delay (the reference) and then at shorter delays.  The
+ * shortest delay that passes every iteration, plus a margin on the bit
+ * period, becomes the floor for the client's settck requests.
+ */
+#define AUTOTUNE_ITERATIONS (16)
+#define AUTOTUNE_MARGIN_PCT (25)
+#define MAX_CHAIN_DEVICES   (32)
+#define BYPASS_WORDS        (10)   /* 32 flush bits + 256 pattern + 32 tail */
+
+/* Result of auto-tuning one chain */
+struct tune {
+   bool valid;
+   uint64_t min_delay_ps;      /* tuned delay floor */
+   uint64_t overhead_ps;       /* per-bit cost of the pin accesses */
+   int ndev;
+   uint32_t idcode[MAX_CHAIN_DEVICES];
+};
+
+/*
+ * Arbitration: XVC assumes one client, so a chain has one owner at a
+ * time and shifts of other connections never reach its TAP.  Later
+ * connections wait in the chain's queue for -q seconds (0: rejected at
+ * once) and the first one takes over when the owner leaves.  An owner
+ * silent for -T seconds is dropped, and TCP keepalive (-A seconds)
+ * finds owners whose host or network went away.
+ */
+#define CHAIN_QUEUE        (8)
+#define KEEPALIVE_PROBES   (3)     /* one second apart */
+static int queue_wait_s = 10;
+static int idle_timeout_s = 0;
+static int keepalive_s = 5;
+
+/*
+ * One JTAG chain: its pins, TCP port and engine thread.  Chains come
+ * from the -f config file, or from the command line as a single chain.
+ * Each is served by its own thread, optionally pinned to a core, and
+ * shares nothing with the others on the shift path.
+ */
+#define MAX_CHAINS (16)
+#define TRACE_HISTORY (4)      /* longest repeating pattern of -t lines folded */
+
+struct chain {
+   char name[32];
+   struct jtag_pins pins;
+   int port;
+   int rbb_port;               /* remote_bitbang, 0: none */
+   int cpu;                    /* core for the engine thread, -1: any */
+   const char *backend;        /* NULL: autoselect */
+   unsigned int delay;         /* -d loops */
+   struct jtag_gpio gpio;
+   struct tune tune;
+   struct session_stats total;
+   unsigned int connections;
+   int listen_fd;
+   int rbb_fd;
+   int clients;
+   unsigned int autotune_seen;
+   pthread_t thread;
+   struct vec_writer *record;  /* -R: sessions are recorded here */
+   int record_state;           /* TAP state while recording */
+   unsigned int record_shifts;
+   bool trace_on;              /* -t: scans are decoded and logged */
+   struct tap_trace trace;
+   int ir_len[MAX_CHAIN_DEVICES];  /* per device from TDO, none: one device */
+   int nir_len;
+   const char *dr_name;        /* instruction of the DR scans, for the log */
+   char trace_hist[TRACE_HISTORY][80];
+   unsigned int trace_lines;
+   int trace_period;           /* last lines repeating, 0: none */
+   unsigned int trace_repeats;
+   unsigned int vcd_seen;      /* SIGHUPs handled */
+   int owner;                  /* connection using the chain, -1: none */
+   uint64_t owner_seen_ns;     /* its last command */
+   int queue[CHAIN_QUEUE];     /* connections waiting for the chain */
+   uint64_t queue_until[CHAIN_QUEUE];
+   int nqueue;
+   pthread_mutex_t ctl_lock;   /* -U requests for the engine thread */
+   pthread_cond_t ctl_done;
+   struct control_req *ctl_head;
+   bool parked;                /* held still for "upgrade" */
+   uint64_t handover_ps;       /* delay handed over by "upgrade", 0: none */
+};
+
+static struct chain chains[MAX_CHAINS];
+static int nchains;
+
+static void print_stats(const struct chain *ch, const char *what,
+                        const struct session_stats *st)
+{
+   double tck_khz = st->shift_ns ? st->bits * 1e6 / st->shift_ns : 0;
+   char temp[24] = "";
+
+   /* -1: no thermal zone to read */
+   if (timing.temp_mc != -1)
+      snprintf(temp, sizeof(temp), "%.1f C, ", timing.temp_mc / 1000.0);
+   printf("%s %s: %llu shifts, %llu bits, effective TCK %.1f kHz, "
+          "CPU %u kHz, %s%u rescales, %u recalibrations\n",
+          ch->name, what, (unsigned long long)st->shifts,
+          (unsigned long long)st->bits, tck_khz,
+          __atomic_load_n(&timing.cur_khz, __ATOMIC_RELAXED),
+          temp, timing.rescales, timing.recalibrations);
+}
+
+/* Clients over all chains, for the performance governor */
+static int active_clients;
+static pthread_mutex_t clients_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void client_count(int delta)
 {
-   int val = gpiod_line_get_value(tdo_line);
-   return val < 0 ? 0 : val;
+   pthread_mutex_lock(&clients_lock);
+   active_clients += delta;
+   if (delta > 0 && active_clients == delta)
+      governor_performance(true);
+   else if (delta < 0 && active_clients == 0)
+      governor_performance(false);
+   pthread_mutex_unlock(&clients_lock);
 }
 
-static void bcm2835gpio_write(int tck, int tms, int tdi)
+/* -t and -I: decoded scans, IR lengths of the devices from TDO */
+static bool trace_scans = false;
+static int ir_lengths[MAX_CHAIN_DEVICES];
+static int nir_lengths = 0;
+
+/*
+ * -V and -W: waveform of the chain's shifts, all of them or the last
+ * kbits before a failed -P/-X or a SIGHUP
+ */
+static const char *vcd_file = NULL;
+static uint64_t vcd_ring_kbits = 0;
+
+static bool autotune_startup = false;
+static int autotune_iterations = AUTOTUNE_ITERATIONS;
+
+/* Shift n bits from word buffers, leaving Shift-xR on the last bit if exit */
+static void tap_shift(struct jtag_gpio *g, int n, const uint32_t *tdi,
+                      uint32_t *tdo, bool exit)
 {
-   gpiod_line_set_value(tck_line, tck);
-   gpiod_line_set_value(tms_line, tms);
-   gpiod_line_set_value(tdi_line, tdi);
+   for (int i = 0; n > 0; i++, n -= 32) {
+      int bits = n < 32 ? n : 32;
+      uint32_t tms = (exit && n <= 32) ? 1u << (bits - 1) : 0;
+      tdo[i] = gpio_xfer(g, bits, tms, tdi[i]);
+   }
+}
 
-   for (unsigned int i = 0; i < jtag_delay; i++)
-      asm volatile ("");
+static inline int get_bit(const uint32_t *buf, int i)
+{
+   return (buf[i / 32] >> (i % 32)) & 1;
 }
 
-static uint32_t bcm2835gpio_xfer(int n, uint32_t tms, uint32_t tdi)
+/* Test-Logic-Reset, then Run-Test/Idle */
+static void tap_reset(struct jtag_gpio *g)
 {
-   uint32_t tdo = 0;
+   gpio_xfer(g, 6, 0x1f, 0);
+}
 
-   for (int i = 0; i < n; i++) {
-      bcm2835gpio_write(0, tms & 1, tdi & 1);
-      bcm2835gpio_write(1, tms & 1, tdi & 1);
-      tdo |= bcm2835gpio_read() << i;
-      tms >>= 1;
-      tdi >>= 1;
+/* Read the chain's IDCODEs; devices without one report 0 */
+static int chain_scan(struct jtag_gpio *g, uint32_t *idcode)
+{
+   uint32_t tdi[MAX_CHAIN_DEVICES + 1], tdo[MAX_CHAIN_DEVICES + 1];
+   const int total = (MAX_CHAIN_DEVICES + 1) * 32;
+   int ndev = 0, pos = 0;
+
+   memset(tdi, 0xff, sizeof(tdi));
+   tap_reset(g);
+   gpio_xfer(g, 3, 0x1, 0);            /* RTI -> Shift-DR */
+   tap_shift(g, total, tdi, tdo, true);
+   gpio_xfer(g, 2, 0x1, 0);            /* Exit1-DR -> RTI */
+
+   while (pos + 32 <= total && ndev < MAX_CHAIN_DEVICES) {
+      if (get_bit(tdo, pos)) {
+         uint32_t id = 0;
+         for (int b = 0; b < 32; b++)
+            id |= (uint32_t)get_bit(tdo, pos + b) << b;
+         if (id == 0xffffffff)
+            return ndev;
+         idcode[ndev++] = id;
+         pos += 32;
+      } else {
+         idcode[ndev++] = 0;
+         pos += 1;
+      }
    }
-   return tdo;
+   return -1;                          /* no end marker: chain broken */
 }
 
-static bool bcm2835gpio_init(void)
+static uint32_t xorshift32(uint32_t *state)
 {
-   // Open GPIO chip
-   chip = gpiod_chip_open_by_name("gpiochip0");
-   if (!chip) {
-      perror("Failed to open GPIO chip");
+   uint32_t x = *state;
+   x ^= x << 13;
+   x ^= x >> 17;
+   x ^= x << 5;
+   return *state = x;
+}
+
+/* Shift a random pattern through all BYPASS registers; returns ps/bit or 0 */
+static uint64_t bypass_test(struct jtag_gpio *g, int ndev, uint32_t *seed)
+{
+   uint32_t tdi[BYPASS_WORDS], tdo[BYPASS_WORDS];
+   const int bits = BYPASS_WORDS * 32;
+   uint32_t ones[MAX_CHAIN_DEVICES + 1];
+
+   /* All-ones instruction selects BYPASS in every device */
+   memset(ones, 0xff, sizeof(ones));
+   tap_reset(g);
+   gpio_xfer(g, 4, 0x3, 0);            /* RTI -> Shift-IR */
+   tap_shift(g, (MAX_CHAIN_DEVICES + 1) * 32, ones, ones, true);
+   gpio_xfer(g, 2, 0x1, 0);            /* Exit1-IR -> RTI */
+
+   tdi[0] = 0;
+   for (int i = 1; i < BYPASS_WORDS - 1; i++)
+      tdi[i] = xorshift32(seed);
+   tdi[BYPASS_WORDS - 1] = 0;
+
+   gpio_xfer(g, 3, 0x1, 0);            /* RTI -> Shift-DR */
+   uint64_t t0 = now_ns();
+   tap_shift(g, bits, tdi, tdo, true);
+   uint64_t t = now_ns() - t0;
+   gpio_xfer(g, 2, 0x1, 0);
+
+   for (int i = 32; i + ndev < bits; i++)
+      if (get_bit(tdo, i + ndev) != get_bit(tdi, i))
+         return 0;
+   return t * 1000 / bits;
+}
+
+/* Run the checks at the current delay; returns ps/bit, 0 on any error */
+static uint64_t autotune_check(struct chain *ch, uint32_t *seed)
+{
+   uint32_t idcode[MAX_CHAIN_DEVICES];
+   uint64_t bit_ps = UINT64_MAX;
+
+   for (int it = 0; it < autotune_iterations; it++) {
+      int ndev = chain_scan(&ch->gpio, idcode);
+      if (ndev != ch->tune.ndev ||
+          memcmp(idcode, ch->tune.idcode, ndev * sizeof(idcode[0])))
+         return 0;
+      uint64_t ps = bypass_test(&ch->gpio, ndev, seed);
+      if (!ps)
+         return 0;
+      if (ps < bit_ps)
+         bit_ps = ps;
+   }
+   return bit_ps;
+}
+
+static bool autotune(struct chain *ch)
+{
+   struct tune *tune = &ch->tune;
+   struct jtag_delay *delay = &ch->gpio.delay;
+   uint32_t seed = 0x1234567;
+   uint64_t ref_ps = delay->ps;
+   uint64_t pass_ps, fail_ps = 0, bit_ps;
+   bool have_fail = false;
+
+   tune->valid = false;
+   tune->ndev = chain_scan(&ch->gpio, tune->idcode);
+   if (tune->ndev <= 0) {
+      fprintf(stderr, "%s: Auto-tune: no JTAG chain found\n", ch->name);
+      return false;
+   }
+   for (int i = 0; i < tune->ndev; i++)
+      printf("%s: Auto-tune: device %d IDCODE 0x%08x\n", ch->name, i,
+             tune->idcode[i]);
+
+   bit_ps = autotune_check(ch, &seed);
+   if (!bit_ps) {
+      fprintf(stderr, "%s: Auto-tune: chain unreliable at the configured delay\n",
+              ch->name);
       return false;
    }
+   pass_ps = ref_ps;
+   tune->overhead_ps = bit_ps > 2 * ref_ps ? bit_ps - 2 * ref_ps : 0;
+
+   /* Halve the delay until a check fails, then bisect the last step */
+   while (pass_ps > 0) {
+      uint64_t try_ps = pass_ps / 2 < 1000 ? 0 : pass_ps / 2;
+      delay_set_ps(delay, try_ps);
+      if (!(bit_ps = autotune_check(ch, &seed))) {
+         fail_ps = try_ps;
+         have_fail = true;
+         break;
+      }
+      pass_ps = try_ps;
+      tune->overhead_ps = bit_ps > 2 * try_ps ? bit_ps - 2 * try_ps : 0;
+   }
+   for (int step = 0; have_fail && step < 4 && pass_ps - fail_ps > 1000; step++) {
+      uint64_t try_ps = (pass_ps + fail_ps) / 2;
+      delay_set_ps(delay, try_ps);
+      if (autotune_check(ch, &seed))
+         pass_ps = try_ps;
+      else
+         fail_ps = try_ps;
+   }
 
+   /* Apply the margin to the whole bit period, not just the delay */
+   uint64_t period_ps = (tune->overhead_ps + 2 * pass_ps) *
+                        (100 + AUTOTUNE_MARGIN_PCT) / 100;
+   tune->min_delay_ps = period_ps > tune->overhead_ps ?
+                        (period_ps - tune->overhead_ps) / 2 : 0;
+   delay_set_ps(delay, tune->min_delay_ps);
+   tap_reset(&ch->gpio);
+   tune->valid = true;
+
+   printf("%s: Auto-tune: %d device(s), fastest passing delay %llu ps, "
+          "using %llu ps (TCK ~%llu kHz)\n", ch->name, tune->ndev,
+          (unsigned long long)pass_ps, (unsigned long long)tune->min_delay_ps,
+          (unsigned long long)(1000000000ULL /
+                               (tune->overhead_ps + 2 * tune->min_delay_ps + 1)));
+   return true;
+}
+
+/*
+ * Honour a client's settck within the tuned limit; returns the period
+ * actually used.  Without tuning the requested period is echoed back.
+ */
+static uint32_t settck(struct chain *ch, uint32_t period_ns)
+{
+   const struct tune *tune = &ch->tune;
+
+   if (!tune->valid)
+      return period_ns;
+
+   uint64_t period_ps = (uint64_t)period_ns * 1000;
+   uint64_t delay_ps = period_ps > tune->overhead_ps ?
+                       (period_ps - tune->overhead_ps) / 2 : 0;
+   if (delay_ps < tune->min_delay_ps)
+      delay_ps = tune->min_delay_ps;
+   delay_set_ps(&ch->gpio.delay, delay_ps);
+   return (tune->overhead_ps + 2 * delay_ps + 999) / 1000;
+}
+
+static volatile sig_atomic_t running = 1;
+static volatile sig_atomic_t autotune_requested = 0;  /* count of SIGUSR1 */
+static volatile sig_atomic_t vcd_requested = 0;       /* count of SIGHUP */
+
+/* SIGUSR2 only interrupts an engine thread's blocking read or select() */
+static void signal_handler(int sig)
+{
+   if (sig == SIGUSR2)
+      return;
+   if (sig == SIGUSR1) {
+      autotune_requested++;
+      return;
+   }
+   if (sig == SIGHUP) {
+      vcd_requested++;
+      return;
+   }
+   running = 0;
    if (verbose) {
-      printf("GPIO chip opened successfully\n");
+      printf("\nReceived signal %d, shutting down...\n", sig);
    }
+}
 
-   // Get GPIO lines
-   tck_line = gpiod_chip_get_line(chip, tck_gpio);
-   tms_line = gpiod_chip_get_line(chip, tms_gpio);
-   tdi_line = gpiod_chip_get_line(chip, tdi_gpio);
-   tdo_line = gpiod_chip_get_line(chip, tdo_gpio);
+static int sread(int fd, void *target, int len) {
+   unsigned char *t = target;
+   while (len) {
+      int r = read(fd, t, len);
+      if (r <= 0) {
+         if (r == 0) {
+            // Connection closed by client
+            return 0;
+         }
+         if (errno == EINTR) {
+            // Interrupted by signal, check if we should continue
+            if (!running) {
+               return -1;  // Signal to exit
+            }
+            continue;  // Retry the read
+         }
+         // Other error (reset, keepalive or -T timeout): the client is gone
+         if (verbose)
+            perror("read");
+         return 0;
+      }
+      t += r;
+      len -= r;
+   }
+   return 1;
+}
 
-   if (!tck_line || !tms_line || !tdi_line || !tdo_line) {
-      perror("Failed to get GPIO lines");
-      return false;
+/*
+ * The start of a command: as sread(), but -2 when a signal comes before
+ * any of it, so that the engine loop polls the control mailbox (SIGUSR2)
+ * instead of waiting on for the client.
+ */
+static int sread_cmd(int fd, void *target, int len)
+{
+   int r = read(fd, target, len);
+
+   if (r < 0 && errno == EINTR)
+      return running ? -2 : -1;
+   if (r <= 0) {
+      if (r < 0 && verbose)
+         perror("read");
+      return 0;
    }
+   return r == len ? 1 : sread(fd, (unsigned char *)target + r, len - r);
+}
 
-   // Configure TDO as input
-   if (gpiod_line_request_input(tdo_line, "xvcpi-tdo") < 0) {
-      perror("Failed to configure TDO as input");
-      return false;
+static struct session_stats stats[FD_SETSIZE];
+
+/* A remote_bitbang connection; XVC connections have none */
+struct rbb_client {
+   struct rbb rbb;
+   struct chain *ch;
+   struct session_stats *st;
+};
+
+static struct rbb_client *rbb_clients[FD_SETSIZE];
+
+/*
+ * -R: append a shift to the recording.  TDO is expected back as it was
+ * seen, but only for bits clocked in Shift-DR/IR; elsewhere it is not
+ * driven.  Write-only shifts (tdo NULL) are recorded without a check.
+ * The TAP is followed from Test-Logic-Reset, where XVC clients start.
+ */
+static void record_shift(struct chain *ch, int bits, const uint8_t *tms,
+                         const uint8_t *tdi, const uint8_t *tdo)
+{
+   uint8_t exp[VEC_MAX_BITS / 8], mask[VEC_MAX_BITS / 8];
+   const size_t nr_bytes = (bits + 7) / 8;
+   struct vec_mark mark = { 0, ++ch->record_shifts, 0 };
+   int state = ch->record_state;
+
+   if (!bits)
+      return;                  /* nothing clocked, nothing to replay */
+   memset(mask, 0, nr_bytes);
+   for (int i = 0; i < bits; i++) {
+      if (state == TAP_DRSHIFT || state == TAP_IRSHIFT)
+         mask[i / 8] |= 1 << (i % 8);
+      state = tap_next[state][(tms[i / 8] >> (i % 8)) & 1];
+   }
+   ch->record_state = state;
+   if (tdo) {
+      for (size_t i = 0; i < nr_bytes; i++)
+         exp[i] = tdo[i] & mask[i];
    }
+   if (!vec_write_shift(ch->record, bits, tdo ? VEC_COMPARE : 0, 0, &mark, 1,
+                        tms, tdi, tdo ? exp : NULL, tdo ? mask : NULL)) {
+      fprintf(stderr, "%s: recording failed, stopped\n", ch->name);
+      vec_writer_close(ch->record, true);
+      ch->record = NULL;
+   }
+}
 
-   // Configure TDI, TCK, TMS as outputs
-   if (gpiod_line_request_output(tdi_line, "xvcpi-tdi", 0) < 0) {
-      perror("Failed to configure TDI as output");
-      return false;
+/*
+ * -t: one line per scan, from the TAP tracker.  Polling repeats the
+ * same few scans many times a second, so when the last lines start to
+ * repeat as a group they are counted instead, until the pattern breaks.
+ */
+static void trace_flush(struct chain *ch)
+{
+   if (ch->trace_repeats)
+      printf("%s: last %d line%s repeated, %u lines\n", ch->name, ch->trace_period,
+             ch->trace_period > 1 ? "s" : "", ch->trace_repeats);
+   ch->trace_period = 0;
+   ch->trace_repeats = 0;
+}
+
+static void trace_line(struct chain *ch, const char *line)
+{
+   unsigned int n = ch->trace_lines;
+
+   if (ch->trace_period) {
+      if (strcmp(line, ch->trace_hist[(n - ch->trace_period) % TRACE_HISTORY]) == 0) {
+         ch->trace_repeats++;
+         goto keep;
+      }
+      trace_flush(ch);
+   } else {
+      for (int p = 1; p <= TRACE_HISTORY && (unsigned int)p <= n; p++) {
+         if (strcmp(line, ch->trace_hist[(n - p) % TRACE_HISTORY]) == 0) {
+            ch->trace_period = p;
+            ch->trace_repeats = 1;
+            goto keep;
+         }
+      }
    }
+   printf("%s: %s\n", ch->name, line);
+keep:
+   snprintf(ch->trace_hist[n % TRACE_HISTORY], sizeof(ch->trace_hist[0]), "%s", line);
+   ch->trace_lines++;
+}
 
-   if (gpiod_line_request_output(tck_line, "xvcpi-tck", 0) < 0) {
-      perror("Failed to configure TCK as output");
-      return false;
+static void trace_event(struct tap_trace *t, enum tap_event ev)
+{
+   struct chain *ch = t->arg;
+   char line[80];
+   int n = 0;
+
+   switch (ev) {
+   case TAP_EVENT_RESET:
+      ch->dr_name = NULL;
+      trace_line(ch, "TAP reset");
+      break;
+   case TAP_EVENT_IR: {
+      /* Split the scan over the devices, the first bits went furthest */
+      int one[1] = { t->ir_len }, total = 0, bypass = 0;
+      const int *len = ch->nir_len ? ch->ir_len : one;
+      int ndev = ch->nir_len ? ch->nir_len : 1;
+      for (int d = 0; d < ndev; d++)
+         total += len[d];
+      ch->dr_name = NULL;
+      if (total != t->ir_len || t->ir_len > 64) {
+         snprintf(line, sizeof(line), "IR %d bits", t->ir_len);
+         trace_line(ch, line);
+         break;
+      }
+      for (int d = 0, at = 0; d < ndev && n < (int)sizeof(line); at += len[d++]) {
+         uint64_t ir = (t->ir >> at) & ((2ull << (len[d] - 1)) - 1);
+         const char *name = len[d] == 6 ? tap_xilinx_ir_name(ir) : NULL;
+         if (ndev > 1 && ir == (2ull << (len[d] - 1)) - 1) {
+            bypass++;
+            continue;
+         }
+         if (!ch->dr_name)
+            ch->dr_name = name;
+         n += snprintf(line + n, sizeof(line) - n, "%sIR=0x%02llx%s%s%s on dev %d",
+                       n ? ", " : "", (unsigned long long)ir, name ? " (" : "",
+                       name ? name : "", name ? ")" : "", d);
+      }
+      if (bypass == ndev)
+         snprintf(line, sizeof(line), "IR=BYPASS on all devices");
+      else if (bypass && n < (int)sizeof(line))
+         snprintf(line + n, sizeof(line) - n, ", others BYPASS");
+      trace_line(ch, line);
+      break;
+   }
+   case TAP_EVENT_DR:
+      snprintf(line, sizeof(line), "DR %llu bits%s%s%s", (unsigned long long)t->dr_bits,
+               ch->dr_name ? " (" : "", ch->dr_name ? ch->dr_name : "", ch->dr_name ? ")" : "");
+      trace_line(ch, line);
+      break;
    }
+}
 
-   if (gpiod_line_request_output(tms_line, "xvcpi-tms", 1) < 0) {
-      perror("Failed to configure TMS as output");
-      return false;
+/* One shift of a client, timed and recorded; tdo may be NULL */
+static void client_shift(struct chain *ch, struct session_stats *st, int len,
+                         const uint8_t *tms, const uint8_t *tdi, uint8_t *tdo)
+{
+   timing_poll();
+   uint64_t t0 = now_ns();
+
+   jtag_shift(&ch->gpio, len, tms, tdi, tdo);
+
+   st->shift_ns += now_ns() - t0;
+   st->bits += len;
+   st->shifts++;
+   if (ch->record)
+      record_shift(ch, len, tms, tdi, tdo);
+   if (ch->trace_on)
+      tap_trace_shift(&ch->trace, len, tms, tdi);
+}
+
+/* SIGHUP triggers a -W capture, from the engine thread that feeds it */
+static void vcd_poll(struct chain *ch)
+{
+   if (ch->vcd_seen != (unsigned int)vcd_requested) {
+      ch->vcd_seen = vcd_requested;
+      if (ch->gpio.vcd)
+         vcd_trigger(ch->gpio.vcd, "SIGHUP");
    }
+}
+
+/*
+ * mshift: each record is shifted as soon as it is in, while the client
+ * is still sending the rest, and all TDO goes back in one write.
+ */
+static int handle_mshift(struct chain *ch, int fd, struct session_stats *st)
+{
+   unsigned char buffer[XVC_MAX_VECTOR], result[MSHIFT_MAX_TDO];
+   uint32_t count;
+   size_t total = 0;
+
+   int read_result = sread(fd, &count, 4);
+   if (read_result != 1) {
+      if (read_result == -1) return -1;
+      fprintf(stderr, "reading count failed\n");
+      return 1;
+   }
+   if (verbose)
+      printf("%u : Received command: 'mshift', %u shifts\n", (int)time(NULL), count);
+
+   for (uint32_t n = 0; n < count; n++) {
+      uint32_t len;
+      read_result = sread(fd, &len, 4);
+      if (read_result != 1) {
+         if (read_result == -1) return -1;
+         fprintf(stderr, "reading length failed\n");
+         return 1;
+      }
+      size_t nr_bytes = ((size_t)len + 7) / 8;
+      if (nr_bytes * 2 > (size_t)vector_size || total + nr_bytes > sizeof(result)) {
+         fprintf(stderr, "buffer size exceeded\n");
+         return 1;
+      }
+      read_result = sread(fd, buffer, nr_bytes * 2);
+      if (read_result != 1) {
+         if (read_result == -1) return -1;
+         fprintf(stderr, "reading data failed\n");
+         return 1;
+      }
+      client_shift(ch, st, len, buffer, buffer + nr_bytes, result + total);
+      total += nr_bytes;
+   }
+
+   if (write(fd, result, total) != (ssize_t)total) {
+      perror("write");
+      return 1;
+   }
+   return 0;
+}
+
+/*
+ * One XVC command per call, so that the engine loop gets to arbitrate,
+ * accept and poll the control mailbox between two commands of a session.
+ */
+int handle_data(struct chain *ch, int fd) {
+   char xvcInfo[64];
+   struct session_stats *st = &stats[fd];
+
+   snprintf(xvcInfo, sizeof(xvcInfo), "xvcServer_v1.0:%d%s\n", vector_size,
+            xvc_extensions ? ":wshift,zshift,mshift" : "");
+
+   // Check if we should exit due to signal
+   if (!running) {
+      return -1;
+   }
+   vcd_poll(ch);
+
+   char cmd[16];
+   unsigned char buffer[XVC_MAX_VECTOR], result[XVC_MAX_VECTOR / 2];
+   unsigned char packed[RLE_MAX_PACKED(sizeof(buffer))];
+   bool capture = true;
+   int zflags = -1;             /* zshift: flags, -1 for plain vectors */
+   memset(cmd, 0, 16);
+
+   int read_result = sread_cmd(fd, cmd, 2);
+   if (read_result != 1) {
+      if (read_result == -1) {
+         return -1;  // Signal to exit
+      }
+      if (read_result == -2)
+         return 0;   // Back to the engine loop, e.g. for a control request
+      return 1;
+   }
+
+   if (memcmp(cmd, "ge", 2) == 0) {
+      int read_result = sread(fd, cmd, 6);
+      if (read_result != 1) {
+         if (read_result == -1) return -1;
+         return 1;
+      }
+      memcpy(result, xvcInfo, strlen(xvcInfo));
+      if (write(fd, result, strlen(xvcInfo)) != (ssize_t)strlen(xvcInfo)) {
+         perror("write");
+         return 1;
+      }
+      if (verbose) {
+         printf("%u : Received command: 'getinfo'\n", (int)time(NULL));
+         printf("\t Replied with %s\n", xvcInfo);
+      }
+      return 0;
+   } else if (memcmp(cmd, "se", 2) == 0) {
+      int read_result = sread(fd, cmd, 9);
+      if (read_result != 1) {
+         if (read_result == -1) return -1;
+         return 1;
+      }
+      uint32_t period;
+      memcpy(&period, cmd + 5, 4);
+      period = settck(ch, period);
+      if (ch->record && ch->tune.valid)
+         vec_write_frequency(ch->record, 1e9 / period);
+      memcpy(result, &period, 4);
+      if (write(fd, result, 4) != 4) {
+         perror("write");
+         return 1;
+      }
+      if (verbose) {
+         printf("%u : Received command: 'settck'\n", (int)time(NULL));
+         printf("\t Replied with %u ns\n\n", period);
+      }
+      return 0;
+   } else if (memcmp(cmd, "sh", 2) == 0) {
+      int read_result = sread(fd, cmd, 4);
+      if (read_result != 1) {
+         if (read_result == -1) return -1;
+         return 1;
+      }
+      if (verbose) {
+         printf("%u : Received command: 'shift'\n", (int)time(NULL));
+      }
+   } else if (xvc_extensions && memcmp(cmd, "ws", 2) == 0) {
+      int read_result = sread(fd, cmd, 5);
+      if (read_result != 1) {
+         if (read_result == -1) return -1;
+         return 1;
+      }
+      capture = false;
+      if (verbose) {
+         printf("%u : Received command: 'wshift'\n", (int)time(NULL));
+      }
+   } else if (xvc_extensions && memcmp(cmd, "zs", 2) == 0) {
+      int read_result = sread(fd, cmd, 6);
+      if (read_result != 1) {
+         if (read_result == -1) return -1;
+         return 1;
+      }
+      zflags = (unsigned char)cmd[5];
+      if (zflags & ~(ZSHIFT_PACK_TDO | ZSHIFT_NO_TDO)) {
+         fprintf(stderr, "invalid zshift flags 0x%02x\n", zflags);
+         return 1;
+      }
+      capture = !(zflags & ZSHIFT_NO_TDO);
+      if (verbose) {
+         printf("%u : Received command: 'zshift', flags 0x%02x\n", (int)time(NULL), zflags);
+      }
+   } else if (xvc_extensions && memcmp(cmd, "ms", 2) == 0) {
+      int read_result = sread(fd, cmd, 5);
+      if (read_result != 1) {
+         if (read_result == -1) return -1;
+         return 1;
+      }
+      return handle_mshift(ch, fd, st);
+   } else {
+      fprintf(stderr, "invalid cmd '%s'\n", cmd);
+      return 1;
+   }
+
+   // For shift command, continue to read length and data
+   int len;
+   read_result = sread(fd, &len, 4);
+   if (read_result != 1) {
+      if (read_result == -1) return -1;
+      fprintf(stderr, "reading length failed\n");
+      return 1;
+   }
+
+   if (len < 0) {
+      fprintf(stderr, "invalid length %d\n", len);
+      return 1;
+   }
+   size_t nr_bytes = (len + 7) / 8;
+   if (nr_bytes * 2 > (size_t)vector_size) {
+      fprintf(stderr, "buffer size exceeded\n");
+      return 1;
+   }
+
+   if (zflags >= 0) {
+      /* Unpacked straight into the vectors handed to the engine */
+      uint32_t size;
+      read_result = sread(fd, &size, 4);
+      if (read_result == 1 && size > sizeof(packed)) {
+         fprintf(stderr, "packed size exceeded\n");
+         return 1;
+      }
+      if (read_result == 1)
+         read_result = sread(fd, packed, size);
+      if (read_result != 1) {
+         if (read_result == -1) return -1;
+         fprintf(stderr, "reading data failed\n");
+         return 1;
+      }
+      if (rle_unpack(packed, size, buffer, nr_bytes * 2) != (ssize_t)(nr_bytes * 2)) {
+         fprintf(stderr, "invalid packed data\n");
+         return 1;
+      }
+   } else {
+      read_result = sread(fd, buffer, nr_bytes * 2);
+      if (read_result != 1) {
+         if (read_result == -1) return -1;
+         fprintf(stderr, "reading data failed\n");
+         return 1;
+      }
+   }
+
+   if (verbose) {
+      printf("\tNumber of Bits  : %d\n", len);
+      printf("\tNumber of Bytes : %zu \n", nr_bytes);
+      printf("\n");
+   }
+
+   client_shift(ch, st, len, buffer, buffer + nr_bytes, capture ? result : NULL);
+   if (!capture)
+      return 0;
 
    if (verbose) {
-      printf("GPIO lines configured successfully\n");
-      printf("TMS=GPIO%d, TDI=GPIO%d, TCK=GPIO%d, TDO=GPIO%d\n", 
-             tms_gpio, tdi_gpio, tck_gpio, tdo_gpio);
+      for (size_t i = 0; i < nr_bytes; i += 4) {
+         uint32_t tms = 0, tdi = 0, tdo = 0;
+         size_t n = nr_bytes - i < 4 ? nr_bytes - i : 4;
+         memcpy(&tms, &buffer[i], n);
+         memcpy(&tdi, &buffer[i + nr_bytes], n);
+         memcpy(&tdo, &result[i], n);
+         printf("LEN : 0x%08x\n", len - (int)i * 8 < 32 ? len - (int)i * 8 : 32);
+         printf("TMS : 0x%08x\n", tms);
+         printf("TDI : 0x%08x\n", tdi);
+         printf("TDO : 0x%08x\n", tdo);
+      }
+   }
+
+   const unsigned char *reply = result;
+   size_t reply_len = nr_bytes;
+   if (zflags >= 0 && (zflags & ZSHIFT_PACK_TDO)) {
+      uint32_t size = rle_pack(result, nr_bytes, packed + 4);
+      memcpy(packed, &size, 4);
+      reply = packed;
+      reply_len = 4 + size;
+   }
+   if (write(fd, reply, reply_len) != (ssize_t)reply_len) {
+      perror("write");
+      return 1;
    }
+   return 0;
+}
+
+static void rbb_client_shift(void *arg, int bits, const uint8_t *tms,
+                             const uint8_t *tdi, uint8_t *tdo)
+{
+   struct rbb_client *c = arg;
+
+   client_shift(c->ch, c->st, bits, tms, tdi, tdo);
+}
 
-   // Initialize JTAG state
-   bcm2835gpio_write(0, 1, 0);
+static bool rbb_accept(struct chain *ch, int fd)
+{
+   struct rbb_client *c = malloc(sizeof(*c));
 
+   if (!c) {
+      perror("remote_bitbang");
+      return false;
+   }
+   rbb_init(&c->rbb, &ch->gpio, rbb_client_shift, c);
+   c->ch = ch;
+   c->st = &stats[fd];
+   rbb_clients[fd] = c;
    return true;
 }
 
-static volatile sig_atomic_t running = 1;
-
-static void signal_handler(int sig)
+/*
+ * remote_bitbang: whatever the client has sent so far is decoded and
+ * shifted in one go, and the answers to its reads go back in one write.
+ */
+static int handle_rbb(struct chain *ch, int fd)
+{
+   struct rbb_client *c = rbb_clients[fd];
+   char in[16 * 1024], out[sizeof(in)];
+   ssize_t n;
+
+   vcd_poll(ch);
+   while ((n = read(fd, in, sizeof(in))) < 0 && errno == EINTR)
+      if (!running)
+         return -1;
+   if (n < 0 && verbose)
+      perror("read");
+   if (n <= 0)
+      return 1;
+
+   int nout = rbb_feed(&c->rbb, in, n, out);
+   if (nout < 0) {
+      fprintf(stderr, "%s: unsupported remote_bitbang command, closing\n", ch->name);
+      return 1;
+   }
+   if (nout && write(fd, out, nout) != nout) {
+      perror("write");
+      return 1;
+   }
+   return c->rbb.quit ? 1 : 0;
+}
+
+/*
+ * Chain config file (-f): one [name] section per chain, with keys
+ *
+ *    port, bitbang, tck, tms, tdi, tdo, cpu, backend, delay, gang, irlen
+ *
+ * Keys left out take the command-line value; the ports then count up
+ * from -p and -B and the engine threads are spread over the cores.
+ * bitbang = 0 turns the remote_bitbang listener of a chain off.
+ */
+static char *trim(char *s)
+{
+   while (*s == ' ' || *s == '\t')
+      s++;
+   char *e = s + strlen(s);
+   while (e > s && (e[-1] == ' ' || e[-1] == '\t' || e[-1] == '\n' || e[-1] == '\r'))
+      *--e = 0;
+   return s;
+}
+
+/* Comma separated numbers, at most max; returns their number or -1 */
+static int parse_list(const char *arg, int *list, int max)
+{
+   int n = 0;
+
+   while (*arg) {
+      char *end;
+      long v = strtol(arg, &end, 0);
+      if (end == arg || v < 0 || n == max || (*end && *end != ','))
+         return -1;
+      list[n++] = v;
+      arg = *end ? end + 1 : end;
+   }
+   return n;
+}
+
+/* Comma separated gang TDO pins; returns their number or -1 */
+static int parse_gang(const char *arg, int *gang)
+{
+   return parse_list(arg, gang, MAX_GANG);
+}
+
+/* IR lengths of the chain's devices, from TDO; returns their number or -1 */
+static int parse_ir_lengths(const char *arg, int *len)
+{
+   int n = parse_list(arg, len, MAX_CHAIN_DEVICES);
+
+   for (int i = 0; i < n; i++)
+      if (len[i] < 1 || len[i] > 32)
+         return -1;
+   return n;
+}
+
+static struct chain *chain_add(const char *name)
+{
+   if (nchains == MAX_CHAINS) {
+      fprintf(stderr, "Too many chains (max %d)\n", MAX_CHAINS);
+      return NULL;
+   }
+   struct chain *ch = &chains[nchains];
+   snprintf(ch->name, sizeof(ch->name), "%s", name);
+   ch->pins.tck = tck_gpio;
+   ch->pins.tms = tms_gpio;
+   ch->pins.tdi = tdi_gpio;
+   ch->pins.tdo = tdo_gpio;
+   ch->pins.ngang = ngang_gpio;
+   memcpy(ch->pins.gang, gang_gpio, sizeof(gang_gpio));
+   ch->port = port + nchains;
+   ch->rbb_port = rbb_port ? rbb_port + nchains : 0;
+   ch->cpu = -2;               /* default, set once all chains are known */
+   ch->backend = gpio_backend;
+   ch->delay = jtag_delay;
+   ch->listen_fd = -1;
+   ch->rbb_fd = -1;
+   ch->owner = -1;
+   pthread_mutex_init(&ch->ctl_lock, NULL);
+   pthread_cond_init(&ch->ctl_done, NULL);
+   ch->trace_on = trace_scans;
+   ch->nir_len = nir_lengths;
+   memcpy(ch->ir_len, ir_lengths, sizeof(ir_lengths));
+   nchains++;
+   return ch;
+}
+
+static bool load_config(const char *path)
+{
+   FILE *f = fopen(path, "r");
+   char line[256];
+   struct chain *ch = NULL;
+   int lineno = 0;
+
+   if (!f) {
+      perror(path);
+      return false;
+   }
+   while (fgets(line, sizeof(line), f)) {
+      char *p = line, *key, *val, *end;
+      long v;
+
+      lineno++;
+      p[strcspn(p, "#;")] = 0;
+      p = trim(p);
+      if (!*p)
+         continue;
+      if (*p == '[') {
+         end = strchr(p, ']');
+         if (!end)
+            goto bad;
+         *end = 0;
+         if (!(ch = chain_add(trim(p + 1))))
+            goto fail;
+         continue;
+      }
+      val = strchr(p, '=');
+      if (!ch || !val)
+         goto bad;
+      *val++ = 0;
+      key = trim(p);
+      val = trim(val);
+      if (strcmp(key, "backend") == 0) {
+         ch->backend = strcmp(val, "auto") ? strdup(val) : NULL;
+         continue;
+      }
+      if (strcmp(key, "gang") == 0) {
+         if ((ch->pins.ngang = parse_gang(val, ch->pins.gang)) < 0)
+            goto bad;
+         continue;
+      }
+      if (strcmp(key, "irlen") == 0) {
+         if ((ch->nir_len = parse_ir_lengths(val, ch->ir_len)) < 0)
+            goto bad;
+         continue;
+      }
+      v = strtol(val, &end, 0);
+      if (end == val || *end || v < 0)
+         goto bad;
+      if (strcmp(key, "port") == 0 && v > 0 && v < 65536)
+         ch->port = v;
+      else if (strcmp(key, "bitbang") == 0 && v < 65536)
+         ch->rbb_port = v;
+      else if (strcmp(key, "tck") == 0)
+         ch->pins.tck = v;
+      else if (strcmp(key, "tms") == 0)
+         ch->pins.tms = v;
+      else if (strcmp(key, "tdi") == 0)
+         ch->pins.tdi = v;
+      else if (strcmp(key, "tdo") == 0)
+         ch->pins.tdo = v;
+      else if (strcmp(key, "cpu") == 0)
+         ch->cpu = v;
+      else if (strcmp(key, "delay") == 0 && v > 0)
+         ch->delay = v;
+      else
+         goto bad;
+   }
+   fclose(f);
+   if (!nchains) {
+      fprintf(stderr, "%s: no chains defined\n", path);
+      return false;
+   }
+   return true;
+
+bad:
+   fprintf(stderr, "%s:%d: invalid line\n", path, lineno);
+fail:
+   fclose(f);
+   return false;
+}
+
+/* A chain's GPIOs; returns their number */
+static int chain_pins(const struct jtag_pins *p, int *pins)
+{
+   int n = 0;
+
+   pins[n++] = p->tck;
+   pins[n++] = p->tms;
+   pins[n++] = p->tdi;
+   pins[n++] = p->tdo;
+   for (int b = 0; b < p->ngang; b++)
+      pins[n++] = p->gang[b];
+   return n;
+}
+
+/* Spread unpinned engine threads over the cores, leaving core 0 if we can */
+static bool chains_check(void)
+{
+   long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+
+   if (ncpu < 1)
+      ncpu = 1;
+   for (int i = 0; i < nchains; i++) {
+      struct chain *ch = &chains[i];
+
+      int a[4 + MAX_GANG], b[4 + MAX_GANG];
+      int na = chain_pins(&ch->pins, a);
+
+      if (ch->cpu == -2)
+         ch->cpu = nchains == 1 ? -1 : nchains < ncpu ? i + 1 : i % ncpu;
+      if (ch->rbb_port == ch->port) {
+         fprintf(stderr, "Chain '%s' uses port %d twice\n", ch->name, ch->port);
+         return false;
+      }
+      for (int x = 0; x < na; x++)
+         for (int y = 0; y < x; y++)
+            if (a[x] == a[y]) {
+               fprintf(stderr, "Chain '%s' uses GPIO%d twice\n", ch->name, a[x]);
+               return false;
+            }
+      for (int j = 0; j < i; j++) {
+         const struct chain *o = &chains[j];
+         int nb = chain_pins(&o->pins, b);
+
+         int pa[2] = { ch->port, ch->rbb_port }, pb[2] = { o->port, o->rbb_port };
+         for (int x = 0; x < 2; x++)
+            for (int y = 0; y < 2; y++)
+               if (pa[x] && pa[x] == pb[y]) {
+                  fprintf(stderr, "Chains '%s' and '%s' both use port %d\n",
+                          o->name, ch->name, pa[x]);
+                  return false;
+               }
+         if ((ch->backend && !strcmp(ch->backend, "mock")) ||
+             (o->backend && !strcmp(o->backend, "mock")))
+            continue;
+         for (int x = 0; x < na; x++)
+            for (int y = 0; y < nb; y++)
+               if (a[x] == b[y]) {
+                  fprintf(stderr, "Chains '%s' and '%s' both use GPIO%d\n",
+                          o->name, ch->name, a[x]);
+                  return false;
+               }
+      }
+   }
+   return true;
+}
+
+/*
+ * "make install" leaves the binary set-user-ID root, for the GPIOs.  It
+ * works as the user who started it but for root_begin() to root_end(),
+ * so that -f, -V, -R, -K, the vector cache, -U and "play" open only what
+ * that user could.  root_end() gives root up for good.
+ */
+static bool set_id;
+static uid_t root_uid;
+static gid_t root_gid;
+
+static bool root_init(void)
+{
+   root_uid = geteuid();
+   root_gid = getegid();
+   set_id = root_uid != getuid() || root_gid != getgid();
+   if (set_id && (setegid(getgid()) < 0 || seteuid(getuid()) < 0)) {
+      perror("seteuid");
+      return false;
+   }
+   return true;
+}
+
+static bool root_begin(void)
+{
+   if (set_id && (seteuid(root_uid) < 0 || setegid(root_gid) < 0)) {
+      perror("seteuid");
+      return false;
+   }
+   return true;
+}
+
+static bool root_end(void)
+{
+   uid_t uid = getuid();
+   gid_t gid = getgid();
+
+   if (set_id && (setresgid(gid, gid, gid) < 0 || setresuid(uid, uid, uid) < 0)) {
+      perror("setresuid");
+      return false;
+   }
+   return true;
+}
+
+static bool chain_open(struct chain *ch)
+{
+   if (verbose) {
+      printf("Chain '%s':\n", ch->name);
+      printf("  TCK: GPIO%d\n", ch->pins.tck);
+      printf("  TMS: GPIO%d\n", ch->pins.tms);
+      printf("  TDI: GPIO%d\n", ch->pins.tdi);
+      printf("  TDO: GPIO%d\n", ch->pins.tdo);
+      printf("  Port: %d\n", ch->port);
+      if (ch->rbb_port)
+         printf("  remote_bitbang port: %d\n", ch->rbb_port);
+      if (ch->cpu >= 0)
+         printf("  CPU: %d\n", ch->cpu);
+   }
+
+   ch->gpio.pins = ch->pins;
+   if (!gpio_open(&ch->gpio, ch->backend)) {
+      fprintf(stderr, "%s: Failed in gpio_open()\n", ch->name);
+      return false;
+   }
+   delay_set_loops(&ch->gpio.delay, ch->delay);
+   if (ch->handover_ps) {
+      /* Tuned by the binary before "upgrade": no clocking the TAP again */
+      delay_set_ps(&ch->gpio.delay, ch->handover_ps);
+      if (verbose)
+         printf("%s: taken over, %llu ps delay\n", ch->name,
+                (unsigned long long)ch->handover_ps);
+      return true;
+   }
+
+   if (autotune_startup)
+      autotune(ch);
+   return true;
+}
+
+/*
+ * Sockets passed in at startup, the way systemd passes them for socket
+ * activation (LISTEN_PID, LISTEN_FDS from fd 3) and "upgrade" passes
+ * them to the new binary.  Listening ones stand in for the sockets
+ * listen_on() and control_open() would make, matched by port or path;
+ * connected ones were clients of a chain and queue up for it again.
+ */
+#define LISTEN_FDS_START (3)
+#define MAX_INHERITED (MAX_CHAINS * (3 + CHAIN_QUEUE) + 1)
+static int inherited[MAX_INHERITED];
+static int ninherited;
+
+static void inherit_fds(void)
+{
+   const char *pid = getenv("LISTEN_PID"), *fds = getenv("LISTEN_FDS");
+
+   if (pid && fds && strtol(pid, NULL, 10) == getpid()) {
+      for (int i = 0; i < atoi(fds) && ninherited < MAX_INHERITED; i++) {
+         int fd = LISTEN_FDS_START + i;
+         fcntl(fd, F_SETFD, FD_CLOEXEC);
+         inherited[ninherited++] = fd;
+      }
+      if (verbose)
+         printf("%d sockets passed in\n", ninherited);
+   }
+   unsetenv("LISTEN_PID");
+   unsetenv("LISTEN_FDS");
+   unsetenv("LISTEN_FDNAMES");
+}
+
+/* Local port of a TCP socket, -1 for other fds */
+static int sock_port(int fd, bool *listening)
+{
+   struct sockaddr_storage a;
+   socklen_t len = sizeof(a);
+   int acc = 0;
+   socklen_t alen = sizeof(acc);
+
+   if (getsockname(fd, (struct sockaddr *)&a, &len) < 0 ||
+       getsockopt(fd, SOL_SOCKET, SO_ACCEPTCONN, &acc, &alen) < 0)
+      return -1;
+   *listening = acc;
+   if (a.ss_family == AF_INET)
+      return ntohs(((struct sockaddr_in *)&a)->sin_port);
+   if (a.ss_family == AF_INET6)
+      return ntohs(((struct sockaddr_in6 *)&a)->sin6_port);
+   return -1;
+}
+
+/* The passed-in listening socket on port, or on the UNIX socket path */
+static int inherit_take(int port, const char *path)
+{
+   for (int i = 0; i < ninherited; i++) {
+      struct sockaddr_un a;
+      socklen_t len = sizeof(a);
+      bool listening = false;
+      int fd = inherited[i];
+
+      if (fd < 0)
+         continue;
+      if (path ? getsockname(fd, (struct sockaddr *)&a, &len) == 0 &&
+                 a.sun_family == AF_UNIX && !strcmp(a.sun_path, path) :
+                 sock_port(fd, &listening) == port && listening) {
+         inherited[i] = -1;
+         return fd;
+      }
+   }
+   return -1;
+}
+
+static void inherit_close(void)
+{
+   for (int i = 0; i < ninherited; i++) {
+      if (inherited[i] < 0)
+         continue;
+      fprintf(stderr, "fd %d: passed-in socket matches no chain, closed\n", inherited[i]);
+      close(inherited[i]);
+      inherited[i] = -1;
+   }
+}
+
+static int listen_on(int port)
+{
+   struct sockaddr_in address;
+   int i = 1;
+   int fd = inherit_take(port, NULL);
+
+   if (fd >= 0) {
+      if (verbose)
+         printf("Port %d: passed-in socket\n", port);
+      return fd;
+   }
+   fd = socket(AF_INET, SOCK_STREAM, 0);
+   if (fd < 0) {
+      perror("socket");
+      return -1;
+   }
+   setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &i, sizeof i);
+
+   address.sin_addr.s_addr = INADDR_ANY;
+   address.sin_port = htons(port);
+   address.sin_family = AF_INET;
+
+   if (bind(fd, (struct sockaddr*) &address, sizeof(address)) < 0) {
+      perror("bind");
+      close(fd);
+      return -1;
+   }
+   /* Room for the connections made while "upgrade" starts the new binary */
+   if (listen(fd, CHAIN_QUEUE) < 0) {
+      perror("listen");
+      close(fd);
+      return -1;
+   }
+   return fd;
+}
+
+static bool chain_listen(struct chain *ch)
+{
+   ch->listen_fd = listen_on(ch->port);
+   if (ch->listen_fd < 0)
+      return false;
+   if (verbose)
+      printf("%s: XVC server listening on port %d\n", ch->name, ch->port);
+   if (ch->rbb_port) {
+      ch->rbb_fd = listen_on(ch->rbb_port);
+      if (ch->rbb_fd < 0)
+         return false;
+      if (verbose)
+         printf("%s: remote_bitbang server listening on port %d\n", ch->name, ch->rbb_port);
+   }
+   return true;
+}
+
+static void chain_close(struct chain *ch)
+{
+   if (ch->listen_fd >= 0)
+      close(ch->listen_fd);
+   ch->listen_fd = -1;
+   if (ch->rbb_fd >= 0)
+      close(ch->rbb_fd);
+   ch->rbb_fd = -1;
+   if (ch->gpio.vcd && vcd_close(ch->gpio.vcd) && verbose)
+      printf("%s: waveform written to %s\n", ch->name, vcd_file);
+   ch->gpio.vcd = NULL;
+   gpio_close(&ch->gpio);
+}
+
+/* -V: capture the chain's shifts from here on */
+static bool chain_capture(struct chain *ch)
+{
+   if (vcd_file)
+      ch->gpio.vcd = vcd_open(vcd_file, vcd_ring_kbits * 1000);
+   return !vcd_file || ch->gpio.vcd;
+}
+
+static void client_closed(struct chain *ch, int fd)
+{
+   const struct session_stats *st = &stats[fd];
+
+   ch->total.bits += st->bits;
+   ch->total.shifts += st->shifts;
+   ch->total.shift_ns += st->shift_ns;
+   gang_report(&ch->gpio, ch->name);
+   if (ch->trace_on)
+      trace_flush(ch);
+   if (ch->gpio.vcd)
+      vcd_flush(ch->gpio.vcd);
+   free(rbb_clients[fd]);
+   rbb_clients[fd] = NULL;
+   close(fd);
+   ch->owner = -1;
+   ch->clients--;
+   client_count(-1);
+}
+
+/* A connection that never owned the chain: rejected, or tired of waiting */
+static void client_drop(int fd)
+{
+   free(rbb_clients[fd]);
+   rbb_clients[fd] = NULL;
+   close(fd);
+}
+
+/* Probes after keepalive_s of silence; unanswered ones or unacked data drop it */
+static void client_keepalive(int fd)
+{
+   int on = 1, idle = keepalive_s, intvl = 1, cnt = KEEPALIVE_PROBES;
+   unsigned int user_ms = (keepalive_s + KEEPALIVE_PROBES) * 1000;
+
+   if (!keepalive_s)
+      return;
+   if (setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof(on)) < 0 ||
+       setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(idle)) < 0 ||
+       setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &intvl, sizeof(intvl)) < 0 ||
+       setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &cnt, sizeof(cnt)) < 0 ||
+       setsockopt(fd, IPPROTO_TCP, TCP_USER_TIMEOUT, &user_ms, sizeof(user_ms)) < 0)
+      perror("keepalive");
+}
+
+/* fd becomes the owner: its commands are read from now on */
+static void chain_own(struct chain *ch, int fd, fd_set *conn, int *maxfd)
+{
+   ch->owner = fd;
+   ch->owner_seen_ns = now_ns();
+   if (idle_timeout_s) {
+      /* Also ends a command the client stopped sending halfway */
+      struct timeval tv = { idle_timeout_s, 0 };
+      setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+   }
+   if (fd > *maxfd)
+      *maxfd = fd;
+   FD_SET(fd, conn);
+   memset(&stats[fd], 0, sizeof(stats[fd]));
+   gang_reset(&ch->gpio);
+   tap_trace_init(&ch->trace, trace_event, ch);
+   ch->connections++;
+   ch->clients++;
+   client_count(1);
+}
+
+/*
+ * -U: control socket (see control_command()).  Requests that name a
+ * chain are carried out by its engine thread, which polls its mailbox
+ * between two client commands; the control thread waits for the reply.
+ * Jobs and reopening the pins wait until the chain has no owner, and go
+ * ahead of the connections queued for it.  A parked engine thread
+ * reads, accepts and runs jobs no more until resumed, so that "upgrade"
+ * can hand its sockets over.
+ */
+enum control_op {
+   CTL_STATS, CTL_DELAY, CTL_TRACE, CTL_PARK, CTL_RESUME,
+   CTL_BACKEND, CTL_PINS, CTL_SCAN, CTL_PLAY, CTL_REPLAY, CTL_PROGRAM,
+};
+#define CTL_FIRST_JOB CTL_BACKEND
+
+struct control_req {
+   struct control_req *next;
+   enum control_op op;
+   int arg[4];
+   char path[256];             /* file, or backend name */
+   bool done;
+   char reply[1024];           /* lines, the last "ok ..." or "error ..." */
+};
+
+static void control_reply(struct control_req *r, const char *fmt, ...)
+{
+   size_t n = strlen(r->reply);
+   va_list ap;
+
+   va_start(ap, fmt);
+   vsnprintf(r->reply + n, sizeof(r->reply) - n, fmt, ap);
+   va_end(ap);
+}
+
+/* Reopen the chain's pins with another mapping or backend, else the old ones */
+static void chain_reopen(struct chain *ch, const struct jtag_pins *pins,
+                         const char *backend, struct control_req *r)
+{
+   const struct jtag_pins old_pins = ch->pins;
+   const char *old_backend = ch->backend;
+   bool mock = backend && !strcmp(backend, "mock");
+   int a[4 + MAX_GANG], b[4 + MAX_GANG];
+   int na = chain_pins(pins, a);
+
+   if (set_id && !mock) {
+      control_reply(r, "error root was given up after start, restart to change the pins\n");
+      return;
+   }
+   for (int x = 0; x < na; x++)
+      for (int y = 0; y < x; y++)
+         if (a[x] == a[y]) {
+            control_reply(r, "error GPIO%d given twice\n", a[x]);
+            return;
+         }
+   for (int i = 0; i < nchains && !mock; i++) {
+      const struct chain *o = &chains[i];
+      int nb = chain_pins(&o->pins, b);
+
+      if (o == ch || (o->backend && !strcmp(o->backend, "mock")))
+         continue;
+      for (int x = 0; x < na; x++)
+         for (int y = 0; y < nb; y++)
+            if (a[x] == b[y]) {
+               control_reply(r, "error GPIO%d is used by chain '%s'\n", a[x], o->name);
+               return;
+            }
+   }
+
+   gpio_close(&ch->gpio);
+   ch->gpio.pins = *pins;
+   if (gpio_open(&ch->gpio, backend)) {
+      ch->pins = *pins;
+      ch->backend = backend;
+      ch->tune.valid = false;     /* tuned for the old wiring */
+      control_reply(r, "ok backend %s, TCK GPIO%d TMS GPIO%d TDI GPIO%d TDO GPIO%d\n",
+                    ch->gpio.be->name, pins->tck, pins->tms, pins->tdi, pins->tdo);
+      return;
+   }
+   ch->gpio.pins = old_pins;
+   if (!gpio_open(&ch->gpio, old_backend)) {
+      fprintf(stderr, "%s: cannot reopen the old pins either, stopping the chain\n", ch->name);
+      control_reply(r, "error cannot open the new pins, nor the old ones\n");
+      running = 0;
+      return;
+   }
+   control_reply(r, "error cannot open the new pins, kept the old ones\n");
+}
+
+
+static void control_run(struct chain *ch, struct control_req *r)
+{
+   uint64_t t0 = now_ns();
+   int result = -1;
+
+   switch (r->op) {
+   case CTL_STATS: {
+      const struct session_stats *st = &ch->total;
+      double tck_khz = st->shift_ns ? st->bits * 1e6 / st->shift_ns : 0;
+      control_reply(r, "ok chain=%s backend=%s kernel=%s delay=%u delay_ps=%llu trace=%s "
+                    "owner=%d queued=%d connections=%u shifts=%llu bits=%llu tck_khz=%.1f",
+                    ch->name, ch->gpio.be->name, ch->gpio.kernel_name ? ch->gpio.kernel_name : "-",
+                    ch->gpio.delay.loops, (unsigned long long)ch->gpio.delay.ps, ch->trace_on ? "on" : "off", ch->owner, ch->nqueue,
+                    ch->connections, (unsigned long long)st->shifts,
+                    (unsigned long long)st->bits, tck_khz);
+      if (ch->owner >= 0)
+         control_reply(r, " session_shifts=%llu session_bits=%llu",
+                       (unsigned long long)stats[ch->owner].shifts,
+                       (unsigned long long)stats[ch->owner].bits);
+      control_reply(r, "\n");
+      return;
+   }
+   case CTL_DELAY:
+      ch->delay = r->arg[0];
+      delay_set_loops(&ch->gpio.delay, ch->delay);
+      control_reply(r, "ok delay %u loops\n", ch->delay);
+      return;
+   case CTL_PARK:
+      ch->parked = true;
+      control_reply(r, "ok %s parked\n", ch->name);
+      return;
+   case CTL_RESUME:
+      ch->parked = false;
+      control_reply(r, "ok %s resumed\n", ch->name);
+      return;
+   case CTL_TRACE:
+      if (r->arg[0] && !ch->trace_on)
+         tap_trace_init(&ch->trace, trace_event, ch);
+      else if (!r->arg[0] && ch->trace_on)
+         trace_flush(ch);
+      ch->trace_on = r->arg[0];
+      control_reply(r, "ok trace %s\n", ch->trace_on ? "on" : "off");
+      return;
+   case CTL_BACKEND:
+      chain_reopen(ch, &ch->pins, strcmp(r->path, "auto") ? strdup(r->path) : NULL, r);
+      return;
+   case CTL_PINS: {
+      struct jtag_pins pins = ch->pins;
+      pins.tck = r->arg[0];
+      pins.tms = r->arg[1];
+      pins.tdi = r->arg[2];
+      pins.tdo = r->arg[3];
+      chain_reopen(ch, &pins, ch->backend, r);
+      return;
+   }
+   case CTL_SCAN: {
+      uint32_t idcode[MAX_CHAIN_DEVICES];
+      int ndev = chain_scan(&ch->gpio, idcode);
+      if (ndev < 0) {
+         control_reply(r, "error no end of chain, TDO stuck or chain broken\n");
+         return;
+      }
+      for (int d = 0; d < ndev; d++)
+         control_reply(r, "device %d idcode 0x%08x\n", d, idcode[d]);
+      control_reply(r, "ok %d devices\n", ndev);
+      return;
+   }
+   case CTL_PLAY:
+      gang_reset(&ch->gpio);
+      result = svf_play(&ch->gpio, r->path, &running);
+      break;
+   case CTL_REPLAY: {
+      struct vec_result res = { 0 };
+      if (!vec_is_vector_file(r->path)) {
+         control_reply(r, "error %s is not a vector file\n", r->path);
+         return;
+      }
+      gang_reset(&ch->gpio);
+      result = vec_replay(&ch->gpio, r->path, NULL, &running, &res);
+      if (result == 0)
+         control_reply(r, "tcks %llu\n", (unsigned long long)res.tcks);
+      else if (result > 0)
+         control_reply(r, "mismatch at TCK %llu, line/shift %d\n",
+                       (unsigned long long)res.mismatch_tck, res.line);
+      break;
+   }
+   case CTL_PROGRAM:
+      gang_reset(&ch->gpio);
+      result = bitstream_program(&ch->gpio, r->path, &running);
+      break;
+   }
+
+   /* Jobs, as -P/-X */
+   if (result && ch->gpio.vcd)
+      vcd_trigger(ch->gpio.vcd, result > 0 ? "the failed check" : "the error");
+   if (ch->gpio.pins.ngang)
+      gang_report(&ch->gpio, ch->name);
+   const char *what = result < 0 ? "failed" : r->op == CTL_PROGRAM ?
+                      (result ? "not DONE" : "DONE") : (result ? "TDO mismatch" : "pass");
+   control_reply(r, "%s %s in %.3f s\n", result ? "error" : "ok", what, (now_ns() - t0) / 1e9);
+}
+
+/* Carry out the requests that can run now; with done, fail all of them */
+static void control_poll(struct chain *ch, bool done)
+{
+   if (!__atomic_load_n(&ch->ctl_head, __ATOMIC_ACQUIRE))
+      return;
+   pthread_mutex_lock(&ch->ctl_lock);
+   for (struct control_req **pp = &ch->ctl_head; *pp; ) {
+      struct control_req *r = *pp;
+      if (!done && r->op >= CTL_FIRST_JOB && (ch->owner >= 0 || ch->parked)) {
+         pp = &r->next;
+         continue;
+      }
+      *pp = r->next;
+      if (done) {
+         control_reply(r, "error server stopping\n");
+      } else {
+         /* A job can take minutes; the submitter waits for it, not the lock */
+         pthread_mutex_unlock(&ch->ctl_lock);
+         control_run(ch, r);
+         pthread_mutex_lock(&ch->ctl_lock);
+         pp = &ch->ctl_head;
+      }
+      r->done = true;
+      pthread_cond_broadcast(&ch->ctl_done);
+   }
+   pthread_mutex_unlock(&ch->ctl_lock);
+}
+
+/*
+ * Queue upkeep, once per pass of the engine loop: drop an idle owner,
+ * run the control requests that can run, give up on connections that
+ * waited too long and hand a free chain to the first one still waiting.
+ */
+static void chain_arbitrate(struct chain *ch, fd_set *conn, int *maxfd)
+{
+   uint64_t t = now_ns();
+   int n = 0;
+
+   /* Parked: the clients stay exactly as "upgrade" found them */
+   if (ch->parked) {
+      control_poll(ch, false);
+      return;
+   }
+   if (ch->owner >= 0 && idle_timeout_s &&
+       t - ch->owner_seen_ns >= (uint64_t)idle_timeout_s * 1000000000) {
+      fprintf(stderr, "%s: fd %d idle for %d s, disconnected\n", ch->name, ch->owner,
+              idle_timeout_s);
+      FD_CLR(ch->owner, conn);
+      client_closed(ch, ch->owner);
+   }
+   control_poll(ch, false);
+   if (ch->parked)
+      return;
+   t = now_ns();
+   for (int i = 0; i < ch->nqueue; i++) {
+      if (t >= ch->queue_until[i]) {
+         fprintf(stderr, "%s: fd %d waited %d s for the chain, closed\n", ch->name,
+                 ch->queue[i], queue_wait_s);
+         client_drop(ch->queue[i]);
+         continue;
+      }
+      ch->queue[n] = ch->queue[i];
+      ch->queue_until[n++] = ch->queue_until[i];
+   }
+   ch->nqueue = n;
+   if (ch->owner < 0 && ch->nqueue) {
+      int fd = ch->queue[0];
+      if (verbose)
+         printf("%s: fd %d takes over the chain\n", ch->name, fd);
+      memmove(ch->queue, ch->queue + 1, --ch->nqueue * sizeof(ch->queue[0]));
+      memmove(ch->queue_until, ch->queue_until + 1, ch->nqueue * sizeof(ch->queue_until[0]));
+      chain_own(ch, fd, conn, maxfd);
+   }
+}
+
+static void chain_enqueue(struct chain *ch, int fd)
+{
+   if (verbose)
+      printf("%s: fd %d queued behind fd %d\n", ch->name, fd, ch->owner);
+   ch->queue[ch->nqueue] = fd;
+   ch->queue_until[ch->nqueue++] = now_ns() + (uint64_t)queue_wait_s * 1000000000;
+}
+
+/* A new connection owns a free chain, waits its turn or is turned away */
+static void chain_accept(struct chain *ch, int fd, fd_set *conn, int *maxfd)
+{
+   client_keepalive(fd);
+   if (ch->owner < 0 && !ch->nqueue) {
+      chain_own(ch, fd, conn, maxfd);
+   } else if (queue_wait_s && ch->nqueue < CHAIN_QUEUE) {
+      chain_enqueue(ch, fd);
+   } else {
+      fprintf(stderr, "%s: chain busy with fd %d, fd %d rejected\n", ch->name,
+              ch->owner, fd);
+      client_drop(fd);
+   }
+}
+
+/* The engine thread: one chain's listening socket and its clients */
+static void chain_serve(struct chain *ch)
+{
+   struct sockaddr_in address;
+   int s = ch->listen_fd, rs = ch->rbb_fd;
+   fd_set conn;
+   int maxfd = 0;
+
+   FD_ZERO(&conn);
+   FD_SET(s, &conn);
+   if (rs >= 0)
+      FD_SET(rs, &conn);
+
+   maxfd = s > rs ? s : rs;
+
+   while (running) {
+      fd_set read, except;
+      int fd;
+
+      chain_arbitrate(ch, &conn, &maxfd);
+      if (ch->parked) {
+         /* Until resumed, or replaced by the new binary; SIGUSR2 wakes it */
+         struct timeval tv = { 1, 0 };
+         select(0, NULL, NULL, NULL, &tv);
+         continue;
+      }
+      read = except = conn;
+      if (ch->autotune_seen != (unsigned int)autotune_requested && ch->clients == 0) {
+         ch->autotune_seen = autotune_requested;
+         autotune(ch);
+      }
+      vcd_poll(ch);
+
+      // Use timeout so we can check running flag
+      struct timeval timeout;
+      timeout.tv_sec = 1;
+      timeout.tv_usec = 0;
+
+      if (select(maxfd + 1, &read, 0, &except, &timeout) < 0) {
+         if (errno == EINTR) {
+            // Interrupted by signal, continue loop
+            continue;
+         }
+         perror("select");
+         break;
+      }
+
+      for (fd = 0; fd <= maxfd; ++fd) {
+         if (FD_ISSET(fd, &read)) {
+            if (fd == s || fd == rs) {
+               int newfd;
+               socklen_t nsize = sizeof(address);
+
+               newfd = accept(fd, (struct sockaddr*) &address, &nsize);
+
+               if (verbose)
+                  printf("%s: %sconnection accepted - fd %d\n", ch->name,
+                         fd == rs ? "remote_bitbang " : "", newfd);
+               if (newfd < 0) {
+                  perror("accept");
+               } else if (fd == rs && !rbb_accept(ch, newfd)) {
+                  close(newfd);
+               } else {
+                 int flag = 1;
+                 int optResult = setsockopt(newfd,
+                                               IPPROTO_TCP,
+                                               TCP_NODELAY,
+                                               (char *)&flag,
+                                               sizeof(int));
+                 if (optResult < 0)
+                    perror("TCP_NODELAY error");
+                  chain_accept(ch, newfd, &conn, &maxfd);
+               }
+            }
+            else {
+               int result = rbb_clients[fd] ? handle_rbb(ch, fd) : handle_data(ch, fd);
+               ch->owner_seen_ns = now_ns();
+               if (result == -1) { // Check for signal to exit
+                  // handle_data returned -1, indicating exit
+                  goto out;
+               }
+               else if (result) {
+                  if (verbose) {
+                     printf("%s: connection closed - fd %d\n", ch->name, fd);
+                     print_stats(ch, "connection", &stats[fd]);
+                  }
+                  FD_CLR(fd, &conn);
+                  client_closed(ch, fd);
+               }
+            }
+         }
+         else if (FD_ISSET(fd, &except)) {
+            if (verbose)
+               printf("%s: connection aborted - fd %d\n", ch->name, fd);
+            FD_CLR(fd, &conn);
+            if (fd == s || fd == rs) {
+               close(fd);
+               if (fd == s)
+                  ch->listen_fd = -1;
+               else
+                  ch->rbb_fd = -1;
+               break;
+            }
+            client_closed(ch, fd);
+         }
+      }
+   }
+
+out:
+   for (int fd = 0; fd <= maxfd; fd++)
+      if (fd != s && fd != rs && FD_ISSET(fd, &conn))
+         client_closed(ch, fd);
+   for (int i = 0; i < ch->nqueue; i++)
+      client_drop(ch->queue[i]);
+   ch->nqueue = 0;
+   control_poll(ch, true);
+}
+
+static void *chain_thread(void *arg)
+{
+   struct chain *ch = arg;
+
+   if (ch->cpu >= 0) {
+      cpu_set_t set;
+      CPU_ZERO(&set);
+      CPU_SET(ch->cpu, &set);
+      int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+      if (err)
+         fprintf(stderr, "%s: cannot pin engine thread to CPU %d: %s\n",
+                 ch->name, ch->cpu, strerror(err));
+   }
+   chain_serve(ch);
+   return NULL;
+}
+
+typedef int (*file_job)(struct jtag_gpio *g, const char *path,
+                        const volatile sig_atomic_t *running);
+
+/* The chain named by -C, or the first one */
+static struct chain *find_chain(const char *name)
+{
+   if (!name)
+      return &chains[0];
+   for (int i = 0; i < nchains; i++)
+      if (!strcmp(chains[i].name, name))
+         return &chains[i];
+   fprintf(stderr, "No chain named '%s'\n", name);
+   return NULL;
+}
+
+/* Play an SVF file or program a bitstream on one chain instead of serving XVC */
+static int run_file(struct chain *ch, file_job job, const char *path)
+{
+   timing_init();
+   if (!root_begin())
+      return 1;
+   governor_open();
+   if (!chain_open(ch) || !root_end() || !chain_capture(ch)) {
+      chain_close(ch);
+      return 1;
+   }
+
+   struct sigaction sa;
+   memset(&sa, 0, sizeof(sa));
+   sa.sa_handler = signal_handler;
+   sigemptyset(&sa.sa_mask);
+   sigaction(SIGINT, &sa, NULL);
+   sigaction(SIGTERM, &sa, NULL);
+
+   if (want_performance)
+      governor_performance(true);
+   gang_reset(&ch->gpio);
+   int result = job(&ch->gpio, path, &running);
+   if (result && ch->gpio.vcd)
+      vcd_trigger(ch->gpio.vcd, result > 0 ? "the failed check" : "the error");
+   if (ch->gpio.pins.ngang)
+      gang_report(&ch->gpio, ch->name);
+   governor_performance(false);
+   chain_close(ch);
+   return result == 0 ? 0 : result > 0 ? 2 : 1;
+}
+
+/*
+ * -U: control socket, one command per line.  The answer is any number
+ * of information lines and then one line starting "ok" or "error".
+ *
+ *    chains                             the chains, their ports and owners
+ *    verbose <level>                    as -v
+ *    stats <chain>                      totals, and the session if one is open
+ *    delay <chain> <loops>              JTAG delay, as -d
+ *    trace <chain> on|off               as -t
+ *    backend <chain> <name>|auto        reopen the pins with another backend
+ *    pins <chain> <tck> <tms> <tdi> <tdo>
+ *    scan <chain>                       IDCODEs of the chain's devices
+ *    play <chain> <file>                SVF or vector file, as -P
+ *    replay <chain> <file>              vector file, with where it failed
+ *    program <chain> <file>             bitstream, as -X
+ *    upgrade [binary]                   re-exec, keeping sockets and clients
+ *
+ * From backend on, commands wait until the chain's client has left.
+ * Files are opened by the server, so the socket is only for its owner.
+ */
+static const char *control_path = NULL;
+static bool control_bound = false;     /* made here, not passed in */
+
+static const struct {
+   const char *name;
+   enum control_op op;
+   int nargs;                  /* after the chain */
+   const char *usage;
+} control_cmds[] = {
+   { "stats",   CTL_STATS,   0, "stats <chain>" },
+   { "delay",   CTL_DELAY,   1, "delay <chain> <loops>" },
+   { "trace",   CTL_TRACE,   1, "trace <chain> on|off" },
+   { "backend", CTL_BACKEND, 1, "backend <chain> <name>|auto" },
+   { "pins",    CTL_PINS,    4, "pins <chain> <tck> <tms> <tdi> <tdo>" },
+   { "scan",    CTL_SCAN,    0, "scan <chain>" },
+   { "play",    CTL_PLAY,    1, "play <chain> <file>" },
+   { "replay",  CTL_REPLAY,  1, "replay <chain> <file>" },
+   { "program", CTL_PROGRAM, 1, "program <chain> <file>" },
+};
+
+/* Hand a request to the chain's engine thread */
+static void control_post(struct chain *ch, struct control_req *r)
+{
+   pthread_mutex_lock(&ch->ctl_lock);
+   struct control_req **pp = &ch->ctl_head;
+   while (*pp)
+      pp = &(*pp)->next;
+   __atomic_store_n(pp, r, __ATOMIC_RELEASE);
+   pthread_mutex_unlock(&ch->ctl_lock);
+   pthread_kill(ch->thread, SIGUSR2);
+}
+
+static void control_wait(struct chain *ch, struct control_req *r)
+{
+   pthread_mutex_lock(&ch->ctl_lock);
+   while (!r->done)
+      pthread_cond_wait(&ch->ctl_done, &ch->ctl_lock);
+   pthread_mutex_unlock(&ch->ctl_lock);
+}
+
+static void control_submit(struct chain *ch, struct control_req *r, FILE *out)
+{
+   control_post(ch, r);
+   control_wait(ch, r);
+   fputs(r->reply, out);
+}
+
+/*
+ * upgrade [binary]: every engine thread parks between two commands and
+ * the binary (by default the path this one was started from) is exec'd
+ * with the same arguments.  The listening sockets, the control socket
+ * and the connections, the owners first, are passed as systemd would
+ * pass them; so are the backend, delay and tuning of each chain and the
+ * pin levels each remote_bitbang client last wrote, in XVCPI_HANDOVER.
+ * Between two commands the pins are where gpio_open() puts them, so the
+ * new binary opens them without clocking the TAP, and connections made
+ * meanwhile wait in the listen backlog.
+ *
+ * Nothing is given up before the exec: the binary is tried first, a
+ * chain that does not park in time resumes them all, and if the exec
+ * fails anyway the fds are put back and the chains carry on.
+ */
+#define UPGRADE_PARK_S (10)    /* for a job or a command under way to end */
+
+static char self_path[PATH_MAX];
+static char **self_argv;
+static int control_fd = -1;
+
+static int handover_fds[MAX_INHERITED];
+static int nhandover;
+static char handover_names[MAX_INHERITED * 12];
+static char handover_state[8192];
+static char *handover_env;      /* XVCPI_HANDOVER of the binary we replaced */
+
+static void handover_add(int fd, const char *name)
+{
+   size_t n = strlen(handover_names);
+
+   if (fd < 0 || nhandover == MAX_INHERITED)
+      return;
+   snprintf(handover_names + n, sizeof(handover_names) - n, "%s%s",
+            nhandover ? ":" : "", name);
+   handover_fds[nhandover++] = fd;
+}
+
+static void handover_conn(int fd)
+{
+   const struct rbb_client *c = rbb_clients[fd];
+
+   if (c) {
+      /* It has the fd LISTEN_FDS_START + nhandover in the new binary */
+      size_t n = strlen(handover_state);
+      snprintf(handover_state + n, sizeof(handover_state) - n, "rbb %d %d %d %d %d;",
+               LISTEN_FDS_START + nhandover, c->rbb.tck, c->rbb.tms, c->rbb.tdi,
+               c->rbb.last_tdo);
+   }
+   handover_add(fd, "connection");
+}
+
+/* A parked chain's sockets and settings, for the new binary */
+static void handover_take(struct chain *ch)
+{
+   size_t n = strlen(handover_state);
+
+   if (ch->gpio.be)
+      snprintf(handover_state + n, sizeof(handover_state) - n,
+               "chain %.31s %.31s %u %llu %d %llu %llu %d;", ch->name, ch->gpio.be->name,
+               ch->delay, (unsigned long long)ch->gpio.delay.ps, ch->tune.valid,
+               (unsigned long long)ch->tune.min_delay_ps,
+               (unsigned long long)ch->tune.overhead_ps, ch->tune.ndev);
+   handover_add(ch->listen_fd, "xvc");
+   handover_add(ch->rbb_fd, "bitbang");
+   if (ch->owner >= 0) {
+      if (ch->trace_on)
+         trace_flush(ch);
+      handover_conn(ch->owner);
+   }
+   for (int i = 0; i < ch->nqueue; i++)
+      handover_conn(ch->queue[i]);
+}
+
+/* The binary has to get as far as its usage text, which exits 1 */
+static bool upgrade_probe(const char *binary)
+{
+   int status;
+   pid_t pid = fork();
+
+   if (pid == 0) {
+      int null = open("/dev/null", O_RDWR);
+      dup2(null, 0);
+      dup2(null, 1);
+      dup2(null, 2);
+      execl(binary, binary, "--help", (char *)NULL);
+      _exit(127);
+   }
+   if (pid < 0)
+      return false;
+   while (waitpid(pid, &status, 0) < 0)
+      if (errno != EINTR)
+         return false;
+   return WIFEXITED(status) && WEXITSTATUS(status) == 1;
+}
+
+/*
+ * Only returns if the exec failed, with its errno and the fds as they
+ * were.  The sockets are moved to LISTEN_FDS_START on; whatever held
+ * those numbers is kept aside meanwhile.
+ */
+static int upgrade_exec(const char *binary)
+{
+   int n = nhandover, done = 0, err;
+   int tmp[MAX_INHERITED], saved[MAX_INHERITED], flags[MAX_INHERITED];
+   char num[16];
+   sigset_t none, mask;
+
+   for (int i = 0; i < n; i++) {
+      tmp[i] = fcntl(handover_fds[i], F_DUPFD_CLOEXEC, LISTEN_FDS_START + n);
+      saved[i] = -1;
+   }
+   for (; done < n && tmp[done] >= 0; done++) {
+      int fd = LISTEN_FDS_START + done;
+      flags[done] = fcntl(fd, F_GETFD);
+      saved[done] = flags[done] < 0 ? -1 : fcntl(fd, F_DUPFD_CLOEXEC, LISTEN_FDS_START + n);
+      if (flags[done] >= 0 && saved[done] < 0)
+         break;
+      /* EBUSY: another thread is between reserving fd and using it */
+      int r, tries = 0;
+      while ((r = dup2(tmp[done], fd)) < 0 && errno == EBUSY && ++tries < 100)
+         usleep(1000);
+      if (r < 0)
+         break;
+   }
+
+   if (done == n) {
+      if (close_range(LISTEN_FDS_START + n, ~0U, CLOSE_RANGE_CLOEXEC) < 0)
+         for (int fd = LISTEN_FDS_START + n; fd < FD_SETSIZE; fd++)
+            fcntl(fd, F_SETFD, FD_CLOEXEC);
+      snprintf(num, sizeof(num), "%d", (int)getpid());
+      setenv("LISTEN_PID", num, 1);
+      snprintf(num, sizeof(num), "%d", n);
+      setenv("LISTEN_FDS", num, 1);
+      setenv("LISTEN_FDNAMES", handover_names, 1);
+      setenv("XVCPI_HANDOVER", handover_state, 1);
+      if (verbose)
+         printf("Upgrading to %s with %d sockets\n", binary, n);
+      fflush(NULL);
+      /* The mask survives exec; the new main thread blocks them itself */
+      sigemptyset(&none);
+      pthread_sigmask(SIG_SETMASK, &none, &mask);
+      execv(binary, self_argv);
+      err = errno;
+      perror(binary);
+      pthread_sigmask(SIG_SETMASK, &mask, NULL);
+      unsetenv("LISTEN_PID");
+      unsetenv("LISTEN_FDS");
+      unsetenv("LISTEN_FDNAMES");
+      unsetenv("XVCPI_HANDOVER");
+   } else {
+      err = errno;
+      perror("upgrade");
+   }
+
+   for (int i = done - 1; i >= 0; i--) {
+      int fd = LISTEN_FDS_START + i;
+      if (saved[i] >= 0) {
+         dup2(saved[i], fd);
+         fcntl(fd, F_SETFD, flags[i]);
+      } else {
+         close(fd);
+      }
+   }
+   for (int i = 0; i < n; i++) {
+      if (saved[i] >= 0)
+         close(saved[i]);
+      if (tmp[i] >= 0)
+         close(tmp[i]);
+   }
+   return err;
+}
+
+static const char *handover_next(const char *e)
+{
+   e = strchr(e, ';');
+   return e && e[1] ? e + 1 : NULL;
+}
+
+/* At startup: the chain settings handed over by "upgrade" */
+static void handover_restore(void)
 {
-   running = 0;
-   if (verbose) {
-      printf("\nReceived signal %d, shutting down...\n", sig);
+   const char *s = getenv("XVCPI_HANDOVER");
+
+   if (!s)
+      return;
+   handover_env = strdup(s);
+   unsetenv("XVCPI_HANDOVER");
+   for (const char *e = handover_env; e; e = handover_next(e)) {
+      char name[32], backend[32];
+      unsigned int loops;
+      unsigned long long ps, min_ps, overhead_ps;
+      int valid, ndev;
+
+      if (sscanf(e, "chain %31s %31s %u %llu %d %llu %llu %d", name, backend, &loops,
+                 &ps, &valid, &min_ps, &overhead_ps, &ndev) != 8)
+         continue;
+      for (int i = 0; i < nchains; i++) {
+         struct chain *ch = &chains[i];
+         if (strcmp(ch->name, name))
+            continue;
+         ch->backend = strdup(backend);
+         ch->delay = loops;
+         ch->handover_ps = ps;
+         ch->tune.valid = valid;
+         ch->tune.min_delay_ps = min_ps;
+         ch->tune.overhead_ps = overhead_ps;
+         ch->tune.ndev = ndev;
+      }
    }
 }
 
-static void bcm2835gpio_cleanup(void)
+/* The levels a remote_bitbang client last wrote, if it was handed over */
+static void handover_rbb(int fd, struct rbb *r)
 {
-   if (chip) {
-      gpiod_chip_close(chip);
-      chip = NULL;
+   for (const char *e = handover_env; e; e = handover_next(e)) {
+      int rfd, tck, tms, tdi, tdo;
+
+      if (sscanf(e, "rbb %d %d %d %d %d", &rfd, &tck, &tms, &tdi, &tdo) == 5 && rfd == fd) {
+         r->tck = tck;
+         r->tms = tms;
+         r->tdi = tdi;
+         r->last_tdo = tdo;
+         return;
+      }
    }
 }
 
-static int sread(int fd, void *target, int len) {
-   unsigned char *t = target;
-   while (len) {
-      int r = read(fd, t, len);
-      if (r <= 0) {
-         if (r == 0) {
-            // Connection closed by client
-            return 0;
-         }
-         if (errno == EINTR) {
-            // Interrupted by signal, check if we should continue
-            if (!running) {
-               return -1;  // Signal to exit
-            }
-            continue;  // Retry the read
+/* The passed-in connections queue up for their chains, in the order passed */
+static void inherit_queue(void)
+{
+   for (int i = 0; i < ninherited; i++) {
+      int fd = inherited[i], p;
+      bool listening = false;
+
+      if (fd < 0 || (p = sock_port(fd, &listening)) < 0 || listening)
+         continue;
+      for (int c = 0; c < nchains; c++) {
+         struct chain *ch = &chains[c];
+         if (p != ch->port && p != ch->rbb_port)
+            continue;
+         inherited[i] = -1;
+         if (ch->nqueue == CHAIN_QUEUE || (p == ch->rbb_port && !rbb_accept(ch, fd))) {
+            client_drop(fd);
+            break;
          }
-         return r;  // Other error
+         if (p == ch->rbb_port)
+            handover_rbb(fd, &rbb_clients[fd]->rbb);
+         chain_enqueue(ch, fd);
+         break;
       }
-      t += r;
-      len -= r;
    }
-   return 1;
 }
 
-int handle_data(int fd) {
-   const char xvcInfo[] = "xvcServer_v1.0:2048\n";
-
-   do {
-      // Check if we should exit due to signal
-      if (!running) {
-         return -1;
-      }
+/* As control_wait(), but a request still queued at the deadline is withdrawn */
+static bool control_wait_until(struct chain *ch, struct control_req *r,
+                               const struct timespec *deadline)
+{
+   pthread_mutex_lock(&ch->ctl_lock);
+   while (!r->done && pthread_cond_timedwait(&ch->ctl_done, &ch->ctl_lock, deadline) == 0)
+      ;
+   if (!r->done) {
+      struct control_req **pp = &ch->ctl_head;
+      while (*pp && *pp != r)
+         pp = &(*pp)->next;
+      if (*pp)
+         *pp = r->next;
+      else
+         /* Taken by the engine thread already: it is running */
+         while (!r->done)
+            pthread_cond_wait(&ch->ctl_done, &ch->ctl_lock);
+   }
+   pthread_mutex_unlock(&ch->ctl_lock);
+   return r->done;
+}
 
-      char cmd[16];
-      unsigned char buffer[2048], result[1024];
-      memset(cmd, 0, 16);
+static void upgrade_resume(void)
+{
+   for (int i = 0; i < nchains; i++) {
+      struct control_req r = { .op = CTL_RESUME };
+      if (!chains[i].parked)
+         continue;
+      control_post(&chains[i], &r);
+      control_wait(&chains[i], &r);
+   }
+}
 
-      int read_result = sread(fd, cmd, 2);
-      if (read_result != 1) {
-         if (read_result == -1) {
-            return -1;  // Signal to exit
-         }
-         return 1;
+static void control_upgrade(const char *binary, FILE *out)
+{
+   static pthread_mutex_t once = PTHREAD_MUTEX_INITIALIZER;
+   struct control_req *r;
+   struct timespec deadline;
+   const char *busy = NULL;
+
+   /* The new binary would open them again, and truncate them */
+   for (int i = 0; i < nchains; i++) {
+      if (chains[i].record || chains[i].gpio.vcd) {
+         fprintf(out, "error %s: -R or -V file open, restart instead\n", chains[i].name);
+         return;
       }
+   }
+   if (access(binary, X_OK) < 0) {
+      fprintf(out, "error %s: %s\n", binary, strerror(errno));
+      return;
+   }
+   if (!upgrade_probe(binary)) {
+      fprintf(out, "error %s does not start\n", binary);
+      return;
+   }
+   if (pthread_mutex_trylock(&once)) {
+      fprintf(out, "error upgrade already in progress\n");
+      return;
+   }
+   r = calloc(nchains, sizeof(*r));
+   if (!r) {
+      fprintf(out, "error out of memory\n");
+      pthread_mutex_unlock(&once);
+      return;
+   }
+   for (int i = 0; i < nchains; i++) {
+      r[i].op = CTL_PARK;
+      control_post(&chains[i], &r[i]);
+   }
+   clock_gettime(CLOCK_REALTIME, &deadline);
+   deadline.tv_sec += UPGRADE_PARK_S;
+   for (int i = 0; i < nchains; i++)
+      if ((!control_wait_until(&chains[i], &r[i], &deadline) || !chains[i].parked) && !busy)
+         busy = chains[i].name;
+   free(r);
+   if (busy) {
+      upgrade_resume();
+      fprintf(out, "error %s did not park within %d s\n", busy, UPGRADE_PARK_S);
+      pthread_mutex_unlock(&once);
+      return;
+   }
 
-      if (memcmp(cmd, "ge", 2) == 0) {
-         int read_result = sread(fd, cmd, 6);
-         if (read_result != 1) {
-            if (read_result == -1) return -1;
-            return 1;
-         }
-         memcpy(result, xvcInfo, strlen(xvcInfo));
-         if (write(fd, result, strlen(xvcInfo)) != strlen(xvcInfo)) {
-            perror("write");
-            return 1;
-         }
-         if (verbose) {
-            printf("%u : Received command: 'getinfo'\n", (int)time(NULL));
-            printf("\t Replied with %s\n", xvcInfo);
-         }
-         break;
-      } else if (memcmp(cmd, "se", 2) == 0) {
-         int read_result = sread(fd, cmd, 9);
-         if (read_result != 1) {
-            if (read_result == -1) return -1;
-            return 1;
-         }
-         memcpy(result, cmd + 5, 4);
-         if (write(fd, result, 4) != 4) {
-            perror("write");
-            return 1;
-         }
-         if (verbose) {
-            printf("%u : Received command: 'settck'\n", (int)time(NULL));
-            printf("\t Replied with '%.*s'\n\n", 4, cmd + 5);
-         }
-         break;
-      } else if (memcmp(cmd, "sh", 2) == 0) {
-         int read_result = sread(fd, cmd, 4);
-         if (read_result != 1) {
-            if (read_result == -1) return -1;
-            return 1;
-         }
-         if (verbose) {
-            printf("%u : Received command: 'shift'\n", (int)time(NULL));
-         }
-      } else {
-         fprintf(stderr, "invalid cmd '%s'\n", cmd);
-         return 1;
-      }
+   nhandover = 0;
+   handover_names[0] = handover_state[0] = '\0';
+   for (int i = 0; i < nchains; i++)
+      handover_take(&chains[i]);
+   if (control_bound)
+      strncat(handover_state, "control bound;",
+              sizeof(handover_state) - strlen(handover_state) - 1);
+   handover_add(control_fd, "control");
+
+   /* On success this connection ends here, passed on to nobody */
+   fprintf(out, "ok upgrading to %s\n", binary);
+   fflush(out);
+   int err = upgrade_exec(binary);
+   fprintf(out, "error %s: %s, carrying on\n", binary, strerror(err));
+   upgrade_resume();
+   pthread_mutex_unlock(&once);
+}
 
-      // For shift command, continue to read length and data
-      int len;
-      read_result = sread(fd, &len, 4);
-      if (read_result != 1) {
-         if (read_result == -1) return -1;
-         fprintf(stderr, "reading length failed\n");
-         return 1;
+static void control_command(char *line, FILE *out)
+{
+   char *save, *argv[7];
+   int argc = 0;
+
+   for (char *t = strtok_r(line, " \t\r\n", &save); t && argc < 7;
+        t = strtok_r(NULL, " \t\r\n", &save))
+      argv[argc++] = t;
+   if (!argc)
+      return;
+
+   if (!strcmp(argv[0], "chains")) {
+      for (int i = 0; i < nchains; i++) {
+         const struct chain *ch = &chains[i];
+         fprintf(out, "chain %s port %d bitbang %d owner %d queued %d\n", ch->name,
+                 ch->port, ch->rbb_port, ch->owner, ch->nqueue);
       }
-
-      size_t nr_bytes = (len + 7) / 8;
-      if (nr_bytes * 2 > sizeof(buffer)) {
-         fprintf(stderr, "buffer size exceeded\n");
-         return 1;
+      fprintf(out, "ok %d chains\n", nchains);
+      return;
+   }
+   if (!strcmp(argv[0], "verbose")) {
+      if (argc != 2) {
+         fprintf(out, "error usage: verbose <level>\n");
+         return;
       }
-
-      read_result = sread(fd, buffer, nr_bytes * 2);
-      if (read_result != 1) {
-         if (read_result == -1) return -1;
-         fprintf(stderr, "reading data failed\n");
-         return 1;
+      verbose = atoi(argv[1]);
+      fprintf(out, "ok verbose %d\n", verbose);
+      return;
+   }
+   if (!strcmp(argv[0], "upgrade")) {
+      if (argc > 2) {
+         fprintf(out, "error usage: upgrade [binary]\n");
+         return;
       }
-      memset(result, 0, nr_bytes);
+      control_upgrade(argc == 2 ? argv[1] : self_path, out);
+      return;
+   }
 
-      if (verbose) {
-         printf("\tNumber of Bits  : %d\n", len);
-         printf("\tNumber of Bytes : %zu \n", nr_bytes);
-         printf("\n");
-      }
-
-      bcm2835gpio_write(0, 1, 1);
-
-      size_t bytesLeft = nr_bytes;
-      int bitsLeft = len;
-      size_t byteIndex = 0;
-      uint32_t tdi, tms, tdo;
-
-      while (bytesLeft > 0) {
-         tms = 0;
-         tdi = 0;
-         tdo = 0;
-         if (bytesLeft >= 4) {
-            memcpy(&tms, &buffer[byteIndex], 4);
-            memcpy(&tdi, &buffer[byteIndex + nr_bytes], 4);
-
-            tdo = bcm2835gpio_xfer(32, tms, tdi);
-            memcpy(&result[byteIndex], &tdo, 4);
-
-            bytesLeft -= 4;
-            bitsLeft -= 32;
-            byteIndex += 4;
-
-            if (verbose) {
-               printf("LEN : 0x%08x\n", 32);
-               printf("TMS : 0x%08x\n", tms);
-               printf("TDI : 0x%08x\n", tdi);
-               printf("TDO : 0x%08x\n", tdo);
-            }
+   size_t c = 0;
+   while (c < sizeof(control_cmds) / sizeof(control_cmds[0]) &&
+          strcmp(argv[0], control_cmds[c].name))
+      c++;
+   if (c == sizeof(control_cmds) / sizeof(control_cmds[0])) {
+      fprintf(out, "error unknown command '%s'\n", argv[0]);
+      return;
+   }
+   if (argc != 2 + control_cmds[c].nargs) {
+      fprintf(out, "error usage: %s\n", control_cmds[c].usage);
+      return;
+   }
 
-         } else {
-            memcpy(&tms, &buffer[byteIndex], bytesLeft);
-            memcpy(&tdi, &buffer[byteIndex + nr_bytes], bytesLeft);
+   struct chain *ch = NULL;
+   for (int i = 0; i < nchains; i++)
+      if (!strcmp(chains[i].name, argv[1]))
+         ch = &chains[i];
+   if (!ch) {
+      fprintf(out, "error no chain named '%s'\n", argv[1]);
+      return;
+   }
 
-            tdo = bcm2835gpio_xfer(bitsLeft, tms, tdi);
-            memcpy(&result[byteIndex], &tdo, bytesLeft);
+   struct control_req *r = calloc(1, sizeof(*r));
+   if (!r) {
+      fprintf(out, "error out of memory\n");
+      return;
+   }
+   r->op = control_cmds[c].op;
+   for (int i = 0; i < control_cmds[c].nargs; i++) {
+      char *end;
+      r->arg[i] = strtol(argv[2 + i], &end, 0);
+      if ((r->op == CTL_DELAY || r->op == CTL_PINS) && (*end || r->arg[i] < 0 ||
+                                                        (r->op == CTL_DELAY && !r->arg[i]))) {
+         fprintf(out, "error usage: %s\n", control_cmds[c].usage);
+         free(r);
+         return;
+      }
+   }
+   if (r->op == CTL_TRACE) {
+      if (strcmp(argv[2], "on") && strcmp(argv[2], "off")) {
+         fprintf(out, "error usage: %s\n", control_cmds[c].usage);
+         free(r);
+         return;
+      }
+      r->arg[0] = !strcmp(argv[2], "on");
+   }
+   if (control_cmds[c].nargs == 1)
+      snprintf(r->path, sizeof(r->path), "%s", argv[2]);
 
-            bytesLeft = 0;
+   control_submit(ch, r, out);
+   free(r);
+}
 
-            if (verbose) {
-               printf("LEN : 0x%08x\n", bitsLeft);
-               printf("TMS : 0x%08x\n", tms);
-               printf("TDI : 0x%08x\n", tdi);
-               printf("TDO : 0x%08x\n", tdo);
-            }
-            break;
-         }
+static void *control_client(void *arg)
+{
+   int fd = (intptr_t)arg;
+   FILE *in = fdopen(fd, "r"), *out = fdopen(dup(fd), "w");
+   char line[512];
+
+   if (in && out) {
+      while (running && fgets(line, sizeof(line), in)) {
+         control_command(line, out);
+         fflush(out);
       }
+   }
+   if (out)
+      fclose(out);
+   if (in)
+      fclose(in);
+   else
+      close(fd);
+   return NULL;
+}
 
-      bcm2835gpio_write(0, 1, 0);
+static void *control_thread(void *arg)
+{
+   int s = (intptr_t)arg;
 
-      if (write(fd, result, nr_bytes) != (ssize_t)nr_bytes) {
-         perror("write");
-         return 1;
+   while (running) {
+      /*
+       * Waiting in accept() would hold on to the fd number it hands out
+       * next, which "upgrade" may need for a socket it passes on
+       */
+      struct pollfd pfd = { .fd = s, .events = POLLIN };
+      if (poll(&pfd, 1, -1) < 0)
+         continue;
+      int fd = accept(s, NULL, NULL);
+      pthread_t t;
+
+      if (fd < 0) {
+         if (errno != EINTR)
+            perror("control accept");
+         continue;
+      }
+      if (pthread_create(&t, NULL, control_client, (void *)(intptr_t)fd) != 0) {
+         close(fd);
+         continue;
       }
+      pthread_detach(t);
+   }
+   return NULL;
+}
 
-   } while (1);
-   
-   return 0;
+/* The socket is made for the server's user only */
+static int control_open(const char *path)
+{
+   struct sockaddr_un addr = { .sun_family = AF_UNIX };
+   int s;
+
+   if (strlen(path) >= sizeof(addr.sun_path)) {
+      fprintf(stderr, "%s: path too long for a socket\n", path);
+      return -1;
+   }
+   strcpy(addr.sun_path, path);
+   s = inherit_take(0, path);
+   if (s >= 0) {
+      /* Still ours to remove if the binary before "upgrade" made it */
+      control_bound = handover_env && strstr(handover_env, "control bound;");
+      if (verbose)
+         printf("Control socket: %s (passed in)\n", path);
+      return s;
+   }
+   s = socket(AF_UNIX, SOCK_STREAM, 0);
+   if (s < 0) {
+      perror("socket");
+      return -1;
+   }
+   unlink(path);
+   mode_t mask = umask(0177);
+   int err = bind(s, (struct sockaddr *)&addr, sizeof(addr));
+   umask(mask);
+   if (err < 0 || listen(s, 4) < 0) {
+      perror(path);
+      close(s);
+      return -1;
+   }
+   control_bound = true;
+   if (verbose)
+      printf("Control socket: %s\n", path);
+   return s;
 }
 
+static const struct option long_options[] = {
+   { "verbose",      no_argument,       NULL, 'v' },
+   { "counter-wait", no_argument,       NULL, 'w' },
+   { "governor",     no_argument,       NULL, 'g' },
+   { "autotune",     no_argument,       NULL, 'a' },
+   { "iterations",   required_argument, NULL, 'n' },
+   { "backend",      required_argument, NULL, 'b' },
+   { "delay",        required_argument, NULL, 'd' },
+   { "port",         required_argument, NULL, 'p' },
+   { "bitbang",      required_argument, NULL, 'B' },
+   { "queue-wait",   required_argument, NULL, 'q' },
+   { "idle-timeout", required_argument, NULL, 'T' },
+   { "keepalive",    required_argument, NULL, 'A' },
+   { "control",      required_argument, NULL, 'U' },
+   { "tck",          required_argument, NULL, 'c' },
+   { "tms",          required_argument, NULL, 'm' },
+   { "tdi",          required_argument, NULL, 'i' },
+   { "tdo",          required_argument, NULL, 'o' },
+   { "gang",         required_argument, NULL, 'G' },
+   { "config",       required_argument, NULL, 'f' },
+   { "play",         required_argument, NULL, 'P' },
+   { "program",      required_argument, NULL, 'X' },
+   { "compile",      required_argument, NULL, 'K' },
+   { "record",       required_argument, NULL, 'R' },
+   { "crc",          no_argument,       NULL, 'k' },
+   { "chain",        required_argument, NULL, 'C' },
+   { "extensions",   no_argument,       NULL, 'x' },
+   { "vector-size",  required_argument, NULL, 'S' },
+   { "trace",        no_argument,       NULL, 't' },
+   { "ir-lengths",   required_argument, NULL, 'I' },
+   { "vcd",          required_argument, NULL, 'V' },
+   { "vcd-ring",     required_argument, NULL, 'W' },
+   { NULL, 0, NULL, 0 }
+};
+
 int main(int argc, char **argv) {
-   int i;
-   int s;
+   const char *config = NULL;
+   const char *play_file = NULL, *play_chain = NULL;
+   const char *compile_file = NULL, *record_file = NULL;
+   bool crc_checks = false;
+   file_job job = NULL;
    int c;
 
-   struct sockaddr_in address;
-
    opterr = 0;
 
-   while ((c = getopt(argc, argv, "vd:p:c:m:i:o:")) != -1) {
+   while ((c = getopt_long(argc, argv, "vwgakxtn:b:d:p:B:q:T:A:U:c:m:i:o:G:f:P:X:K:R:C:S:I:V:W:", long_options, NULL)) != -1) {
       switch (c) {
       case 'v':
          verbose = 1;
          break;
+      case 'w':
+         timing.counter_wait = true;
+         break;
+      case 'g':
+         want_performance = true;
+         break;
+      case 'b':
+         gpio_backend = optarg;
+         break;
+      case 'a':
+         autotune_startup = true;
+         break;
+      case 'n':
+         autotune_iterations = atoi(optarg);
+         if (autotune_iterations <= 0)
+            autotune_iterations = AUTOTUNE_ITERATIONS;
+         break;
       case 'd':
          jtag_delay = atoi(optarg);
          if (jtag_delay <= 0)
@@ -354,6 +2637,28 @@ int main(int argc, char **argv) {
          if (port <= 0)
              port = 2542; // Default to 2542 if invalid
          break;
+      case 'B':
+         rbb_port = atoi(optarg);
+         if (rbb_port <= 0 || rbb_port > 65535) {
+            fprintf(stderr, "Invalid remote_bitbang port '%s'\n", optarg);
+            return 1;
+         }
+         break;
+      case 'U':
+         control_path = optarg;
+         break;
+      case 'q':
+      case 'T':
+      case 'A': {
+         char *end;
+         long v = strtol(optarg, &end, 0);
+         if (end == optarg || *end || v < 0 || v > 86400) {
+            fprintf(stderr, "Invalid time '%s' (seconds)\n", optarg);
+            return 1;
+         }
+         *(c == 'q' ? &queue_wait_s : c == 'T' ? &idle_timeout_s : &keepalive_s) = v;
+         break;
+      }
       case 'c':
          tck_gpio = atoi(optarg);
          if (tck_gpio < 0)
@@ -374,15 +2679,108 @@ int main(int argc, char **argv) {
          if (tdo_gpio < 0)
              tdo_gpio = 9; // Default to 9 if invalid
          break;
+      case 'G':
+         ngang_gpio = parse_gang(optarg, gang_gpio);
+         if (ngang_gpio < 0) {
+            fprintf(stderr, "Invalid gang TDO pins '%s' (at most %d)\n", optarg, MAX_GANG);
+            return 1;
+         }
+         break;
+      case 'f':
+         config = optarg;
+         break;
+      case 'P':
+         job = svf_play;
+         play_file = optarg;
+         break;
+      case 'X':
+         job = bitstream_program;
+         play_file = optarg;
+         break;
+      case 'K':
+         compile_file = optarg;
+         break;
+      case 'R':
+         record_file = optarg;
+         break;
+      case 'k':
+         crc_checks = true;
+         break;
+      case 'C':
+         play_chain = optarg;
+         break;
+      case 'x':
+         xvc_extensions = true;
+         break;
+      case 't':
+         trace_scans = true;
+         break;
+      case 'I':
+         nir_lengths = parse_ir_lengths(optarg, ir_lengths);
+         if (nir_lengths < 0) {
+            fprintf(stderr, "Invalid IR lengths '%s' (1 to 32 bits, at most %d devices)\n",
+                    optarg, MAX_CHAIN_DEVICES);
+            return 1;
+         }
+         break;
+      case 'V':
+         vcd_file = optarg;
+         break;
+      case 'W':
+         vcd_ring_kbits = strtoull(optarg, NULL, 0);
+         if (vcd_ring_kbits == 0) {
+            fprintf(stderr, "Invalid capture size '%s' (kbits)\n", optarg);
+            return 1;
+         }
+         break;
+      case 'S':
+         vector_size = atoi(optarg);
+         if (vector_size < 2 || vector_size > XVC_MAX_VECTOR || vector_size % 2) {
+            fprintf(stderr, "Invalid vector size '%s' (even, 2 to %d)\n", optarg, XVC_MAX_VECTOR);
+            return 1;
+         }
+         break;
       case '?':
-         fprintf(stderr, "usage: %s [-v] [-d delay] [-p port] [-c tck_pin] [-m tms_pin] [-i tdi_pin] [-o tdo_pin]\n", *argv);
+         fprintf(stderr, "usage: %s [-v] [-w] [-g] [-a] [-n count] [-b backend] [-d delay] [-p port] [-B port] [-q secs] [-T secs] [-A secs] [-U socket] [-c tck_pin] [-m tms_pin] [-i tdi_pin] [-o tdo_pin] [-G tdo_pins] [-f chains.conf] [-P file.svf | -X file.bit | -K file.svf] [-R file.xvec [-k]] [-C chain] [-x] [-S bytes] [-t [-I ir_lengths]] [-V file.vcd [-W kbits]]\n", *argv);
          fprintf(stderr, "  -v          : verbose output\n");
+         fprintf(stderr, "  -w          : time delays with the system counter instead of spin loops\n");
+         fprintf(stderr, "  -g          : select the performance governor while a client is connected\n");
+         fprintf(stderr, "  -a          : auto-tune TCK at startup (SIGUSR1 re-tunes when idle)\n");
+         fprintf(stderr, "  -n count    : auto-tune iterations per delay (default: %d)\n", AUTOTUNE_ITERATIONS);
+         fprintf(stderr, "  -b backend  : GPIO backend (default: fastest usable):");
+         for (int b = 0; gpio_backends[b]; b++)
+            fprintf(stderr, " %s", gpio_backends[b]->name);
+         fprintf(stderr, "\n");
          fprintf(stderr, "  -d delay    : JTAG delay (default: %d)\n", JTAG_DELAY);
          fprintf(stderr, "  -p port     : TCP port (default: %d)\n", 2542);
+         fprintf(stderr, "  -B port     : also serve OpenOCD remote_bitbang on this TCP port\n");
+         fprintf(stderr, "  -q secs     : a connection to a busy chain waits this long, 0 rejects it (default: 10)\n");
+         fprintf(stderr, "  -T secs     : drop the chain's owner after this long without a command (default: never)\n");
+         fprintf(stderr, "  -A secs     : TCP keepalive probes after this long idle, 0 for none (default: 5)\n");
+         fprintf(stderr, "  -U path     : control socket for settings, stats and jobs (see README)\n");
          fprintf(stderr, "  -c pin      : TCK GPIO pin (default: %d)\n", 11);
          fprintf(stderr, "  -m pin      : TMS GPIO pin (default: %d)\n", 25);
          fprintf(stderr, "  -i pin      : TDI GPIO pin (default: %d)\n", 10);
          fprintf(stderr, "  -o pin      : TDO GPIO pin (default: %d)\n", 9);
+         fprintf(stderr, "  -G pins     : gang mode, TDO pins of further boards sharing TCK/TMS/TDI\n");
+         fprintf(stderr, "  -f file     : serve the JTAG chains defined in file\n");
+         fprintf(stderr, "  -P file     : play an SVF file instead of serving, exit 0 pass, 2 TDO mismatch\n");
+         fprintf(stderr, "  -X file     : program a Xilinx .bit/.bin file instead of serving, exit 0 DONE, 2 not DONE\n");
+         fprintf(stderr, "  -K file     : compile an SVF file to vectors, into the cache or the -R file\n");
+         fprintf(stderr, "  -R file     : record the XVC sessions served as vectors\n");
+         fprintf(stderr, "  -k          : with -K or -R, keep TDO checks as CRC-32s instead of data\n");
+         fprintf(stderr, "  -C name     : chain from -f for -P, -X, -R or -V (default: the first)\n");
+         fprintf(stderr, "  -x          : offer protocol extensions (wshift:, zshift:, mshift:) in getinfo\n");
+         fprintf(stderr, "  -t          : log the IR and DR scans of the clients\n");
+         fprintf(stderr, "  -I lengths  : with -t, IR length of each device from TDO (default: one device)\n");
+         fprintf(stderr, "  -V file     : write the waveform of the shifts (-P, -X or the -C chain) to a VCD file\n");
+         fprintf(stderr, "  -W kbits    : with -V, keep only the last kbits, written when -P/-X fail or on SIGHUP\n");
+         fprintf(stderr, "  -S bytes    : largest shift offered in getinfo, TMS and TDI (default: 2048, max: %d)\n", XVC_MAX_VECTOR);
+         fprintf(stderr, "Long options: --verbose --counter-wait --governor --autotune --iterations\n"
+                         "  --backend --delay --port --bitbang --queue-wait --idle-timeout --keepalive --control\n"
+                         "  --tck --tms --tdi --tdo --gang --config --play\n"
+                         "  --program --compile --record --crc --chain --extensions --vector-size\n"
+                         "  --trace --ir-lengths --vcd --vcd-ring\n");
          return 1;
       }
    }
@@ -390,143 +2788,142 @@ int main(int argc, char **argv) {
    if (verbose)
       printf("jtag_delay=%d\n", jtag_delay);
 
+   if (vcd_ring_kbits && !vcd_file) {
+      fprintf(stderr, "-W needs a -V file\n");
+      return 1;
+   }
+
    // Validate GPIO pins
    if (tck_gpio < 0 || tms_gpio < 0 || tdi_gpio < 0 || tdo_gpio < 0) {
       fprintf(stderr, "Error: Invalid GPIO pin numbers\n");
       return 1;
    }
-   
-   if (verbose) {
-      printf("GPIO Configuration:\n");
-      printf("  TCK: GPIO%d\n", tck_gpio);
-      printf("  TMS: GPIO%d\n", tms_gpio);
-      printf("  TDI: GPIO%d\n", tdi_gpio);
-      printf("  TDO: GPIO%d\n", tdo_gpio);
-      printf("  Port: %d\n", port);
-   }
 
-   if (!bcm2835gpio_init()) {
-      fprintf(stderr,"Failed in bcm2835gpio_init()\n");
-      return -1;
-   }
-
-   // Set up signal handler for cleanup
-   signal(SIGINT, signal_handler);
-   signal(SIGTERM, signal_handler);
+   if (!root_init())
+      return 1;
+   if (compile_file)
+      return !root_end() || svf_compile(compile_file, record_file, crc_checks) ? 1 : 0;
 
-   s = socket(AF_INET, SOCK_STREAM, 0);
+   if (config ? !load_config(config) : !chain_add("default"))
+      return 1;
+   if (!chains_check())
+      return 1;
 
-   if (s < 0) {
-      perror("socket");
-      bcm2835gpio_cleanup();
+   struct chain *selected = find_chain(play_chain);
+   if (!selected)
       return 1;
+   if (play_file)
+      return run_file(selected, job, play_file);
+   if (record_file) {
+      selected->record = vec_writer_open(record_file, 0, VEC_RECORDED |
+                                         (crc_checks ? VEC_CRC_CHECKS : 0));
+      if (!selected->record)
+         return 1;
    }
 
-   i = 1;
-   setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &i, sizeof i);
-
-   address.sin_addr.s_addr = INADDR_ANY;
-   address.sin_port = htons(port);
-   address.sin_family = AF_INET;
+   timing_init();
+   self_argv = argv;
+   ssize_t len = readlink("/proc/self/exe", self_path, sizeof(self_path) - 1);
+   if (len > 0)
+      self_path[len] = '\0';
+   inherit_fds();
+   handover_restore();
 
-   if (bind(s, (struct sockaddr*) &address, sizeof(address)) < 0) {
-      perror("bind");
-      bcm2835gpio_cleanup();
+   if (!root_begin())
       return 1;
+   governor_open();
+   for (int i = 0; i < nchains; i++) {
+      if (!chain_open(&chains[i]) || !chain_listen(&chains[i])) {
+         for (int j = 0; j <= i; j++)
+            chain_close(&chains[j]);
+         return 1;
+      }
    }
-
-   if (listen(s, 0) < 0) {
-      perror("listen");
-      bcm2835gpio_cleanup();
+   if (!root_end() || !chain_capture(selected)) {
+      for (int i = 0; i < nchains; i++)
+         chain_close(&chains[i]);
       return 1;
    }
-
-   if (verbose) {
-      printf("XVC server listening on port %d\n", port);
-      printf("Use Ctrl+C to stop the server\n");
+   inherit_queue();
+
+   // Set up signal handler for cleanup; no SA_RESTART so that SIGUSR2
+   // interrupts an engine thread blocked in read()
+   struct sigaction sa;
+   memset(&sa, 0, sizeof(sa));
+   sa.sa_handler = signal_handler;
+   sigemptyset(&sa.sa_mask);
+   sigaction(SIGINT, &sa, NULL);
+   sigaction(SIGTERM, &sa, NULL);
+   sigaction(SIGUSR1, &sa, NULL);
+   sigaction(SIGUSR2, &sa, NULL);
+   sigaction(SIGHUP, &sa, NULL);
+   // A client that hangs up shows as a failed write, not a dead server
+   signal(SIGPIPE, SIG_IGN);
+
+   // Engine threads leave the process signals to the main thread
+   sigset_t block, orig;
+   sigemptyset(&block);
+   sigaddset(&block, SIGINT);
+   sigaddset(&block, SIGTERM);
+   sigaddset(&block, SIGUSR1);
+   sigaddset(&block, SIGHUP);
+   pthread_sigmask(SIG_BLOCK, &block, &orig);
+
+   for (int i = 0; i < nchains; i++) {
+      int err = pthread_create(&chains[i].thread, NULL, chain_thread, &chains[i]);
+      if (err) {
+         fprintf(stderr, "%s: cannot start engine thread: %s\n", chains[i].name,
+                 strerror(err));
+         running = 0;
+         nchains = i;
+         break;
+      }
    }
 
-   fd_set conn;
-   int maxfd = 0;
-
-   FD_ZERO(&conn);
-   FD_SET(s, &conn);
+   pthread_t control;
+   if (control_path && running) {
+      control_fd = control_open(control_path);
+      if (control_fd < 0 ||
+          pthread_create(&control, NULL, control_thread, (void *)(intptr_t)control_fd) != 0)
+         running = 0;
+   }
+   inherit_close();
 
-   maxfd = s;
+   if (verbose)
+      printf("Use Ctrl+C to stop the server\n");
 
+   // A SIGHUP is taken by each engine thread at its next command, or at
+   // once if it is waiting in select()
+   unsigned int vcd_seen = 0;
    while (running) {
-      fd_set read = conn, except = conn;
-      int fd;
-      
-      // Use timeout so we can check running flag
-      struct timeval timeout;
-      timeout.tv_sec = 1;
-      timeout.tv_usec = 0;
-
-      if (select(maxfd + 1, &read, 0, &except, &timeout) < 0) {
-         if (errno == EINTR) {
-            // Interrupted by signal, continue loop
-            continue;
-         }
-         perror("select");
-         break;
+      sigsuspend(&orig);
+      if (vcd_seen != (unsigned int)vcd_requested) {
+         vcd_seen = vcd_requested;
+         for (int i = 0; i < nchains; i++)
+            pthread_kill(chains[i].thread, SIGUSR2);
       }
+   }
 
-      for (fd = 0; fd <= maxfd; ++fd) {
-         if (FD_ISSET(fd, &read)) {
-            if (fd == s) {
-               int newfd;
-               socklen_t nsize = sizeof(address);
-
-               newfd = accept(s, (struct sockaddr*) &address, &nsize);
+   for (int i = 0; i < nchains; i++) {
+      struct chain *ch = &chains[i];
 
-               if (verbose)
-                  printf("connection accepted - fd %d\n", newfd);
-               if (newfd < 0) {
-                  perror("accept");
-               } else {
-                 int flag = 1;
-                 int optResult = setsockopt(newfd,
-                                               IPPROTO_TCP,
-                                               TCP_NODELAY,
-                                               (char *)&flag,
-                                               sizeof(int));
-                 if (optResult < 0)
-                    perror("TCP_NODELAY error");
-                  if (newfd > maxfd) {
-                     maxfd = newfd;
-                  }
-                  FD_SET(newfd, &conn);
-               }
-            }
-            else {
-               int result = handle_data(fd);
-               if (result == -1) { // Check for signal to exit
-                  // handle_data returned -1, indicating exit
-                  goto cleanup_and_exit;
-               }
-               else if (result) {
-                  if (verbose)
-                     printf("connection closed - fd %d\n", fd);
-                  close(fd);
-                  FD_CLR(fd, &conn);
-               }
-            }
-         }
-         else if (FD_ISSET(fd, &except)) {
-            if (verbose)
-               printf("connection aborted - fd %d\n", fd);
-            close(fd);
-            FD_CLR(fd, &conn);
-            if (fd == s)
-               break;
-         }
+      while (pthread_tryjoin_np(ch->thread, NULL) == EBUSY) {
+         pthread_kill(ch->thread, SIGUSR2);
+         usleep(10000);
+      }
+      if (verbose) {
+         printf("%s: %u connections\n", ch->name, ch->connections);
+         print_stats(ch, "total", &ch->total);
       }
+      if (ch->record && vec_writer_close(ch->record, true) && verbose)
+         printf("%s: %u shifts recorded to %s\n", ch->name, ch->record_shifts, record_file);
+      chain_close(ch);
    }
-   
-cleanup_and_exit:
-   bcm2835gpio_cleanup();
-   return 0;
+
+   if (control_bound)
+      unlink(control_path);
+   governor_performance(false);
+   return control_path && control_fd < 0 ? 1 : 0;
 }
 
 /*